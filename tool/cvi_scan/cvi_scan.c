@@ -3,9 +3,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "libnkf.h"
 
@@ -146,19 +148,58 @@ typedef struct {
 		uint8_t		feeNameLength:8;					// uimsbf 8bit
 		uint8_t		*feeName;							// uimsbf byte[feeNameLength]
 														// 記述した ES 群について、その料金を説明する
+		struct sdescArray	*service;					// 登録先サービス (CVI索引のキー)
 } DescriptorXCB;
 
-typedef	struct {
+typedef	struct sdescArray {
 		SdtDescriptor	sdesc;
 		DescriptorX48	*x48;
-		DescriptorXCB	**xCBArray;
+		DescriptorXCB	**xCBArray;					// 登録順 NULL終端
+		size_t			numOfXCB;
+		size_t			maxXCB;
+		struct sdtArray	*sdt;						// 登録先SDT (サービス索引のキー)
 	} SDESCARRAY;
 
-typedef struct {
+typedef struct sdtArray {
 	SDT			sdt;
-	 SDESCARRAY	**sdescArray;
+	 SDESCARRAY	**sdescArray;						// 登録順 NULL終端
+	size_t		numOfSdesc;
+	size_t		maxSdesc;
 } SDTARRAY;
 
+// アリーナブロック 使い切ったら次のブロックを確保して連結する
+typedef struct arenaBlock {
+	struct arenaBlock	*next;
+	size_t				size;				// data のbyte数
+	size_t				used;				// 使用済みbyte数
+	_Alignas(max_align_t) uint8_t data[];
+} ARENA_BLOCK;
+
+// モデルの要素をまとめて確保し arenaFree で一括解放する
+typedef struct {
+	ARENA_BLOCK	*block;						// 現在のブロック (先頭)
+} ARENA;
+
+// オープンアドレス法のハッシュ索引 entry==NULL:空き
+typedef struct {
+	void		**entry;
+	uint64_t	*hash;
+	size_t		numOfSlots;
+	size_t		numOfEntries;
+} HASH_INDEX;
+
+// 全ファイルを通したサービスモデル
+typedef struct {
+	SDTARRAY	**sdtArray;						// 登録順 NULL終端
+	size_t		numOfSdt;
+	size_t		maxSdt;
+	HASH_INDEX	sdtIndex;						// (onid, tsid) → SDTARRAY
+	HASH_INDEX	serviceIndex;					// (onid, tsid, sid) → SDESCARRAY
+	HASH_INDEX	cviIndex;						// (サービス, CVI) → DescriptorXCB
+	ARENA		arena;							// 上記の配列・索引・要素の確保先
+	ARIB_CACHE	*textCache;						// サービス名・料金名の変換結果
+} CVI_MODEL;
+
 typedef struct {
 	SDT				*sdt;
 	SdtDescriptor	*sdesc;
@@ -166,77 +207,287 @@ typedef struct {
 	DescriptorXCB	**xCBArray;
 } XMLOUTPUT;
 
+// original_network_id → 出力グループ名
+typedef struct {
+	uint16_t	originalNetworkId;
+	const char	*label;							// "":出力しない
+} NETWORK_LABEL;
+
+// 出力グループ 同じ名前のネットワークのサービスをまとめる
+typedef struct {
+	const char	*label;
+	uint16_t	originalNetworkId;				// グループ内の最小onid グループの出力順
+	XMLOUTPUT	**xml;							// 登録順 NULL終端
+	size_t		numOfXml;
+	size_t		maxXml;
+} NETWORK_GROUP;
+
 
-static SDTARRAY *sdtArraySet(SDTARRAY ***sdtArray, SDT *sdt)
+/************************************
+ * アリーナ                         *
+ * 個別の解放はせず arenaFree で    *
+ * ブロック単位にまとめて解放する   *
+*************************************/
+#define ARENA_BLOCK_SIZE	(64*1024)	// アリーナ1ブロックのbyte数
+
+// 0 クリアした size byte を返す 戻値:NULL メモリ不足
+static void *arenaAlloc(ARENA *arena, size_t size)
 {
+	ARENA_BLOCK *b = arena->block;
 
-	if(*sdtArray == NULL){
-		if((*sdtArray = (SDTARRAY **)calloc(1, sizeof(SDTARRAY *)))==NULL){
+	size = (size+_Alignof(max_align_t)-1) & ~(_Alignof(max_align_t)-1);
+	if(b==NULL || b->size-b->used < size){
+		size_t blockSize = (size>ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+		if((b = malloc(sizeof(ARENA_BLOCK)+blockSize))==NULL){
 			return NULL;
 		}
-		**sdtArray = NULL;
+		b->size	= blockSize;
+		b->used	= 0;
+		// 大きな要素専用のブロックは現在のブロックの後ろにつなぎ 残りを使い続ける
+		if(size>ARENA_BLOCK_SIZE/4 && arena->block!=NULL){
+			b->next = arena->block->next;
+			arena->block->next = b;
+		}else{
+			b->next = arena->block;
+			arena->block = b;
+		}
 	}
+	void *p = b->data+b->used;
+	b->used += size;
+	memset(p, '\0', size);
+	return(p);
+}
 
-	bool find = false;
-	int arrSize;
-	for(arrSize=0;*((*sdtArray)+arrSize)!=NULL ;arrSize++){
-		if((*((*sdtArray)+arrSize))->sdt.transportStreamId == sdt->transportStreamId){
-			find = true;
+static void arenaFree(ARENA *arena)
+{
+	while(arena->block!=NULL){
+		ARENA_BLOCK *next = arena->block->next;
+		free(arena->block);
+		arena->block = next;
+	}
+}
+
+/************************************
+ * ハッシュ索引                     *
+ * スロットはアリーナから確保する   *
+ * 広げた後の古いスロットは         *
+ * アリーナ解放まで残す             *
+*************************************/
+#define INDEX_INIT_SLOTS	64			// 初期スロット数 (2のべき乗)
+
+static uint64_t hashMix(uint64_t x)
+{
+	x ^= x>>33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x>>33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x>>33;
+	return(x);
+}
+
+// FNV-1a 64bit
+static uint64_t hashBytes(uint64_t h, const uint8_t *p, size_t len)
+{
+	h ^= 0xcbf29ce484222325ULL;
+	for(size_t i=0; i<len; i++){
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return(h);
+}
+
+// hash に一致し match が真を返す要素のスロット または挿入先の空きスロットを返す
+static void **indexFind(ARENA *arena, HASH_INDEX *idx, uint64_t hash, bool (*match)(const void *entry, const void *key), const void *key)
+{
+	size_t k;
+
+	if(idx->entry==NULL){
+		idx->entry	= arenaAlloc(arena, INDEX_INIT_SLOTS*sizeof(void *));
+		idx->hash	= arenaAlloc(arena, INDEX_INIT_SLOTS*sizeof(uint64_t));
+		if(idx->entry==NULL || idx->hash==NULL){
+			return NULL;
+		}
+		idx->numOfSlots = INDEX_INIT_SLOTS;
+	}
+	for(k=hash & (idx->numOfSlots-1); idx->entry[k]!=NULL; k=(k+1) & (idx->numOfSlots-1)){
+		if(idx->hash[k]==hash && match(idx->entry[k], key)){
 			break;
 		}
-	} 
-	if(find){
-		return(*((*sdtArray)+arrSize));
 	}
+	return(&idx->entry[k]);
+}
+
+// indexFind が返した空きスロットに登録する 負荷率 3/4 を超えたら倍に広げる
+static bool indexInsert(ARENA *arena, HASH_INDEX *idx, void **slot, uint64_t hash, void *entry)
+{
+	size_t k = slot-idx->entry;
+
+	idx->entry[k]	= entry;
+	idx->hash[k]	= hash;
+	idx->numOfEntries++;
+	if(idx->numOfEntries*4 <= idx->numOfSlots*3){
+		return(true);
+	}
+
+	size_t numOfSlots = idx->numOfSlots*2;
+	void **newEntry = arenaAlloc(arena, numOfSlots*sizeof(void *));
+	uint64_t *newHash = arenaAlloc(arena, numOfSlots*sizeof(uint64_t));
+	if(newEntry==NULL || newHash==NULL){
+		// 広げられなくても空きがあるうちは使える
+		return(idx->numOfEntries < idx->numOfSlots);
+	}
+	for(size_t i=0; i<idx->numOfSlots; i++){
+		if(idx->entry[i]==NULL){
+			continue;
+		}
+		for(k=idx->hash[i] & (numOfSlots-1); newEntry[k]!=NULL; k=(k+1) & (numOfSlots-1)){
+			;
+		}
+		newEntry[k]	= idx->entry[i];
+		newHash[k]	= idx->hash[i];
+	}
+	idx->entry		= newEntry;
+	idx->hash		= newHash;
+	idx->numOfSlots	= numOfSlots;
+	return(true);
+}
 
-	SDTARRAY *sdtarr = (SDTARRAY *)calloc(1, sizeof(SDTARRAY ));
+// 登録順の配列に追加する NULL終端を保ったまま容量を倍々に広げる
+// 広げる際はアリーナに新しい配列を確保して写す 古い配列はアリーナ解放まで残す
+static bool arrayGrow(ARENA *arena, void **array, size_t *max, size_t need, size_t size)
+{
+	if(need <= *max){
+		return(true);
+	}
+	size_t newMax = (*max==0) ? 8 : *max*2;
+	void *p;
+	if(newMax<need){
+		newMax = need;
+	}
+	if((p = arenaAlloc(arena, size*newMax))==NULL){
+		return(false);
+	}
+	if(*array!=NULL){
+		memcpy(p, *array, size*(*max));
+	}
+	*array	= p;
+	*max	= newMax;
+	return(true);
+}
+
+#define ARRAY_APPEND(arena, array, num, max, item) \
+	(arrayGrow((arena), (void **)&(array), &(max), (num)+2, sizeof(*(array))) \
+	 && ((array)[(num)] = (item), (array)[++(num)] = NULL, true))
+
+/************************************
+ * サービスモデルへの登録           *
+ * 登録済みなら登録済みのものを返す *
+*************************************/
+typedef struct {
+	uint16_t	originalNetworkId;
+	uint16_t	transportStreamId;
+	uint16_t	serviceId;
+	SDTARRAY	*sdt;
+	SDESCARRAY	*service;
+	uint8_t		*cvi;
+	uint8_t		cviLength;
+} MODEL_KEY;
+
+static bool sdtMatch(const void *entry, const void *key)
+{
+	const SDTARRAY *sdtArray = entry;
+	const MODEL_KEY *k = key;
+
+	return(sdtArray->sdt.originalNetworkId==k->originalNetworkId && sdtArray->sdt.transportStreamId==k->transportStreamId);
+}
+
+static bool serviceMatch(const void *entry, const void *key)
+{
+	const SDESCARRAY *sdescArray = entry;
+	const MODEL_KEY *k = key;
+
+	return(sdescArray->sdt==k->sdt && sdescArray->sdesc.serviceId==k->serviceId);
+}
+
+static bool cviMatch(const void *entry, const void *key)
+{
+	const DescriptorXCB *xCB = entry;
+	const MODEL_KEY *k = key;
+
+	return(xCB->service==k->service && xCB->contractVerificationInfoLength==k->cviLength
+		&& !memcmp(xCB->contractVerificationInfo, k->cvi, k->cviLength));
+}
+
+static SDTARRAY *sdtArraySet(CVI_MODEL *model, SDT *sdt)
+{
+	MODEL_KEY key = {.originalNetworkId = sdt->originalNetworkId, .transportStreamId = sdt->transportStreamId};
+	uint64_t hash = hashMix((uint64_t)sdt->originalNetworkId<<16 | sdt->transportStreamId);
+	void **slot;
+
+	if((slot = indexFind(&model->arena, &model->sdtIndex, hash, sdtMatch, &key))==NULL){
+		return NULL;
+	}
+	if(*slot != NULL){
+		return((SDTARRAY *)*slot);
+	}
+
+	SDTARRAY *sdtarr = (SDTARRAY *)arenaAlloc(&model->arena, sizeof(SDTARRAY));
 	if(sdtarr == NULL){
 		return NULL;
 	}
 	memcpy(&sdtarr->sdt, sdt, sizeof(SDT));
-	if((*sdtArray = (SDTARRAY **)realloc(*sdtArray, sizeof(SDTARRAY *) * (arrSize+2)))==NULL){
+	if(!ARRAY_APPEND(&model->arena, model->sdtArray, model->numOfSdt, model->maxSdt, sdtarr) || !indexInsert(&model->arena, &model->sdtIndex, slot, hash, sdtarr)){
 		return NULL;
 	}
-	*((*sdtArray)+arrSize)   = sdtarr;
-	*((*sdtArray)+arrSize+1) = NULL;
-		
-	return(*((*sdtArray)+arrSize));
+
+	return(sdtarr);
 }
 
-static SDESCARRAY *sdescArraySet(SDTARRAY *sdtArray, SdtDescriptor *sdesc)
+static SDESCARRAY *sdescArraySet(CVI_MODEL *model, SDTARRAY *sdtArray, SdtDescriptor *sdesc)
 {
+	MODEL_KEY key = {.sdt = sdtArray, .serviceId = sdesc->serviceId};
+	uint64_t hash = hashMix((uint64_t)sdtArray->sdt.originalNetworkId<<32 | (uint64_t)sdtArray->sdt.transportStreamId<<16 | sdesc->serviceId);
+	void **slot;
 
-	if(sdtArray->sdescArray == NULL){
-		if((sdtArray->sdescArray = (SDESCARRAY **)calloc(1, sizeof(SDESCARRAY *)))==NULL){
-			return NULL;
-		}
-		*sdtArray->sdescArray = NULL;
-	}
-
-	bool find = false;
-	int arrSize;
-	for(arrSize=0;*(sdtArray->sdescArray+arrSize)!=NULL ;arrSize++){
-		if((*(sdtArray->sdescArray+arrSize))->sdesc.serviceId == sdesc->serviceId){
-			find = true;
-			break;
-		}
+	if((slot = indexFind(&model->arena, &model->serviceIndex, hash, serviceMatch, &key))==NULL){
+		return NULL;
 	}
-	if(find){
-		return(*(sdtArray->sdescArray+arrSize));
+	if(*slot != NULL){
+		return((SDESCARRAY *)*slot);
 	}
 
-	SDESCARRAY *sdescarr = (SDESCARRAY *)calloc(1, sizeof(SDESCARRAY ));
+	SDESCARRAY *sdescarr = (SDESCARRAY *)arenaAlloc(&model->arena, sizeof(SDESCARRAY));
 	if(sdescarr == NULL){
 		return NULL;
 	}
 	memcpy(&(sdescarr->sdesc), sdesc, sizeof(SdtDescriptor));
-	if((sdtArray->sdescArray = (SDESCARRAY **)realloc(sdtArray->sdescArray, sizeof(SDESCARRAY *) * (arrSize+2)))==NULL){
+	sdescarr->sdt = sdtArray;
+	if(!ARRAY_APPEND(&model->arena, sdtArray->sdescArray, sdtArray->numOfSdesc, sdtArray->maxSdesc, sdescarr) || !indexInsert(&model->arena, &model->serviceIndex, slot, hash, sdescarr)){
 		return NULL;
 	}
-	*(sdtArray->sdescArray+arrSize)   = sdescarr;
-	*(sdtArray->sdescArray+arrSize+1) = NULL;
 
-	return(*(sdtArray->sdescArray+arrSize));
+	return(sdescarr);
+}
+
+/************************************
+ * ARIB文字列をUTF-8に変換する      *
+ * SJIS・nkf を経由せず直接変換する *
+ * 同じ文字列は変換結果を共有する   *
+ * 戻値は model->textCache 内を     *
+ * 指すので個別に free しないこと   *
+*************************************/
+static uint8_t *aribToUtf8(CVI_MODEL *model, uint8_t *arib, size_t len, size_t *utf8Len)
+{
+	const uint8_t *utf8;
+
+	if(model->textCache==NULL && (model->textCache = aribCacheNew())==NULL){
+		return NULL;
+	}
+	if((utf8 = aribCacheUtf8(model->textCache, arib, len, utf8Len))==NULL){
+		return NULL;
+	}
+
+	return((uint8_t *)utf8);
 }
 
 /************************************
@@ -264,91 +515,110 @@ static SDESCARRAY *sdescArraySet(SDTARRAY *sdtArray, SdtDescriptor *sdesc)
  * -Z 全角を半角にする              *
  * -Z4 全角カナを半角カナにする     *
 *************************************/
-static DescriptorX48 *x48ArraySet(SDESCARRAY *sdescArray, DescriptorX48 *x48)
+static DescriptorX48 *x48ArraySet(CVI_MODEL *model, SDESCARRAY *sdescArray, DescriptorX48 *x48)
 {
 
 	if(sdescArray->x48 == NULL){
-		if((sdescArray->x48= (DescriptorX48 *)calloc(1, sizeof(DescriptorX48)))==NULL){
+		if((sdescArray->x48= (DescriptorX48 *)arenaAlloc(&model->arena, sizeof(DescriptorX48)))==NULL){
 			return NULL;
 		}
 		memcpy(sdescArray->x48, x48, sizeof(DescriptorX48));
 
-		const char *option = "-S -w";
-		uint8_t *sjis = aribTOsjis(x48->serviceProviderName, x48->serviceProviderNameLength);
-		if(sjis==NULL){
-			return NULL;
-		}
-		if((sdescArray->x48->serviceProviderName = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))==NULL){
+		size_t len;
+		if((sdescArray->x48->serviceProviderName = aribToUtf8(model, x48->serviceProviderName, x48->serviceProviderNameLength, &len))==NULL){
 			return NULL;
 		}
-		sdescArray->x48->serviceProviderNameLength = strlen((char *)sdescArray->x48->serviceName);
-		free(sjis);
+		sdescArray->x48->serviceProviderNameLength = len;
 
-		if((sjis = aribTOsjis(x48->serviceName, x48->serviceNameLength))==NULL){
-			return NULL;
-		}
-		if((sdescArray->x48->serviceName = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))==NULL){
+		if((sdescArray->x48->serviceName = aribToUtf8(model, x48->serviceName, x48->serviceNameLength, &len))==NULL){
 			return NULL;
 		}
-		sdescArray->x48->serviceNameLength = strlen((char *)sdescArray->x48->serviceName);
-		free(sjis);
+		sdescArray->x48->serviceNameLength = len;
 	}
 
 	return(sdescArray->x48);
 }
 
-static DescriptorXCB *xCBArraySet(SDESCARRAY *sdescArray, DescriptorXCB *xCB)
+// adopt:true  併合用 xCB は別モデルで登録済みのものなので複製せずそのまま登録する
+static DescriptorXCB *xCBArraySet(CVI_MODEL *model, SDESCARRAY *sdescArray, DescriptorXCB *xCB, bool adopt)
 {
+	MODEL_KEY key = {.service = sdescArray, .cvi = xCB->contractVerificationInfo, .cviLength = xCB->contractVerificationInfoLength};
+	uint64_t hash = hashBytes(hashMix((uintptr_t)sdescArray), xCB->contractVerificationInfo, xCB->contractVerificationInfoLength);
+	void **slot;
 
-	if(sdescArray->xCBArray == NULL){
-		if((sdescArray->xCBArray = (DescriptorXCB **)calloc(1, sizeof(DescriptorXCB *)))==NULL){
-			return NULL;
-		}
-		*(sdescArray->xCBArray) = NULL;
+	if((slot = indexFind(&model->arena, &model->cviIndex, hash, cviMatch, &key))==NULL){
+		return NULL;
 	}
-
-	bool find = false;
-	int arrSize;
-	for(arrSize=0;*(sdescArray->xCBArray+arrSize)!=NULL ;arrSize++){
-		if((*(sdescArray->xCBArray+arrSize))->contractVerificationInfoLength == xCB->contractVerificationInfoLength){
-			if(!memcmp((*(sdescArray->xCBArray+arrSize))->contractVerificationInfo,xCB->contractVerificationInfo,xCB->contractVerificationInfoLength)){
-				find = true;
-				break;
-			}
-		}
+	if(*slot != NULL){
+		return((DescriptorXCB *)*slot);
 	}
-	if(find){
-		return(*(sdescArray->xCBArray+arrSize));
+	if(adopt){
+		xCB->service = sdescArray;
+		if(!ARRAY_APPEND(&model->arena, sdescArray->xCBArray, sdescArray->numOfXCB, sdescArray->maxXCB, xCB) || !indexInsert(&model->arena, &model->cviIndex, slot, hash, xCB)){
+			return NULL;
+		}
+		return(xCB);
 	}
 
-	DescriptorXCB *xCBArray = (DescriptorXCB *)calloc(1, sizeof(DescriptorXCB));
+	DescriptorXCB *xCBArray = (DescriptorXCB *)arenaAlloc(&model->arena, sizeof(DescriptorXCB));
 	if(xCBArray == NULL){
 		return NULL;
 	}
 	memcpy(xCBArray, xCB, sizeof(DescriptorXCB));
-	if((xCBArray->contractVerificationInfo = malloc(xCBArray->contractVerificationInfoLength))==NULL){
+	xCBArray->service = sdescArray;
+	if((xCBArray->contractVerificationInfo = arenaAlloc(&model->arena, xCBArray->contractVerificationInfoLength))==NULL){
 		return NULL;
 	}
 	memcpy(xCBArray->contractVerificationInfo, xCB->contractVerificationInfo, xCBArray->contractVerificationInfoLength);
 
-	const char *option = "-S -w";
-	uint8_t *sjis = aribTOsjis(xCB->feeName, xCB->feeNameLength);
-	if(sjis == NULL){
+	size_t len;
+	if((xCBArray->feeName = aribToUtf8(model, xCB->feeName, xCB->feeNameLength, &len))==NULL){
 		return NULL;
 	}
-	if((xCBArray->feeName = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))==NULL){
-		return NULL;
-	}
-	xCBArray->feeNameLength = strlen((char *)xCBArray->feeName);
-	free(sjis);
+	xCBArray->feeNameLength = len;
 
-	if((sdescArray->xCBArray = (DescriptorXCB **)realloc(sdescArray->xCBArray, sizeof(DescriptorXCB *) * (arrSize+2)))==NULL){
+	if(!ARRAY_APPEND(&model->arena, sdescArray->xCBArray, sdescArray->numOfXCB, sdescArray->maxXCB, xCBArray) || !indexInsert(&model->arena, &model->cviIndex, slot, hash, xCBArray)){
 		return NULL;
 	}
-	*(sdescArray->xCBArray+arrSize)   = xCBArray;
-	*(sdescArray->xCBArray+arrSize+1) = NULL;
 
-	return(*(sdescArray->xCBArray+arrSize));
+	return(xCBArray);
+}
+
+/************************************
+ * ファイル毎のモデルを併合する     *
+ * 併合先に無いサービス名・CVI は   *
+ * src の要素をそのまま参照するので *
+ * src は併合先と一緒に解放すること *
+ * ファイル指定順に併合すれば       *
+ * 1ファイルずつ読んだ場合と同じ    *
+ * 登録順・内容になる               *
+*************************************/
+static bool modelMerge(CVI_MODEL *model, CVI_MODEL *src)
+{
+	SDTARRAY 	*sdtCurrent;
+	SDESCARRAY	*sdescCurrent;
+
+	for(size_t i=0; i<src->numOfSdt; i++){
+		SDTARRAY *srcSdt = src->sdtArray[i];
+		if((sdtCurrent = sdtArraySet(model, &srcSdt->sdt))==NULL){
+			return(false);
+		}
+		for(size_t k=0; k<srcSdt->numOfSdesc; k++){
+			SDESCARRAY *srcSdesc = srcSdt->sdescArray[k];
+			if((sdescCurrent = sdescArraySet(model, sdtCurrent, &srcSdesc->sdesc))==NULL){
+				return(false);
+			}
+			if(sdescCurrent->x48 == NULL){
+				sdescCurrent->x48 = srcSdesc->x48;
+			}
+			for(size_t g=0; g<srcSdesc->numOfXCB; g++){
+				if(xCBArraySet(model, sdescCurrent, srcSdesc->xCBArray[g], true)==NULL){
+					return(false);
+				}
+			}
+		}
+	}
+	return(true);
 }
 
 /*******************************************
@@ -383,17 +653,45 @@ uint32_t crc32(uint8_t *d, size_t len)
 ******************************************************/
 
 
+#define TS_PACKETSIZE	188
+#define MAX_PAYLOAD		4324	// 188 * 23 EIT max size 4096 + stuffing
+
+/********************************************/
+/* TSパケット読込							*/
+/* 次のペイロード先頭パケットは fseek で	*/
+/* 戻さず held に残して次回に使うので		*/
+/* パイプ(チューナー出力)からも読める		*/
+/********************************************/
+typedef struct {
+	FILE		*fp;
+	uint8_t		held[TS_PACKETSIZE];
+	bool		isHeld;
+} TS_READER;
+
+static bool tsRead(TS_READER *ts, uint8_t *packet)
+{
+	if(ts->isHeld){
+		memcpy(packet, ts->held, TS_PACKETSIZE);
+		ts->isHeld = false;
+		return(true);
+	}
+	return(fread(packet, TS_PACKETSIZE, 1, ts->fp)==1);
+}
+
+static bool tsEof(TS_READER *ts)
+{
+	return(!ts->isHeld && feof(ts->fp));
+}
+
 /********************************************/
 /* 指定されたPIDをTSファイルから抽出し		*/
 /* TS188byteパケットからPID可変長データ		*/
 /* (payload)を作り上げる					*/
 /********************************************/
 static bool
-create_payload(uint16_t pid, uint8_t *payload, size_t *payload_len, FILE **fp)
+create_payload(uint16_t pid, uint8_t *payload, size_t *payload_len, TS_READER *ts)
 {
 
-#define TS_PACKETSIZE	188
-#define MAX_PAYLOAD		4324	// 188 * 23 EIT max size 4096 + stuffing
 #define MAX_FILENAME	256
 #define SEND_COMMAND	1024
 #define RECV_COMMAND	128
@@ -407,7 +705,7 @@ create_payload(uint16_t pid, uint8_t *payload, size_t *payload_len, FILE **fp)
 	*payload_len = 0;
 	memset(&ts_before, '\0', sizeof(TS_HEADER));
 
-	while(fread(packet, TS_PACKETSIZE, 1, *fp)==1){
+	while(tsRead(ts, packet)){
 		ts_header.sync_byte						= packet[0];
 		ts_header.transport_error_indicator		= packet[1]>>7 & 0x01;
 		ts_header.payload_unit_start_indicator	= packet[1]>>6 & 0x01;
@@ -515,8 +813,9 @@ if(ts_header.PID==0x012 && pid==0x012){
 								
 							}
 						}
-						// 読み込んだTSパケット(188byte)ファイルポインタを戻して終了
-						fseek(*fp, -TS_PACKETSIZE, SEEK_CUR);
+						// 読み込んだTSパケット(188byte)は次回の先頭として残して終了
+						memcpy(ts->held, packet, TS_PACKETSIZE);
+						ts->isHeld = true;
 						ret = true;
 						break;
 					}
@@ -559,7 +858,7 @@ SDT_set(uint8_t *payload, SDT *sdt)
 	sdt->transportStreamId		= (*(payload+3)&0xff)<<8 | *(payload+4);
 	sdt->reserved2				= *(payload+5)>>6 & 0x03;
 	sdt->versionNumber			= *(payload+5)>>1 & 0x1f;
-	sdt->currentNextIndicator	= *(payload+5)>>1 & 0x01;
+	sdt->currentNextIndicator	= *(payload+5) & 0x01;
 	sdt->sectionNumber			= *(payload+6);
 	sdt->lastSectionNumber		= *(payload+7);
 	sdt->originalNetworkId		= (*(payload+8)&0xff)<<8 | *(payload+9);
@@ -617,32 +916,169 @@ DescriptorXCB_set(uint8_t *descriptor, DescriptorXCB *xCB)
 	return;
 } 
 
-static int compare_tsid(const void *a, const void *b)
+/************************************
+ * 出力順の並べ替え                 *
+ * (tsid<<16 | sid) または sid の   *
+ * 32bitキーと要素を平坦な配列に    *
+ * 並べ、8bit毎のLSD基数ソートを    *
+ * 1回行う 全要素で同じ桁は飛ばす   *
+ * 安定なので同じキーは登録順       *
+*************************************/
+typedef struct {
+	uint32_t	key;
+	XMLOUTPUT	*xml;
+} SORT_KEY;
+
+static bool sortXml(XMLOUTPUT **xml, size_t size, bool bySid)
 {
-	return((*(XMLOUTPUT **)a)->sdt->transportStreamId - (*(XMLOUTPUT **)b)->sdt->transportStreamId);
+	SORT_KEY *src, *dst, *work;
+	size_t count[4][256];
+
+	if(size<2){
+		return(true);
+	}
+	src = malloc(sizeof(SORT_KEY)*size);
+	dst = malloc(sizeof(SORT_KEY)*size);
+	if(src==NULL || dst==NULL){
+		free(src);
+		free(dst);
+		return(false);
+	}
+
+	memset(count, '\0', sizeof(count));
+	for(size_t i=0; i<size; i++){
+		uint32_t key = xml[i]->sdesc->serviceId;
+		if(!bySid){
+			key |= (uint32_t)xml[i]->sdt->transportStreamId<<16;
+		}
+		src[i].key = key;
+		src[i].xml = xml[i];
+		for(int d=0; d<4; d++){
+			count[d][key>>(d*8) & 0xff]++;
+		}
+	}
+
+	for(int d=0; d<4; d++){
+		size_t pos = 0;
+		// 全要素が同じ値の桁は並べ替え不要
+		if(count[d][src[0].key>>(d*8) & 0xff]==size){
+			continue;
+		}
+		for(int b=0; b<256; b++){
+			size_t n = count[d][b];
+			count[d][b] = pos;
+			pos += n;
+		}
+		for(size_t i=0; i<size; i++){
+			dst[count[d][src[i].key>>(d*8) & 0xff]++] = src[i];
+		}
+		work = src;
+		src = dst;
+		dst = work;
+	}
+
+	for(size_t i=0; i<size; i++){
+		xml[i] = src[i].xml;
+	}
+	free(src);
+	free(dst);
+	return(true);
 }
 
-static int compare_sid(const void *a, const void *b)
+/************************************
+ * ネットワーク別の出力グループ     *
+ * 既定は 4:BS 6,7:CS               *
+ * -n onid=名前 で追加・変更する    *
+ * 名前の無いネットワークは         *
+ * onid毎のグループにする           *
+*************************************/
+static const NETWORK_LABEL defaultLabels[] = {
+	{0x0004, "BS"},
+	{0x0006, "CS"},
+	{0x0007, "CS"},
+};
+
+static int compare_onid(const void *a, const void *b)
+{
+	return(((NETWORK_LABEL *)a)->originalNetworkId - ((NETWORK_LABEL *)b)->originalNetworkId);
+}
+
+// "onid=名前" を labels に登録する 登録済みのonidは後の指定で置き換える
+static bool networkLabelSet(NETWORK_LABEL **labels, size_t *numOfLabels, char *arg)
 {
-	return((*(XMLOUTPUT **)a)->sdesc->serviceId - (*(XMLOUTPUT **)b)->sdesc->serviceId);
+	char *label, *end;
+	long onid;
+
+	if((label = strchr(arg, '='))==NULL){
+		return(false);
+	}
+	*label++ = '\0';
+	onid = strtol(arg, &end, 0);
+	if(*arg=='\0' || *end!='\0' || onid<0 || onid>0xffff){
+		return(false);
+	}
+	for(size_t i=0; i<*numOfLabels; i++){
+		if((*labels)[i].originalNetworkId==onid){
+			(*labels)[i].label = label;
+			return(true);
+		}
+	}
+	NETWORK_LABEL *p = realloc(*labels, sizeof(NETWORK_LABEL)*(*numOfLabels+1));
+	if(p==NULL){
+		return(false);
+	}
+	p[*numOfLabels].originalNetworkId = onid;
+	p[*numOfLabels].label = label;
+	(*numOfLabels)++;
+	*labels = p;
+	return(true);
 }
 
-static int compare_tsid_sid(const void *a, const void *b)
+// onid のサービスを登録するグループを返す 戻値:NULL 出力しないネットワーク・メモリ不足
+static NETWORK_GROUP *networkGroupGet(CVI_MODEL *model, NETWORK_GROUP **groups, size_t *numOfGroups, size_t *maxGroups,
+										const NETWORK_LABEL *labels, size_t numOfLabels, uint16_t onid)
 {
-	int rtn;
-	if((rtn=compare_tsid(a,b))==0){
-		return(compare_sid(a,b));
+	NETWORK_LABEL key = {.originalNetworkId = onid};
+	NETWORK_LABEL *hit = bsearch(&key, labels, numOfLabels, sizeof(NETWORK_LABEL), compare_onid);
+	const char *label;
+
+	if(hit!=NULL){
+		label = hit->label;
+		if(*label=='\0'){
+			return NULL;
+		}
 	}else{
-		return(rtn);
+		char *work;
+		if((work = arenaAlloc(&model->arena, 16))==NULL){
+			return NULL;
+		}
+		snprintf(work, 16, "onid %04" PRIx16, onid);
+		label = work;
 	}
 
+	for(size_t i=0; i<*numOfGroups; i++){
+		NETWORK_GROUP *g = &(*groups)[i];
+		if(!strcmp(g->label, label)){
+			if(onid < g->originalNetworkId){
+				g->originalNetworkId = onid;
+			}
+			return(g);
+		}
+	}
+	// グループ配列の要素は arrayGrow で移動するので NULL終端用の1つ分も含めて確保する
+	if(!arrayGrow(&model->arena, (void **)groups, maxGroups, *numOfGroups+2, sizeof(NETWORK_GROUP))){
+		return NULL;
+	}
+	NETWORK_GROUP *g = &(*groups)[(*numOfGroups)++];
+	memset(g, '\0', sizeof(NETWORK_GROUP));
+	g->label = label;
+	g->originalNetworkId = onid;
+	return(g);
 }
 
-static void sort_tsid_sid(XMLOUTPUT **a, size_t size)
+static int compare_group(const void *a, const void *b)
 {
-	qsort(a,size,sizeof(XMLOUTPUT *),compare_sid);
-	qsort(a,size,sizeof(XMLOUTPUT *),compare_tsid);
-	qsort(a,size,sizeof(XMLOUTPUT *),compare_tsid_sid);
+	return(((NETWORK_GROUP *)a)->originalNetworkId - ((NETWORK_GROUP *)b)->originalNetworkId);
 }
 
 static void printSDT(SDT *sdt)
@@ -769,181 +1205,804 @@ static void	printXmlPart(XMLOUTPUT *xml)
 	}
 }
 
-static void printXml(XMLOUTPUT **xmlBS, size_t xmlBSSize,XMLOUTPUT **xmlCS, size_t xmlCSSize)
+static void printXml(NETWORK_GROUP *groups, size_t numOfGroups)
 {
 	fprintf(stdout, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n");
 	fprintf(stdout, "<CVI_INFOMATION>\n\n");
 
-	for(size_t i=0; i<xmlBSSize; i++){
-		printXmlPart(*(xmlBS+i));
-	}
-	for(size_t i=0; i<xmlCSSize; i++){
-		printXmlPart(*(xmlCS+i));
+	for(size_t g=0; g<numOfGroups; g++){
+		for(size_t i=0; i<groups[g].numOfXml; i++){
+			printXmlPart(*(groups[g].xml+i));
+		}
 	}
 	fprintf(stdout, "</CVI_INFOMATION>\n\n");
 }
 
+/****************************************************************/
+/* 差分モード                                                   */
+/* 出力対象のCA契約情報を (onid, tsid, sid, CVI) → 料金名 の    */
+/* エントリにし、前回の結果 (-s で保存したスナップショット      */
+/* または -x のXML出力) とハッシュ索引で突き合わせて            */
+/* 追加・削除・料金名変更のエントリだけを出力する               */
+/*                                                              */
+/* スナップショット形式 (数値はビッグエンディアン)              */
+/*   "CVIS" version:2byte(1) numOfEntries:4byte                 */
+/*   エントリ毎 onid:2 tsid:2 sid:2 flags:1 cviLength:1 cvi     */
+/*              feeNameLength:2 feeName(UTF-8)                  */
+/****************************************************************/
+#define SNAP_MAGIC		"CVIS"
+#define SNAP_VERSION	1
+#define SNAP_FREE_CA	0x01				// free_CA_mode=1 のサービス
+#define SNAP_FIRST_CVI	0x02				// サービスの最初のCVI (XML出力対象)
 
-int main(int argc, char *argv[])
+typedef struct {
+	uint16_t		originalNetworkId;
+	uint16_t		transportStreamId;
+	uint16_t		serviceId;
+	uint8_t			flags;
+	uint8_t			cviLength;
+	const uint8_t	*cvi;
+	const char		*feeName;				// NULL:不明 (XMLから読込)
+	bool			matched;				// 突き合わせ済み
+} CVI_ENTRY;
+
+typedef struct {
+	CVI_ENTRY		*entry;
+	size_t			numOfEntries;
+	size_t			maxEntries;
+	bool			fromXml;				// XMLから読込 料金名と2番目以降のCVIは無い
+} CVI_ENTRIES;
+
+static bool entryAdd(CVI_MODEL *model, CVI_ENTRIES *entries, CVI_ENTRY *entry)
 {
+	if(!arrayGrow(&model->arena, (void **)&entries->entry, &entries->maxEntries, entries->numOfEntries+1, sizeof(CVI_ENTRY))){
+		return(false);
+	}
+	entries->entry[entries->numOfEntries++] = *entry;
+	return(true);
+}
 
-	uint8_t xmlFlag = 0;
-	uint8_t tsfileNum;
-	int		opt;
+// 出力対象のサービスからエントリを作る CVIの無いサービスは cviLength 0 の1エントリ
+static bool entriesBuild(CVI_MODEL *model, NETWORK_GROUP *groups, size_t numOfGroups, CVI_ENTRIES *entries)
+{
+	CVI_ENTRY entry;
+
+	for(size_t g=0; g<numOfGroups; g++){
+		for(size_t i=0; i<groups[g].numOfXml; i++){
+			XMLOUTPUT *xml = groups[g].xml[i];
+			memset(&entry, '\0', sizeof(CVI_ENTRY));
+			entry.originalNetworkId	= xml->sdt->originalNetworkId;
+			entry.transportStreamId	= xml->sdt->transportStreamId;
+			entry.serviceId			= xml->sdesc->serviceId;
+			entry.flags				= (xml->sdesc->freeCaMode==1) ? SNAP_FREE_CA : 0;
+			if(xml->xCBArray==NULL){
+				entry.flags |= SNAP_FIRST_CVI;
+				entry.feeName = "";
+				if(!entryAdd(model, entries, &entry)){
+					return(false);
+				}
+				continue;
+			}
+			for(size_t k=0; xml->xCBArray[k]!=NULL; k++){
+				entry.flags		= (entry.flags & SNAP_FREE_CA) | ((k==0) ? SNAP_FIRST_CVI : 0);
+				entry.cviLength	= xml->xCBArray[k]->contractVerificationInfoLength;
+				entry.cvi		= xml->xCBArray[k]->contractVerificationInfo;
+				entry.feeName	= (const char *)xml->xCBArray[k]->feeName;
+				if(!entryAdd(model, entries, &entry)){
+					return(false);
+				}
+			}
+		}
+	}
+	return(true);
+}
+
+// 一時ファイルに書いてから置き換えるので -d と同じファイルを指定できる
+static bool snapshotWrite(const char *path, CVI_ENTRIES *entries)
+{
+	char *tmp;
+	uint8_t head[10];
+	FILE *fp;
+	bool rtn = true;
+
+	if((tmp = malloc(strlen(path)+sizeof(".tmp")))==NULL){
+		return(false);
+	}
+	sprintf(tmp, "%s.tmp", path);
+	if((fp = fopen(tmp, "w"))==NULL){
+		free(tmp);
+		return(false);
+	}
+	memcpy(head, SNAP_MAGIC, 4);
+	head[4] = SNAP_VERSION>>8;
+	head[5] = SNAP_VERSION & 0xff;
+	head[6] = entries->numOfEntries>>24 & 0xff;
+	head[7] = entries->numOfEntries>>16 & 0xff;
+	head[8] = entries->numOfEntries>>8 & 0xff;
+	head[9] = entries->numOfEntries & 0xff;
+	rtn = (fwrite(head, sizeof(head), 1, fp)==1);
+
+	for(size_t i=0; i<entries->numOfEntries && rtn; i++){
+		CVI_ENTRY *e = &entries->entry[i];
+		size_t feeNameLength = strlen(e->feeName);
+		uint8_t rec[8];
+		if(feeNameLength>0xffff){
+			feeNameLength = 0xffff;
+		}
+		rec[0] = e->originalNetworkId>>8;
+		rec[1] = e->originalNetworkId & 0xff;
+		rec[2] = e->transportStreamId>>8;
+		rec[3] = e->transportStreamId & 0xff;
+		rec[4] = e->serviceId>>8;
+		rec[5] = e->serviceId & 0xff;
+		rec[6] = e->flags;
+		rec[7] = e->cviLength;
+		uint8_t len[2] = {feeNameLength>>8, feeNameLength & 0xff};
+		rtn = fwrite(rec, sizeof(rec), 1, fp)==1
+			&& (e->cviLength==0 || fwrite(e->cvi, e->cviLength, 1, fp)==1)
+			&& fwrite(len, sizeof(len), 1, fp)==1
+			&& (feeNameLength==0 || fwrite(e->feeName, feeNameLength, 1, fp)==1);
+	}
+	if(fclose(fp)!=0){
+		rtn = false;
+	}
+	if(!rtn || rename(tmp, path)!=0){
+		remove(tmp);
+		rtn = false;
+	}
+	free(tmp);
+	return(rtn);
+}
+
+static bool snapshotParse(CVI_MODEL *model, uint8_t *buf, size_t size, CVI_ENTRIES *entries)
+{
+	CVI_ENTRY entry;
+	size_t pos = 10;
+	uint32_t numOfEntries;
+
+	if(size<10 || (buf[4]<<8 | buf[5])!=SNAP_VERSION){
+		return(false);
+	}
+	numOfEntries = (uint32_t)buf[6]<<24 | buf[7]<<16 | buf[8]<<8 | buf[9];
+	for(uint32_t i=0; i<numOfEntries; i++){
+		memset(&entry, '\0', sizeof(CVI_ENTRY));
+		if(pos+8>size){
+			return(false);
+		}
+		entry.originalNetworkId	= buf[pos]<<8 | buf[pos+1];
+		entry.transportStreamId	= buf[pos+2]<<8 | buf[pos+3];
+		entry.serviceId			= buf[pos+4]<<8 | buf[pos+5];
+		entry.flags				= buf[pos+6];
+		entry.cviLength			= buf[pos+7];
+		pos += 8;
+		if(pos+entry.cviLength+2>size){
+			return(false);
+		}
+		size_t feeNameLength = buf[pos+entry.cviLength]<<8 | buf[pos+entry.cviLength+1];
+		if(pos+entry.cviLength+2+feeNameLength>size){
+			return(false);
+		}
+		// 読込バッファは解放するのでCVIと料金名('\0'終端)はアリーナにコピーする
+		uint8_t *cvi;
+		char *feeName;
+		if((cvi = arenaAlloc(&model->arena, entry.cviLength+1))==NULL || (feeName = arenaAlloc(&model->arena, feeNameLength+1))==NULL){
+			return(false);
+		}
+		memcpy(cvi, buf+pos, entry.cviLength);
+		pos += entry.cviLength+2;
+		memcpy(feeName, buf+pos, feeNameLength);
+		pos += feeNameLength;
+		entry.cvi = cvi;
+		entry.feeName = feeName;
+		if(!entryAdd(model, entries, &entry)){
+			return(false);
+		}
+	}
+	return(true);
+}
+
+static int hexValue(char c)
+{
+	if(c>='0' && c<='9'){
+		return(c-'0');
+	}else if(c>='A' && c<='F'){
+		return(c-'A'+10);
+	}else if(c>='a' && c<='f'){
+		return(c-'a'+10);
+	}
+	return(-1);
+}
+
+// printXml の出力から sid tsid nid と最初のCVIを読む
+static bool xmlParse(CVI_MODEL *model, char *text, CVI_ENTRIES *entries)
+{
+	CVI_ENTRY entry;
+	char *p = text;
+	unsigned int sid, tsid, nid;
+
+	entries->fromXml = true;
+	while((p = strstr(p, "<ServiceID "))!=NULL){
+		if(sscanf(p, "<ServiceID sid=\"%u\" tsid=\"%u\" nid=\"%u\"", &sid, &tsid, &nid)!=3){
+			return(false);
+		}
+		char *close = strstr(p, "</ServiceID>");
+		char *cvi = strstr(p, "<cvi>");
+		if(close==NULL){
+			return(false);
+		}
+		memset(&entry, '\0', sizeof(CVI_ENTRY));
+		entry.originalNetworkId	= nid;
+		entry.transportStreamId	= tsid;
+		entry.serviceId			= sid;
+		entry.flags				= SNAP_FREE_CA | SNAP_FIRST_CVI;
+		if(cvi!=NULL && cvi<close){
+			uint8_t *bytes;
+			size_t n = 0;
+			cvi += strlen("<cvi>");
+			cvi += strspn(cvi, " \t\r\n");
+			if((bytes = arenaAlloc(&model->arena, 256))==NULL){
+				return(false);
+			}
+			while(n<255 && hexValue(cvi[0])>=0 && hexValue(cvi[1])>=0){
+				bytes[n++] = hexValue(cvi[0])<<4 | hexValue(cvi[1]);
+				cvi += 2;
+			}
+			entry.cvi		= bytes;
+			entry.cviLength	= n;
+		}
+		if(!entryAdd(model, entries, &entry)){
+			return(false);
+		}
+		p = close;
+	}
+	return(true);
+}
+
+// 前回の結果を読む 先頭が "CVIS" ならスナップショット それ以外はXMLとして読む
+static bool previousLoad(CVI_MODEL *model, const char *path, CVI_ENTRIES *entries)
+{
+	FILE *fp;
+	uint8_t *buf;
+	size_t size = 0, max = 64*1024, n;
+
+	if((fp = fopen(path, "r"))==NULL){
+		return(false);
+	}
+	if((buf = malloc(max+1))==NULL){
+		fclose(fp);
+		return(false);
+	}
+	while((n = fread(buf+size, 1, max-size, fp))>0){
+		size += n;
+		if(size==max){
+			uint8_t *p = realloc(buf, max*2+1);
+			if(p==NULL){
+				free(buf);
+				fclose(fp);
+				return(false);
+			}
+			buf = p;
+			max *= 2;
+		}
+	}
+	fclose(fp);
+	buf[size] = '\0';
+
+	bool rtn;
+	if(size>=4 && !memcmp(buf, SNAP_MAGIC, 4)){
+		rtn = snapshotParse(model, buf, size, entries);
+	}else if(strstr((char *)buf, "<CVI_INFOMATION>")!=NULL){
+		rtn = xmlParse(model, (char *)buf, entries);
+	}else{
+		rtn = false;
+	}
+	free(buf);
+	return(rtn);
+}
+
+static bool entryMatch(const void *entry, const void *key)
+{
+	const CVI_ENTRY *a = entry;
+	const CVI_ENTRY *b = key;
+
+	return(a->originalNetworkId==b->originalNetworkId && a->transportStreamId==b->transportStreamId && a->serviceId==b->serviceId
+		&& a->cviLength==b->cviLength && (a->cviLength==0 || !memcmp(a->cvi, b->cvi, a->cviLength)));
+}
+
+static uint64_t entryHash(const CVI_ENTRY *e)
+{
+	return(hashBytes(hashMix((uint64_t)e->originalNetworkId<<32 | (uint64_t)e->transportStreamId<<16 | e->serviceId), e->cvi, e->cviLength));
+}
+
+static void printEntry(char mark, CVI_ENTRY *e)
+{
+	fprintf(stdout, "%c nid=%d tsid=%d sid=%d cvi=", mark, e->originalNetworkId, e->transportStreamId, e->serviceId);
+	for(size_t i=0; i<e->cviLength; i++){
+		fprintf(stdout, "%02" PRIX8"", e->cvi[i]);
+	}
+	if(e->feeName!=NULL){
+		fprintf(stdout, " fee=\"%s\"", e->feeName);
+	}
+}
+
+// 差分を出力する 戻値:変更のあったエントリ数
+static size_t cviDiff(CVI_MODEL *model, CVI_ENTRIES *previous, CVI_ENTRIES *current)
+{
+	HASH_INDEX index;
+	size_t changes = 0;
+	void **slot;
+
+	memset(&index, '\0', sizeof(HASH_INDEX));
+	for(size_t i=0; i<previous->numOfEntries; i++){
+		CVI_ENTRY *e = &previous->entry[i];
+		uint64_t hash = entryHash(e);
+		if((slot = indexFind(&model->arena, &index, hash, entryMatch, e))==NULL){
+			continue;
+		}
+		// 同じキーが重複していれば先の1つだけ突き合わせる
+		if(*slot!=NULL){
+			e->matched = true;
+			continue;
+		}
+		indexInsert(&model->arena, &index, slot, hash, e);
+	}
+
+	for(size_t i=0; i<current->numOfEntries; i++){
+		CVI_ENTRY *e = &current->entry[i];
+		CVI_ENTRY *old = NULL;
+		// XMLと比較する場合はXMLに出力されるエントリだけを比べる
+		if(previous->fromXml && e->flags!=(SNAP_FREE_CA|SNAP_FIRST_CVI)){
+			continue;
+		}
+		if((slot = indexFind(&model->arena, &index, entryHash(e), entryMatch, e))!=NULL){
+			old = *slot;
+		}
+		if(old==NULL){
+			printEntry('+', e);
+			fprintf(stdout, "\n");
+			changes++;
+			continue;
+		}
+		old->matched = true;
+		if(old->feeName!=NULL && strcmp(old->feeName, e->feeName)){
+			printEntry('~', e);
+			fprintf(stdout, " (fee=\"%s\")\n", old->feeName);
+			changes++;
+		}
+	}
+	for(size_t i=0; i<previous->numOfEntries; i++){
+		CVI_ENTRY *e = &previous->entry[i];
+		if(!e->matched){
+			printEntry('-', e);
+			fprintf(stdout, "\n");
+			changes++;
+		}
+	}
+	return(changes);
+}
+
+
+
+/****************************************************************/
+/* SDT受信状況                                                  */
+/* (table_id, onid, tsid) 毎に version_number と                */
+/* section_number の受信済みビットを記録する                    */
+/* それまでに現れた全てのSDTの 0〜last_section_number が揃い、 */
+/* さらに全てのSDTの全セクションをもう1周受信する間に          */
+/* 新しいSDT・バージョン更新が無ければ受信完了                  */
+/* (周期の長い 0x46 も各テーブルが1周するまで待つ)             */
+/****************************************************************/
+typedef struct {
+	uint8_t		tableId;
+	uint16_t	originalNetworkId;
+	uint16_t	transportStreamId;
+	uint8_t		versionNumber;
+	uint8_t		lastSectionNumber;
+	uint16_t	numOfSeen;					// 受信済みセクション数
+	uint8_t		seen[256/8];				// section_number 毎の受信済みビット
+	uint32_t	generation;					// again を記録した時の SDT_TRACKER.generation
+	uint16_t	numOfAgain;					// 揃った後に再受信したセクション数
+	uint8_t		again[256/8];				// section_number 毎の再受信ビット
+} SDT_PROGRESS;
+
+typedef struct {
+	HASH_INDEX		index;					// (table_id, onid, tsid) → SDT_PROGRESS
+	size_t			numOfTables;
+	size_t			numOfComplete;
+	size_t			numOfRepeated;			// 揃った後に全セクションを再受信したテーブル数
+	uint32_t		generation;				// 新しいSDT・バージョン更新毎に進めて再受信をやり直す
+	uint32_t		repeatGeneration;		// numOfRepeated を数えている generation
+} SDT_TRACKER;
+
+static bool progressMatch(const void *entry, const void *key)
+{
+	const SDT_PROGRESS *p = entry;
+	const SDT *sdt = key;
+
+	return(p->tableId==sdt->tableId && p->originalNetworkId==sdt->originalNetworkId && p->transportStreamId==sdt->transportStreamId);
+}
+
+// 受信したセクションを記録する 戻値:true 全SDT受信完了
+static bool sdtTrack(CVI_MODEL *model, SDT_TRACKER *tracker, SDT *sdt)
+{
+	uint64_t hash = hashMix((uint64_t)sdt->tableId<<32 | (uint64_t)sdt->originalNetworkId<<16 | sdt->transportStreamId);
+	SDT_PROGRESS *p;
+	void **slot;
+
+	// 0x42:自TS 0x46:他TS 以外 (BAT等) と未適用のセクションは数えない
+	if((sdt->tableId!=0x42 && sdt->tableId!=0x46) || sdt->currentNextIndicator==0 || sdt->sectionNumber>sdt->lastSectionNumber){
+		return(false);
+	}
+	if((slot = indexFind(&model->arena, &tracker->index, hash, progressMatch, sdt))==NULL){
+		return(false);
+	}
+	if((p = *slot)==NULL){
+		if((p = arenaAlloc(&model->arena, sizeof(SDT_PROGRESS)))==NULL || !indexInsert(&model->arena, &tracker->index, slot, hash, p)){
+			return(false);
+		}
+		p->tableId				= sdt->tableId;
+		p->originalNetworkId	= sdt->originalNetworkId;
+		p->transportStreamId	= sdt->transportStreamId;
+		p->versionNumber		= sdt->versionNumber;
+		p->lastSectionNumber	= sdt->lastSectionNumber;
+		tracker->numOfTables++;
+		tracker->generation++;
+	}else if(p->versionNumber!=sdt->versionNumber || p->lastSectionNumber!=sdt->lastSectionNumber){
+		// バージョンが変わったら受信し直す
+		if(p->numOfSeen==p->lastSectionNumber+1){
+			tracker->numOfComplete--;
+		}
+		p->versionNumber		= sdt->versionNumber;
+		p->lastSectionNumber	= sdt->lastSectionNumber;
+		p->numOfSeen			= 0;
+		memset(p->seen, '\0', sizeof(p->seen));
+		tracker->generation++;
+	}
 
+	if(!(p->seen[sdt->sectionNumber/8] & 1<<(sdt->sectionNumber%8))){
+		p->seen[sdt->sectionNumber/8] |= 1<<(sdt->sectionNumber%8);
+		p->numOfSeen++;
+		if(p->numOfSeen==p->lastSectionNumber+1){
+			tracker->numOfComplete++;
+		}
+		tracker->generation++;
+		return(false);
+	}
+
+	if(tracker->numOfComplete!=tracker->numOfTables){
+		return(false);
+	}
+	// 新しいSDT・バージョン更新があれば再受信を数え直す
+	if(tracker->repeatGeneration!=tracker->generation){
+		tracker->repeatGeneration	= tracker->generation;
+		tracker->numOfRepeated		= 0;
+	}
+	if(p->generation!=tracker->generation){
+		p->generation	= tracker->generation;
+		p->numOfAgain	= 0;
+		memset(p->again, '\0', sizeof(p->again));
+	}
+	if(!(p->again[sdt->sectionNumber/8] & 1<<(sdt->sectionNumber%8))){
+		p->again[sdt->sectionNumber/8] |= 1<<(sdt->sectionNumber%8);
+		p->numOfAgain++;
+		if(p->numOfAgain==p->lastSectionNumber+1){
+			tracker->numOfRepeated++;
+		}
+	}
+	return(tracker->numOfRepeated==tracker->numOfTables);
+}
+
+/****************************************************************/
+/* 複数ファイル並列処理                                         */
+/* ファイル毎にワーカースレッドを割り当て、各スレッドは         */
+/* ファイル毎の CVI_MODEL にSDTを登録する                       */
+/* 全スレッド終了後にファイル指定順に併合するので               */
+/* 同じ入力からは常に同じ結果となる                             */
+/****************************************************************/
+typedef struct {
+	char			**files;
+	size_t			numOfFiles;
+	CVI_MODEL		*models;			// ファイル毎
+	bool			*opened;			// ファイル毎 false:オープンエラー
+	bool			earlyStop;			// true:SDTが揃った時点で読込を止める
+	size_t			next;				// 次に処理するファイル番号
+	pthread_mutex_t	lock;
+} BATCH;
+
+// 1ファイル分のSDTを model に登録する
+// earlyStop が true の場合は全SDTのセクションが揃った時点で読込を止める
+static bool scanFile(const char *path, CVI_MODEL *model, bool earlyStop)
+{
 	uint8_t payload[MAX_PAYLOAD];
 	size_t	payload_len;
-	FILE *fp;
+	TS_READER	ts;
+	SDT_TRACKER	tracker;
 	SDT	sdt;
 	SdtDescriptor	sdesc;
 	DescriptorX48	x48;
 	DescriptorXCB	xCB;
-
-	SDTARRAY 	**sdtArray  = NULL;
 	SDTARRAY 	*sdtCurrent = NULL;
 	SDESCARRAY	*sdescCurrent = NULL;
 
-	while ((opt = getopt(argc, argv, "x")) != -1){
+	memset(&ts, '\0', sizeof(TS_READER));
+	memset(&tracker, '\0', sizeof(SDT_TRACKER));
+	if((ts.fp=fopen(path,"r"))==NULL){
+		return(false);
+	}
+
+	bool find = false;
+
+	while(!tsEof(&ts)){
+		find = create_payload(0x0011, payload, &payload_len, &ts);	/* 0x11 SDT	*/
+		if(find){
+			memset(&sdt, '\0', sizeof(SDT));
+			SDT_set(payload, &sdt);
+			if((sdtCurrent = sdtArraySet(model, &sdt))==NULL){
+				continue;
+			}
+			for(int sDescriptorLength=0; sDescriptorLength<sdt.sectionLength-8-4; sDescriptorLength+=5+sdesc.descriptorsLoopLength){
+																			// 8 : SDT transportStreamId から reservedFutureUse2 までのbyte数
+																			// 4 : SDT CRC32 のbyte数
+																			// sdt.sectionLength-8-4 : SDT sectionData のbyte数
+																			// 5 : serviceId から descriptorsLoopLength までのbyte数
+																			// sdesc.descriptorsLoopLength : descriptor のbyte数
+																			// 5+sdesc.descriptorsLoopLength : SDT Descriptor 1つのbyte数
+				memset(&sdesc, '\0', sizeof(SdtDescriptor));
+				SdtDescriptor_set(sdt.sectionData+sDescriptorLength, &sdesc);
+				if((sdescCurrent = sdescArraySet(model, sdtCurrent, &sdesc))==NULL){
+					continue;
+				}
+				uint8_t descriptorTag;
+				for(int descriptorOffset=0; descriptorOffset<sdesc.descriptorsLoopLength; descriptorOffset+=*(sdesc.descriptor+descriptorOffset+1) + 2){
+																			// *(sdesc.descriptor+descriptorOffset+1) : descriptorLength
+																			// 2 : descriptorTag 1byte descriptorLength 1byte
+																			// *(sdesc.descriptor+descriptorOffset+1) + 2はdescriptor1つのbyte数
+					descriptorTag = *(sdesc.descriptor+descriptorOffset);
+					if(descriptorTag==0x48){		// 0x48:サービス記述子
+						memset(&x48, '\0', sizeof(DescriptorX48));
+						DescriptorX48_set(sdesc.descriptor+descriptorOffset, &x48);
+						x48ArraySet(model, sdescCurrent, &x48);
+					}else if(descriptorTag==0xcb){	// 0xcb:CA 契約情報記述子
+						memset(&xCB, '\0', sizeof(DescriptorXCB));
+						DescriptorXCB_set(sdesc.descriptor+descriptorOffset, &xCB);
+						xCBArraySet(model, sdescCurrent, &xCB, false);
+					}
+
+				}
+			}
+			if(earlyStop && sdtTrack(model, &tracker, &sdt)){
+				break;
+			}
+		}
+	}
+	fclose(ts.fp);
+	return(true);
+}
+
+static void *batchWorker(void *arg)
+{
+	BATCH *batch = arg;
+	size_t fileNo;
+
+	while(true){
+		pthread_mutex_lock(&batch->lock);
+		fileNo = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if(fileNo>=batch->numOfFiles){
+			break;
+		}
+		batch->opened[fileNo] = scanFile(batch->files[fileNo], &batch->models[fileNo], batch->earlyStop);
+	}
+	return(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+
+	uint8_t xmlFlag = 0;
+	size_t	tsfileNum;
+	long	jobs = 0;
+	int		opt;
+	char	*end;
+
+	CVI_MODEL	model;
+	SDTARRAY 	**sdtArray;
+	BATCH		batch;
+	pthread_t	*threads;
+	size_t		started = 0;
+
+	NETWORK_LABEL	*labels = NULL;
+	size_t			numOfLabels = 0;
+	NETWORK_GROUP	*groups = NULL;
+	size_t			numOfGroups = 0, maxGroups = 0;
+
+	char		*previousPath = NULL;			// -d 前回の結果
+	char		*snapshotPath = NULL;			// -s スナップショット出力先
+	CVI_ENTRIES	previous, current;
+	int			rtn = 0;
+
+	if((labels = malloc(sizeof(defaultLabels)))==NULL){
+		fprintf(stderr, "memory allocate error\n");
+		return(-1);
+	}
+	memcpy(labels, defaultLabels, sizeof(defaultLabels));
+	numOfLabels = sizeof(defaultLabels)/sizeof(NETWORK_LABEL);
+
+	memset(&batch, '\0', sizeof(BATCH));
+	while ((opt = getopt(argc, argv, "xaej:n:d:s:")) != -1){
 		switch (opt) {
 			case 'x':
 				xmlFlag = 1;
 			break;
+			case 'a':	// 最後まで読む (省略時と同じ 以前の指定との互換用)
+				batch.earlyStop = false;
+			break;
+			case 'e':
+				batch.earlyStop = true;
+			break;
+			case 'j':
+				jobs = strtol(optarg, &end, 10);
+				if(*optarg=='\0' || *end!='\0' || jobs<1 || jobs>256){
+					fprintf(stderr, "-j arg error %s\n", optarg);
+					return(-1);
+				}
+			break;
+			case 'd':
+				previousPath = optarg;
+			break;
+			case 's':
+				snapshotPath = optarg;
+			break;
+			case 'n':
+				if(!networkLabelSet(&labels, &numOfLabels, optarg)){
+					fprintf(stderr, "-n arg error %s (onid=name)\n", optarg);
+					return(-1);
+				}
+			break;
 			default:
-				fprintf(stderr, "Usage: %s [-x] TSfile1 TSfile2 ...\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-x] [-e] [-j jobs] [-n onid=name ...] [-d previous] [-s snapshot] TSfile1 TSfile2 ...\n", argv[0]);
 				return(-1);
 		}
 	}
+	qsort(labels, numOfLabels, sizeof(NETWORK_LABEL), compare_onid);
 
-	if(xmlFlag){
-		if(optind >= argc || argc > 5){
-			fprintf(stderr, "Usage: %s [-x] TSfile1 TSfile2 ...\n", argv[0]);
-			return(-1);
-		}
-	}else{
-		if(argc > 4){
-			fprintf(stderr, "Usage: %s [-x] TSfile1 TSfile2 ...\n", argv[0]);
-			return(-1);
-		}
+	tsfileNum = argc - optind;
+	if(xmlFlag && tsfileNum < 1){
+		fprintf(stderr, "Usage: %s [-x] [-e] [-j jobs] [-n onid=name ...] [-d previous] [-s snapshot] TSfile1 TSfile2 ...\n", argv[0]);
+		return(-1);
 	}
 
-	tsfileNum = argc - optind;
-	for(uint8_t i = 0; i<tsfileNum; i++){
-		if((fp=fopen(argv[optind+i],"r"))==NULL){
-			fprintf(stderr, "file open error : %s\n", argv[optind+i]);
-			return(-1);
-   		 }
-
-		bool find = false;
-
-		while(!feof(fp)){
-			find = create_payload(0x0011, payload, &payload_len, &fp);	/* 0x11 SDT	*/
-			if(find){
-				memset(&sdt, '\0', sizeof(SDT));
-				SDT_set(payload, &sdt);
-				sdtCurrent = sdtArraySet(&sdtArray, &sdt);
-				for(int sDescriptorLength=0; sDescriptorLength<sdt.sectionLength-8-4; sDescriptorLength+=5+sdesc.descriptorsLoopLength){
-																				// 8 : SDT transportStreamId から reservedFutureUse2 までのbyte数
-																				// 4 : SDT CRC32 のbyte数
-																				// sdt.sectionLength-8-4 : SDT sectionData のbyte数
-																				// 5 : serviceId から descriptorsLoopLength までのbyte数
-																				// sdesc.descriptorsLoopLength : descriptor のbyte数
-																				// 5+sdesc.descriptorsLoopLength : SDT Descriptor 1つのbyte数
-					memset(&sdesc, '\0', sizeof(SdtDescriptor));
-					SdtDescriptor_set(sdt.sectionData+sDescriptorLength, &sdesc);
-					sdescCurrent = sdescArraySet(sdtCurrent, &sdesc);
-					uint8_t descriptorTag;
-					for(int descriptorOffset=0; descriptorOffset<sdesc.descriptorsLoopLength; descriptorOffset+=*(sdesc.descriptor+descriptorOffset+1) + 2){
-																				// *(sdesc.descriptor+descriptorOffset+1) : descriptorLength
-																				// 2 : descriptorTag 1byte descriptorLength 1byte
-																				// *(sdesc.descriptor+descriptorOffset+1) + 2はdescriptor1つのbyte数
-						descriptorTag = *(sdesc.descriptor+descriptorOffset);
-						if(descriptorTag==0x48){		// 0x48:サービス記述子
-							memset(&x48, '\0', sizeof(DescriptorX48));
-							DescriptorX48_set(sdesc.descriptor+descriptorOffset, &x48);
-							x48ArraySet(sdescCurrent, &x48);
-						}else if(descriptorTag==0xcb){	// 0xcb:CA 契約情報記述子
-							memset(&xCB, '\0', sizeof(DescriptorXCB));
-							DescriptorXCB_set(sdesc.descriptor+descriptorOffset, &xCB);
-							xCBArraySet(sdescCurrent, &xCB);
-						}
+	// CPU数のスレッドでファイルを分担する -j 指定時はその数
+	if(jobs<1){
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(jobs<1){
+		jobs = 1;
+	}
+	if((size_t)jobs>tsfileNum){
+		jobs = tsfileNum;
+	}
+	memset(&model, '\0', sizeof(CVI_MODEL));
+	batch.files = argv+optind;
+	batch.numOfFiles = tsfileNum;
+	batch.models = calloc(tsfileNum+1, sizeof(CVI_MODEL));
+	batch.opened = calloc(tsfileNum+1, sizeof(bool));
+	threads = calloc(jobs+1, sizeof(pthread_t));
+	if(batch.models==NULL || batch.opened==NULL || threads==NULL){
+		fprintf(stderr, "memory allocate error\n");
+		return(-1);
+	}
+	pthread_mutex_init(&batch.lock, NULL);
 
-					}
-				}
-			}
+	for(long i=0; i<jobs; i++){
+		if(pthread_create(&threads[i], NULL, batchWorker, &batch)!=0){
+			break;
 		}
-		fclose(fp);
+		started++;
+	}
+	// スレッドを作れなかった場合は自スレッドで処理する
+	if(started==0){
+		batchWorker(&batch);
 	}
+	for(size_t i=0; i<started; i++){
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&batch.lock);
+	free(threads);
 
-	XMLOUTPUT	**xmlBS= NULL;
-	XMLOUTPUT	**xmlCS= NULL;
-	size_t xmlBSSize = 0, xmlCSSize = 0;
+	for(size_t i=0; i<tsfileNum; i++){
+		if(!batch.opened[i]){
+			fprintf(stderr, "file open error : %s\n", batch.files[i]);
+			return(-1);
+		}
+	}
+	// 先頭ファイルのモデルに残りをファイル指定順に併合する
+	if(tsfileNum>0){
+		model = batch.models[0];
+		for(size_t i=1; i<tsfileNum; i++){
+			modelMerge(&model, &batch.models[i]);
+		}
+	}
 
-	if(sdtArray == NULL){
+	sdtArray = model.sdtArray;
+	if(sdtArray == NULL && previousPath == NULL){
 		fprintf(stdout, "SDT Not Found\n");
-	}else{
+	}else if(sdtArray != NULL){
 		for(size_t i=0; *(sdtArray+i) != NULL; i++){
+			NETWORK_GROUP *group = networkGroupGet(&model, &groups, &numOfGroups, &maxGroups, labels, numOfLabels, (*(sdtArray+i))->sdt.originalNetworkId);
+			if(group == NULL){
+				continue;
+			}
 			SDESCARRAY	**sdescWork = (*(sdtArray+i))->sdescArray;
 			for(size_t k=0; *(sdescWork+k) != NULL; k++){
-				XMLOUTPUT *xmlWork = (XMLOUTPUT *)calloc(1,sizeof(XMLOUTPUT));
+				XMLOUTPUT *xmlWork = (XMLOUTPUT *)arenaAlloc(&model.arena, sizeof(XMLOUTPUT));
+				if(xmlWork == NULL){
+					continue;
+				}
 				xmlWork->sdt = &((*(sdtArray+i))->sdt);
 				xmlWork->sdesc = &((*(sdescWork+k))->sdesc);
 				xmlWork->x48 = (*(sdescWork+k))->x48;
 				xmlWork->xCBArray = (*(sdescWork+k))->xCBArray;
-
-				if((*(sdtArray+i))->sdt.originalNetworkId == 4){	// BS
-					xmlBS = (XMLOUTPUT **)realloc(xmlBS, sizeof(XMLOUTPUT *) * (xmlBSSize+1));
-					*(xmlBS+xmlBSSize) = xmlWork;
-					xmlBSSize++;
-				}else if((*(sdtArray+i))->sdt.originalNetworkId == 6 || (*(sdtArray+i))->sdt.originalNetworkId == 7){	// CS
-					xmlCS = (XMLOUTPUT **)realloc(xmlCS, sizeof(XMLOUTPUT *) * (xmlCSSize+1));
-					*(xmlCS+xmlCSSize) = xmlWork;
-					xmlCSSize++;
-				}
+				ARRAY_APPEND(&model.arena, group->xml, group->numOfXml, group->maxXml, xmlWork);
 			}
 		}
+		// ネットワーク(グループ内の最小onid)順に出力する
+		qsort(groups, numOfGroups, sizeof(NETWORK_GROUP), compare_group);
 
-		if(xmlFlag == 1){
-			qsort(xmlBS, xmlBSSize, sizeof(XMLOUTPUT *), compare_sid);
-			qsort(xmlCS, xmlCSSize, sizeof(XMLOUTPUT *), compare_sid);
-			printXml(xmlBS, xmlBSSize,xmlCS, xmlCSSize);
+		if(previousPath != NULL){
+			for(size_t g=0; g<numOfGroups; g++){
+				sortXml(groups[g].xml, groups[g].numOfXml, false);
+			}
+		}else if(xmlFlag == 1){
+			for(size_t g=0; g<numOfGroups; g++){
+				sortXml(groups[g].xml, groups[g].numOfXml, true);
+			}
+			printXml(groups, numOfGroups);
 		}else{
-			sort_tsid_sid(xmlBS, xmlBSSize);
-			sort_tsid_sid(xmlCS, xmlCSSize);
-			printInfo(xmlBS, xmlBSSize);
-			printInfo(xmlCS, xmlCSSize);
+			for(size_t g=0; g<numOfGroups; g++){
+				sortXml(groups[g].xml, groups[g].numOfXml, false);
+				fprintf(stdout, "======================== %s ========================\n", groups[g].label);
+				printInfo(groups[g].xml, groups[g].numOfXml);
+			}
 		}
+	}
 
-		/* アロケートメモリ解放 */
-		for(size_t i=0; i<xmlBSSize;i++){
-			free(*(xmlBS+i));
+	// 差分モード 変更があれば終了コード 1
+	memset(&previous, '\0', sizeof(CVI_ENTRIES));
+	memset(&current, '\0', sizeof(CVI_ENTRIES));
+	if(previousPath != NULL || snapshotPath != NULL){
+		if(!entriesBuild(&model, groups, numOfGroups, &current)){
+			fprintf(stderr, "memory allocate error\n");
+			rtn = -1;
 		}
-		free(xmlBS);
-		for(size_t i=0; i<xmlCSSize;i++){
-			free(*(xmlCS+i));
+	}
+	if(rtn == 0 && previousPath != NULL){
+		if(!previousLoad(&model, previousPath, &previous)){
+			fprintf(stderr, "previous result read error : %s\n", previousPath);
+			rtn = -1;
+		}else if(cviDiff(&model, &previous, &current) > 0){
+			rtn = 1;
 		}
-		free(xmlCS);
-		for(size_t i=0; *(sdtArray+i) != NULL; i++){
-			SDESCARRAY	**sdescWork = (*(sdtArray+i))->sdescArray;
-			for(size_t k=0; *(sdescWork+k) != NULL; k++){
-				free((*(sdescWork+k))->x48->serviceProviderName);
-				free((*(sdescWork+k))->x48->serviceName);
-				free((*(sdescWork+k))->x48);
-				if((*(sdescWork+k))->xCBArray != NULL){
-					for(size_t g=0; *((*(sdescWork+k))->xCBArray+g) != NULL; g++){
-						free((*((*(sdescWork+k))->xCBArray+g))->contractVerificationInfo);
-						free((*((*(sdescWork+k))->xCBArray+g))->feeName);
-						free(*((*(sdescWork+k))->xCBArray+g));
-					}
-				}
-				free((*(sdescWork+k))->xCBArray);
-				free(*(sdescWork+k));
-			}
-			free(sdescWork);
-			free(*(sdtArray+i));
+	}
+	if(rtn >= 0 && snapshotPath != NULL){
+		if(!snapshotWrite(snapshotPath, &current)){
+			fprintf(stderr, "snapshot write error : %s\n", snapshotPath);
+			rtn = -1;
 		}
-		free(sdtArray);
 	}
 
-	return(0);
+	/* アロケートメモリ解放 モデルの要素はすべてアリーナ上にある */
+	/* 併合したモデルの要素は併合元のアリーナ上にもあるので併合元も解放する */
+	arenaFree(&model.arena);
+	aribCacheFree(model.textCache);
+	for(size_t i=1; i<tsfileNum; i++){
+		arenaFree(&batch.models[i].arena);
+		aribCacheFree(batch.models[i].textCache);
+	}
+	free(batch.models);
+	free(batch.opened);
+	free(labels);
+
+	return(rtn);
 }
 
@@ -10,6 +10,10 @@
 /*            戻値  :SJIS文字列先頭アドレス 終端文字 '\0'                     */
 /*            注意  :アロケートメモリなので使用後freeすること                 */
 /*                                                                            */
+/* size_t aribTOsjisBuf(const uint8_t *input, size_t length,                  */
+/*                      uint8_t *sjis, size_t sjisSize)                       */
+/*            呼出し側のバッファに書き込む版 戻値:出力したbyte数              */
+/*                                                                            */
 /******************************************************************************/
 #include <stdio.h>
 #include <stdbool.h>
@@ -17,6 +21,8 @@
 #include <string.h>
 #include <inttypes.h>
 
+#include "libnkf.h"
+
 	// ARIB ひらがな SJIS 全角ひらがな変換テーブル ([0]:ARIB Code, [1-2]:SJIS 2Byte)
 	const uint8_t hiraganaTable[][3] = {
 			{0x20, 0x81, 0x40}, //"　"
@@ -334,22 +340,48 @@ static bool gsetCheck(uint8_t gset){
 		return(rtn);
 }
 
+#define SJIS_CHAR(c)	(((c) & 0x7F)>=0x21 && ((c) & 0x7F)<=0x7E)	// GL/GR の文字符号
+
 /******************************************************************************/
-/* 関数名：aribTOsjis                                                         */
-/* 機能  ：ARIB文字コードをSJISに変換する                                     */
-/*           但し、ASCIIひらがなカタカナ漢字のみとし、ARIB外字には対応しない  */
+/* 内部関数                                                                   */
+/* static const uint8_t (*kanaTable(uint8_t gset))[3]                         */
+/* 1バイト符号集合に対応する変換テーブルを返す 対象外はNULL                   */
+/******************************************************************************/
+static const uint8_t (*kanaTable(uint8_t gset))[3]
+{
+	switch(gset){
+		case GSET_HIRAGANA:
+		case GSET_P_HIRAGANA:
+			return(hiraganaTable);
+		case GSET_KATAKANA:
+		case GSET_P_KATAKANA:
+		case GSET_JIS_X0201_KATAKANA:
+			return(katakanaTable);
+		default:
+			return(NULL);
+	}
+}
+
+/******************************************************************************/
+/* 関数名：aribTOsjisBuf                                                      */
+/* 機能  ：ARIB文字コードをSJISに変換し呼出し側のバッファに書き込む           */
+/*           aribTOsjis と同じ変換結果を返す                                  */
 /*                                                                            */
-/* char *aribTOsjis(uint8_t *input, size_t length)                            */
-/*            input :ARIB文字列                                               */
-/*            length:ARIB文字列byte数                                         */
-/*            戻値  :SJIS文字列先頭アドレス 終端文字 '\0'                     */
-/*            注意  :アロケートメモリなので使用後freeすること                 */
+/* size_t aribTOsjisBuf(const uint8_t *input, size_t length,                  */
+/*                      uint8_t *sjis, size_t sjisSize)                       */
+/*            input   :ARIB文字列                                             */
+/*            length  :ARIB文字列byte数                                       */
+/*            sjis    :出力バッファ                                           */
+/*            sjisSize:出力バッファbyte数                                     */
+/*                     ARIB_SJIS_BUFSIZE(length) あれば切り捨ては起きない     */
+/*            戻値    :出力したbyte数 終端文字 '\0' は含まない                */
+/*                     バッファが足りない場合は文字単位で切り捨てる           */
 /*                                                                            */
+/* 書込み位置はカーソルで保持するので入力長に対して線形時間で変換する         */
+/* 同じ符号集合の文字が続く間は符号集合の判定を繰り返さず表引きだけ行う       */
 /******************************************************************************/
-uint8_t *aribTOsjis(uint8_t *input, size_t length)
+size_t aribTOsjisBuf(const uint8_t *input, size_t length, uint8_t *sjis, size_t sjisSize)
 {
-	uint8_t *sjis;
-
 	// 中間バッファ デフォルト文字テーブル
 	uint8_t G0 = GSET_KANJI;	// 漢字
 	uint8_t G1 = GSET_ASCII;	// ASCII
@@ -359,241 +391,216 @@ uint8_t *aribTOsjis(uint8_t *input, size_t length)
 	uint8_t GL = G0;
 	uint8_t GR = G2;
 
-	int8_t beforeBuf = -1;
+	int16_t beforeBuf = -1;
 
-//	bool char2Byte = true;	// true:2byte/false:1byte
+	uint8_t *cur, *end;
 
-	if( (sjis = (uint8_t *)malloc(length*2+1))==NULL){
-		return(NULL);
+	if(sjisSize==0){
+		return(0);
 	}
-	memset(sjis, '\0', length*2+1);
+	cur = sjis;
+	end = sjis+sjisSize-1;
 
-	int offSet = 0;
+	size_t offSet = 0;
 	while(offSet < length){
-
-		/************************/
-		/* GL GR 割当コマンド	*/
-		/************************/
-		// 使わない制御コードを読み飛ばす
-		if( *(input+offSet)==0x00 ||
-			*(input+offSet)==0x16 ||
-			*(input+offSet)==0x18 ||
-			*(input+offSet)==0x1C ||
-			*(input+offSet)==0x1E ||
-			*(input+offSet)==0x1F ||
-			*(input+offSet)==0x20 ||
-			*(input+offSet)==0x7f ||
-			*(input+offSet)==0xA0 ||
-			*(input+offSet)==0xFF ||
-			(*(input+offSet)>=0x07 && *(input+offSet)<=0x0D) ||
-			(*(input+offSet)>=0x80 && *(input+offSet)<=0x8B) ||
-			(*(input+offSet)>=0x90 && *(input+offSet)<=0x9D)){
-			offSet += 1;
-			continue;
-		}
-
-		//  GL に中間バッファ G0-G3 をセット
-		// 次の文字を処理する為に1byte シフト
-		// ループ先頭に戻す
-		if(*(input+offSet) == G0toGL){
-			GL = G0;
-			offSet += 1;
-			continue;
-		}else if(*(input+offSet) == G1toGL){
-			GL = G1;										
-			offSet += 1;
-			continue;
-		}else if(*(input+offSet) == G2toGL_ONCE){
-			beforeBuf = GL;
-			GL = G2;
-			offSet += 1;
-			continue;
-		}else if(*(input+offSet) == G3toGL_ONCE){
-			beforeBuf = GL;
-			GL = G3;
-			offSet += 1;
-			continue;
-
-		}else if(*(input+offSet) == 0x1B){				// 制御コードなのでコマンド
-
-			if(!memcmp(G2toGL, input+offSet, sizeof(G2toGL))){
-				GL = G2;									// G2をGLに割り当てる
-				offSet += sizeof(G2toGL);					// 次の文字を処理する為に2byte シフト
-			}else if(!memcmp(G3toGL, input+offSet, sizeof(G3toGL))){
-				GL = G3;									// G3をGLに割り当てる
-				offSet += sizeof(G3toGL);					// 次の文字を処理する為に2byte シフト
-			}else if(!memcmp(G1toGR, input+offSet, sizeof(G1toGR))){
-				GR = G1;									// G1をGRに割り当てる
-				offSet += sizeof(G1toGR);					// 次の文字を処理する為に2byte シフト
-			}else if(!memcmp(G2toGR, input+offSet, sizeof(G2toGR))){
-				GR = G2;									// G2をGRに割り当てる
-				offSet += sizeof(G2toGR);					// 次の文字を処理する為に2byte シフト
-			}else if(!memcmp(G3toGR, input+offSet, sizeof(G3toGR))){
-				GR = G3;									// コマンド:G3をGRに割り当てる
-				offSet += sizeof(G3toGR);					// 次の文字を処理する為に2byte シフト
-
-			/****************************/
-			/* 中間バッファ割当コマンド	*/
-			/****************************/
-
-			// 制御コードをチェックし、適合した場合、その直後の1byteを終端符号としてG0-G3にセットする
-			// 但し処理不能な制御コードは対応しない
-			// 1byte 文字制御
-			}else if(!memcmp(D1GSETtoG0, input+offSet, sizeof(D1GSETtoG0))){
-				if(gsetCheck(*(input+offSet+sizeof(D1GSETtoG0)))){ G0 = *(input+offSet+sizeof(D1GSETtoG0));}
-				offSet += sizeof(D1GSETtoG0) + 1;				
-
-			}else if(!memcmp(D1GSETtoG1, input+offSet, sizeof(D1GSETtoG1))){
-				if(gsetCheck(*(input+offSet+sizeof(D1GSETtoG1)))){ G1 = *(input+offSet+sizeof(D1GSETtoG1));}
-				G1 = *(input+offSet+sizeof(D1GSETtoG1));
-				offSet += sizeof(D1GSETtoG1) + 1;
-
-			}else if(!memcmp(D1GSETtoG2, input+offSet, sizeof(D1GSETtoG2))){
-				if(gsetCheck(*(input+offSet+sizeof(D1GSETtoG2)))){ G2 = *(input+offSet+sizeof(D1GSETtoG2));}
-				offSet += sizeof(D1GSETtoG2) + 1;
-
-			}else if(!memcmp(D1GSETtoG3, input+offSet, sizeof(D1GSETtoG3))){
-				if(gsetCheck(*(input+offSet+sizeof(D1GSETtoG3)))){ G3 = *(input+offSet+sizeof(D1GSETtoG3));}
-				offSet += sizeof(D1GSETtoG3)+ 1;
-
-			// 2byte 文字制御
-
-			}else if(!memcmp(D2GSETtoG0, input+offSet, sizeof(D2GSETtoG0))){
-				if(gsetCheck(*(input+offSet+sizeof(D2GSETtoG0)))){ G0 = *(input+offSet+sizeof(D2GSETtoG0));}
-				offSet += sizeof(D2GSETtoG0) + 1;
-
-			}else if(!memcmp(D2GSETtoG1, input+offSet, sizeof(D2GSETtoG1))){
-				if(gsetCheck(*(input+offSet+sizeof(D2GSETtoG1)))){ G1 = *(input+offSet+sizeof(D2GSETtoG1));}
-				offSet += sizeof(D2GSETtoG1) + 1;
-
-			}else if(!memcmp(D2GSETtoG2, input+offSet, sizeof(D2GSETtoG2))){
-				if(gsetCheck(*(input+offSet+sizeof(D2GSETtoG2)))){ G2 = *(input+offSet+sizeof(D2GSETtoG2));}
-				offSet += sizeof(D2GSETtoG2) + 1;
-
-			}else if(!memcmp(D2GSETtoG3, input+offSet, sizeof(D2GSETtoG3))){
-				if(gsetCheck(*(input+offSet+sizeof(D2GSETtoG3)))){ G3 = *(input+offSet+sizeof(D2GSETtoG3));}
-				offSet += sizeof(D2GSETtoG3) + 1;
-
-			}else{
-				// 1B(ESC)の後続に当てはまる制御コードがなければ読み捨てる
-				offSet += 1;
-			}
-					
-			continue;
-		}
+		uint8_t c = *(input+offSet);
 
 		/************************************************************************/
-		/* 文字データ処理														*/
-		/* 制御系データの場合、continueでループ頭に戻すのでここには入ってこない	*/
+		/* 文字データ処理                                                       */
+		/* GL(0x21-0x7E)/GR(0xA1-0xFE) の同じ側の文字が続く間はまとめて処理する */
 		/************************************************************************/
+		if(SJIS_CHAR(c)){
+			uint8_t mask = c & 0x80;
+			uint8_t gset = mask ? GR : GL;
+			const uint8_t (*table)[3];
+			size_t run;
+
+			// SS2/SS3 の場合は1文字だけ処理する
+			if(beforeBuf!=-1){
+				run = offSet+1;
+			}else{
+				run = offSet+aribRunLength(input+offSet, length-offSet, mask);
+			}
 
-		if( (*(input+offSet) >= 0x20) &&
-			(*(input+offSet) <= 0x7F) ){
-			switch(GL){
-				uint8_t henkan[2];
+			switch(gset){
 				case GSET_KANJI:	// 漢字
 				case GSET_JIS_COMPATIBLE_KANJI1:
 				case GSET_JIS_COMPATIBLE_KANJI2:
-				// 漢字変換処理
-					henkan[0] = (*(input+offSet)-0x21) / 2 + ((*(input+offSet)<=0x5E) ? 0x81 : 0xC1);
-					if(((*(input+offSet)) & 0x01) == 1){
-						henkan[1] = *(input+offSet+1) + ((*(input+offSet+1)<=0x5F) ? 0x1F : 0x20);
-					}else{
-						henkan[1] = *(input+offSet+1) + 0x7E;
-					}
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
-					offSet += 2;
+				// 漢字変換処理 2byteずつ
+					do{
+						uint8_t c1 = *(input+offSet) & 0x7F;
+						uint8_t c2;
+						if(offSet+1 >= length){
+							// 後続byteがない
+							offSet = length;
+							break;
+						}
+						c2 = mask ? (*(input+offSet+1) & 0x7F) : *(input+offSet+1);
+						if(cur+2 > end){
+							goto full;
+						}
+						*cur++ = (c1-0x21) / 2 + ((c1<=0x5E) ? 0x81 : 0xC1);
+						if((c1 & 0x01) == 1){
+							*cur = c2 + ((c2<=0x5F) ? 0x1F : 0x20);
+						}else{
+							*cur = c2 + 0x7E;
+						}
+						// 範囲外の2byte目が 0x00 になる場合は出力しない (従来と同じ)
+						if(*cur != '\0'){
+							cur++;
+						}
+						offSet += 2;
+					}while(offSet < run);
 					break;
 
 				case GSET_ASCII:	// ASCII
 				case GSET_P_ASCII:
-				// 編集バッファに追加する
-					memcpy(sjis+strlen((char *)sjis), input+offSet, 1);
-					offSet += 1;
+				// 最上位ビットを0にして連続する文字をまとめて追加する
+					if(cur+(run-offSet) > end){
+						run = offSet+(end-cur);
+					}
+					if(run==offSet){
+						goto full;
+					}
+					for(; offSet<run; offSet++){
+						*cur++ = *(input+offSet) & 0x7F;
+					}
 					break;
 
 				case GSET_HIRAGANA:	// 平仮名
 				case GSET_P_HIRAGANA:
-				// 対応するSJISコードを編集バッファに追加する
-					henkan[0] = hiraganaTable[*(input+offSet)-0x20][1];
-					henkan[1] = hiraganaTable[*(input+offSet)-0x20][2];
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
-					offSet += 1;
-					break;
-
 				case GSET_KATAKANA:	// カタカナ
-				case GSET_JIS_X0201_KATAKANA:
 				case GSET_P_KATAKANA:
-				// 対応するSJISコードを編集バッファに追加する
-					henkan[0] = katakanaTable[*(input+offSet)-0x20][1];
-					henkan[1] = katakanaTable[*(input+offSet)-0x20][2];
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
-					offSet += 1;
+				case GSET_JIS_X0201_KATAKANA:
+				// 対応するSJISコードを表引きして追加する
+					table = kanaTable(gset);
+					for(; offSet<run; offSet++){
+						if(cur+2 > end){
+							goto full;
+						}
+						*cur++ = table[(*(input+offSet) & 0x7F)-0x20][1];
+						*cur++ = table[(*(input+offSet) & 0x7F)-0x20][2];
+					}
 					break;
 
 				case GSET_ADD_CODE:	// 追加記号 (2byte)
 				// 文字化け防止用に ？ をセットする
-					henkan[0] = 0x81;
-					henkan[1] = 0x48;
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
+					if(cur+2 > end){
+						goto full;
+					}
+					*cur++ = 0x81;
+					*cur++ = 0x48;
 					offSet += 2;
 					break;
+
+				default:
+				// 変換できない符号集合の文字は読み捨てる
+					offSet += 1;
+					break;
 			}
 
 			if(beforeBuf != -1){
 				GL = beforeBuf;
 				beforeBuf = -1;
 			}
+			continue;
+		}
 
+		/************************/
+		/* GL GR 割当コマンド	*/
+		/************************/
+		//  GL に中間バッファ G0-G3 をセット
+		// 次の文字を処理する為に1byte シフト
+		// ループ先頭に戻す
+		if(c == G0toGL){
+			GL = G0;
+			offSet += 1;
+		}else if(c == G1toGL){
+			GL = G1;
+			offSet += 1;
+		}else if(c == G2toGL_ONCE){
+			beforeBuf = GL;
+			GL = G2;
+			offSet += 1;
+		}else if(c == G3toGL_ONCE){
+			beforeBuf = GL;
+			GL = G3;
+			offSet += 1;
 
-		}else if(*(input+offSet) > 0x7F){
-			switch(GR){
-				uint8_t henkan[2];
-				case GSET_ASCII:	// ASCII
-				case GSET_P_ASCII:
-					// 最上位ビットを0にして編集バッファに追加する
-					henkan[0] = *(input+offSet) & 0x7F;
-					memcpy(sjis+strlen((char *)sjis), henkan, 1);
-					offSet += 1;
-					break;
+		}else if(c == 0x1B){				// 制御コードなのでコマンド
+			size_t rest = length-offSet;
+			uint8_t f;
 
-				case GSET_HIRAGANA:	// 平仮名
-				case GSET_P_HIRAGANA:
-					// 最上位ビットを0にして対応するSJISコードを編集バッファに追加する
-					henkan[0] = hiraganaTable[(*(input+offSet)&0x7F)-0x20][1];
-					henkan[1] = hiraganaTable[(*(input+offSet)&0x7F)-0x20][2];
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
-					offSet += 1;
+			if(rest < 2){
+				break;
+			}
+			switch(*(input+offSet+1)){
+				case 0x6E: GL = G2; offSet += sizeof(G2toGL); continue;		// LS2  G2をGLに割り当てる
+				case 0x6F: GL = G3; offSet += sizeof(G3toGL); continue;		// LS3  G3をGLに割り当てる
+				case 0x7E: GR = G1; offSet += sizeof(G1toGR); continue;		// LS1R G1をGRに割り当てる
+				case 0x7D: GR = G2; offSet += sizeof(G2toGR); continue;		// LS2R G2をGRに割り当てる
+				case 0x7C: GR = G3; offSet += sizeof(G3toGR); continue;		// LS3R G3をGRに割り当てる
+				case 0x28: case 0x29: case 0x2A: case 0x2B:	case 0x24:
 					break;
-
-				case GSET_KATAKANA:	// カタカナ
-				case GSET_P_KATAKANA:
-				case GSET_JIS_X0201_KATAKANA:
-					// 最上位ビットを0にして対応するSJISコードを編集バッファに追加する
-					henkan[0] = katakanaTable[(*(input+offSet)&0x7F)-0x20][1];
-					henkan[1] = katakanaTable[(*(input+offSet)&0x7F)-0x20][2];
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
+				default:
+					// 1B(ESC)の後続に当てはまる制御コードがなければ読み捨てる
 					offSet += 1;
-					break;
+					continue;
+			}
 
-				case GSET_ADD_CODE:	// 追加記号 (2byte)
-					// 文字化け防止用に ？ をセットする
-					henkan[0] = 0x81;
-					henkan[1] = 0x48;
-					memcpy(sjis+strlen((char *)sjis), henkan, 2);
-					offSet += 2;
-					break;
+			/****************************/
+			/* 中間バッファ割当コマンド	*/
+			/****************************/
+			// 制御コードの直後の1byteを終端符号としてG0-G3にセットする
+			// 但し処理不能な終端符号は無視する (終端符号の位置は従来通り固定で
+			// ESC $ ) F 等の3byte形式や DRCS は後続byteを文字として扱う)
+			if(rest < 3){
+				break;
 			}
-			if(beforeBuf != -1){
-				GL = beforeBuf;
-				beforeBuf = -1;
+			f = *(input+offSet+2);
+			if(gsetCheck(f)){
+				switch(*(input+offSet+1)){
+					case 0x28: G0 = f; break;
+					case 0x29: G1 = f; break;
+					case 0x2A: G2 = f; break;
+					case 0x2B: G3 = f; break;
+					case 0x24: G0 = f; break;	// 2byte GSET -> G0
+				}
 			}
+			offSet += 3;
+
 		}else{
-			// 当てはまらなかった文字は読み捨てる
+			// 使わない制御コード・当てはまらなかった文字は読み捨てる
 			offSet += 1;
 		}
 	}
 
-	return(sjis);
+full:
+	*cur = '\0';
+	return(cur-sjis);
 }
 
+/******************************************************************************/
+/* 関数名：aribTOsjis                                                         */
+/* 機能  ：ARIB文字コードをSJISに変換する                                     */
+/*           但し、ASCIIひらがなカタカナ漢字のみとし、ARIB外字には対応しない  */
+/*                                                                            */
+/* char *aribTOsjis(uint8_t *input, size_t length)                            */
+/*            input :ARIB文字列                                               */
+/*            length:ARIB文字列byte数                                         */
+/*            戻値  :SJIS文字列先頭アドレス 終端文字 '\0'                     */
+/*            注意  :アロケートメモリなので使用後freeすること                 */
+/*                   アロケートしない場合は aribTOsjisBuf を使用する          */
+/*                                                                            */
+/******************************************************************************/
+uint8_t *aribTOsjis(uint8_t *input, size_t length)
+{
+	uint8_t *sjis;
+
+	if( (sjis = (uint8_t *)malloc(ARIB_SJIS_BUFSIZE(length)))==NULL){
+		return(NULL);
+	}
+	aribTOsjisBuf(input, length, sjis, ARIB_SJIS_BUFSIZE(length));
+
+	return(sjis);
+}
@@ -0,0 +1,249 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* 関数名：aribCacheNew / aribCacheUtf8 / aribCacheLimit / aribCacheFree      */
+/* 機能  ：ARIB文字列 → UTF-8 変換結果のインターンキャッシュ                  */
+/*           同じARIBバイト列の2回目以降の変換はハッシュ検索1回で済ませる     */
+/*           変換元バイト列と変換結果はアリーナにまとめて確保し               */
+/*           aribCacheFree で一括解放する                                     */
+/*                                                                            */
+/* const uint8_t *aribCacheUtf8(ARIB_CACHE *cache, const uint8_t *arib,       */
+/*                              size_t len, size_t *utf8Len)                  */
+/*            arib   :ARIB文字列                                              */
+/*            len    :ARIB文字列byte数                                        */
+/*            utf8Len:変換結果byte数を返す NULL可                             */
+/*            戻値   :変換結果 '\0' 終端 NULL:メモリ不足                      */
+/*                    aribCacheFree まで有効 呼出し側で free しないこと       */
+/*                                                                            */
+/* void aribCacheLimit(ARIB_CACHE *cache, size_t maxBytes)                    */
+/*            登録する変換元と変換結果の合計byte数の上限 0:無制限(省略時)     */
+/*            上限を超える場合は登録済みを全て捨ててから登録するので          */
+/*            aribCacheUtf8 の戻値は次の aribCacheUtf8 呼出しまで有効となる   */
+/*            (続けて現れない長い文字列でキャッシュが増え続けないようにする)  */
+/*                                                                            */
+/* スレッドセーフではないので複数スレッドで使う場合はスレッド毎に作成する     */
+/******************************************************************************/
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "libnkf.h"
+
+#define CACHE_BLOCK_SIZE	(64*1024)	// アリーナ1ブロックのbyte数
+#define CACHE_INIT_SLOTS	1024		// ハッシュ表の初期スロット数 (2のべき乗)
+
+// アリーナブロック 使い切ったら次のブロックを確保して連結する
+typedef struct cacheBlock {
+	struct cacheBlock	*next;
+	size_t				size;		// data のbyte数
+	size_t				used;		// 使用済みbyte数
+	uint8_t				data[];
+} CACHE_BLOCK;
+
+// ハッシュ表の要素 key/utf8 はアリーナ内を指す
+typedef struct {
+	uint64_t		hash;
+	const uint8_t	*key;
+	const uint8_t	*utf8;
+	uint32_t		keyLen;
+	uint32_t		utf8Len;
+} CACHE_ENTRY;
+
+struct aribCache {
+	CACHE_BLOCK		*block;			// 現在のブロック (先頭)
+	CACHE_ENTRY		*slots;			// オープンアドレス法 key==NULL:空き
+	size_t			numOfSlots;
+	size_t			numOfEntries;
+	size_t			bytes;			// 登録済みの変換元と変換結果のbyte数
+	size_t			limit;			// bytes の上限 0:無制限
+};
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* FNV-1a 64bit                                                               */
+/******************************************************************************/
+static uint64_t cacheHash(const uint8_t *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for(size_t i=0; i<len; i++){
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return(h);
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* アリーナから size byte 以上の空きを持つブロックを返す                      */
+/* 確保は used を進めて行う 戻値:NULL メモリ不足                              */
+/******************************************************************************/
+static CACHE_BLOCK *cacheReserve(ARIB_CACHE *cache, size_t size)
+{
+	CACHE_BLOCK *b = cache->block;
+
+	if(b!=NULL && b->size-b->used >= size){
+		return(b);
+	}
+	size_t blockSize = (size>CACHE_BLOCK_SIZE) ? size : CACHE_BLOCK_SIZE;
+	if((b = malloc(sizeof(CACHE_BLOCK)+blockSize))==NULL){
+		return(NULL);
+	}
+	b->size	= blockSize;
+	b->used	= 0;
+	b->next	= cache->block;
+	cache->block = b;
+	return(b);
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* ハッシュ表を2倍に広げて入れ直す                                            */
+/******************************************************************************/
+static bool cacheGrow(ARIB_CACHE *cache)
+{
+	size_t numOfSlots = cache->numOfSlots*2;
+	CACHE_ENTRY *slots;
+
+	if((slots = calloc(numOfSlots, sizeof(CACHE_ENTRY)))==NULL){
+		return(false);
+	}
+	for(size_t i=0; i<cache->numOfSlots; i++){
+		CACHE_ENTRY *e = &cache->slots[i];
+		if(e->key==NULL){
+			continue;
+		}
+		size_t k = e->hash & (numOfSlots-1);
+		while(slots[k].key!=NULL){
+			k = (k+1) & (numOfSlots-1);
+		}
+		slots[k] = *e;
+	}
+	free(cache->slots);
+	cache->slots		= slots;
+	cache->numOfSlots	= numOfSlots;
+	return(true);
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* 登録済みを全て捨てる 先頭ブロックだけ残して使い直す                        */
+/******************************************************************************/
+static void cacheClear(ARIB_CACHE *cache)
+{
+	CACHE_BLOCK *b = cache->block;
+
+	if(b!=NULL){
+		while(b->next!=NULL){
+			CACHE_BLOCK *next = b->next->next;
+			free(b->next);
+			b->next = next;
+		}
+		b->used = 0;
+	}
+	memset(cache->slots, '\0', sizeof(CACHE_ENTRY)*cache->numOfSlots);
+	cache->numOfEntries	= 0;
+	cache->bytes		= 0;
+}
+
+ARIB_CACHE *aribCacheNew(void)
+{
+	ARIB_CACHE *cache;
+
+	if((cache = calloc(1, sizeof(ARIB_CACHE)))==NULL){
+		return(NULL);
+	}
+	if((cache->slots = calloc(CACHE_INIT_SLOTS, sizeof(CACHE_ENTRY)))==NULL){
+		free(cache);
+		return(NULL);
+	}
+	cache->numOfSlots = CACHE_INIT_SLOTS;
+	return(cache);
+}
+
+const uint8_t *aribCacheUtf8(ARIB_CACHE *cache, const uint8_t *arib, size_t len, size_t *utf8Len)
+{
+	static const uint8_t empty[1] = {'\0'};
+	uint64_t hash;
+	size_t k;
+
+	if(len==0){
+		if(utf8Len!=NULL){
+			*utf8Len = 0;
+		}
+		return(empty);
+	}
+
+	hash = cacheHash(arib, len);
+	for(k=hash & (cache->numOfSlots-1); cache->slots[k].key!=NULL; k=(k+1) & (cache->numOfSlots-1)){
+		CACHE_ENTRY *e = &cache->slots[k];
+		if(e->hash==hash && e->keyLen==len && !memcmp(e->key, arib, len)){
+			if(utf8Len!=NULL){
+				*utf8Len = e->utf8Len;
+			}
+			return(e->utf8);
+		}
+	}
+
+	// 未登録 上限を超える場合は全て捨ててから登録する
+	if(cache->limit>0 && cache->numOfEntries>0 && cache->bytes+len+ARIB_UTF8_BUFSIZE(len) > cache->limit){
+		cacheClear(cache);
+		k = hash & (cache->numOfSlots-1);
+	}
+
+	// 負荷率 3/4 を超える場合は先に広げて空きスロットを探し直す
+	if((cache->numOfEntries+1)*4 > cache->numOfSlots*3){
+		if(cacheGrow(cache)){
+			for(k=hash & (cache->numOfSlots-1); cache->slots[k].key!=NULL; k=(k+1) & (cache->numOfSlots-1)){
+				;
+			}
+		}else if(cache->numOfEntries+1 >= cache->numOfSlots){
+			return(NULL);
+		}
+	}
+
+	// 変換元と変換結果をアリーナに続けて置き 結果の分だけ確保を確定する
+	CACHE_BLOCK *b;
+	if((b = cacheReserve(cache, len+ARIB_UTF8_BUFSIZE(len)))==NULL){
+		return(NULL);
+	}
+	uint8_t *key	= b->data+b->used;
+	uint8_t *utf8	= key+len;
+	memcpy(key, arib, len);
+	size_t n = aribTOutf8(arib, len, utf8, ARIB_UTF8_BUFSIZE(len));
+	b->used += len+n+1;
+	cache->bytes += len+n+1;
+
+	CACHE_ENTRY *e = &cache->slots[k];
+	e->hash		= hash;
+	e->key		= key;
+	e->keyLen	= len;
+	e->utf8		= utf8;
+	e->utf8Len	= n;
+	cache->numOfEntries++;
+
+	if(utf8Len!=NULL){
+		*utf8Len = n;
+	}
+	return(utf8);
+}
+
+void aribCacheLimit(ARIB_CACHE *cache, size_t maxBytes)
+{
+	cache->limit = maxBytes;
+}
+
+void aribCacheFree(ARIB_CACHE *cache)
+{
+	if(cache==NULL){
+		return;
+	}
+	while(cache->block!=NULL){
+		CACHE_BLOCK *next = cache->block->next;
+		free(cache->block);
+		cache->block = next;
+	}
+	free(cache->slots);
+	free(cache);
+}
@@ -25,6 +25,7 @@ Changes.
 */
 #include "libnkf.h"
 #include <setjmp.h>
+#include <pthread.h>
 
 #undef getc
 #undef ungetc
@@ -36,20 +37,36 @@ Changes.
 #undef FALSE
 #define putchar(c)      pynkf_putchar(c)
 
-static int pynkf_ibufsize, pynkf_obufsize;
-static unsigned char *pynkf_inbuf, *pynkf_outbuf;
-static int pynkf_icount,pynkf_ocount;
-static unsigned char *pynkf_iptr, *pynkf_optr;
-static jmp_buf env;
-static int pynkf_guess_flag;
+/*
+ * 変換コンテキスト
+ * 入出力バッファとエラー時の復帰先を保持する
+ * nkf.c 側の変換状態は NKF_TLS(__thread) でスレッド毎に持ち、変換毎に reinit() で初期化するので
+ * スレッド毎に別のコンテキストを使えば並行して変換できる
+ * (1つのコンテキストを複数スレッドで同時に使うことはできない)
+ */
+struct nkf_ctx {
+  int ibufsize, obufsize;
+  unsigned char *inbuf, *outbuf;
+  int icount, ocount;
+  unsigned char *iptr, *optr;
+  jmp_buf env;
+  int guess_flag;
+};
+
+/* 変換中のコンテキスト nkf.c から呼ばれる pynkf_getc/pynkf_putchar が参照する */
+static __thread NKF_CTX *pynkf_ctx;
+
+/* nkf_convert/nkf_guess 用 スレッド毎の既定コンテキスト */
+static __thread NKF_CTX pynkf_default_ctx;
 
 static int 
 pynkf_getc(FILE *f)
 {
+  NKF_CTX *ctx = pynkf_ctx;
   unsigned char c;
-  if (pynkf_icount >= pynkf_ibufsize) return EOF;
-  c = *pynkf_iptr++;
-  pynkf_icount++;
+  if (ctx->icount >= ctx->ibufsize) return EOF;
+  c = *ctx->iptr++;
+  ctx->icount++;
   return (int)c;
 }
 
@@ -67,32 +84,37 @@ pynkf_ungetc(int c, FILE *f)
 static void
 pynkf_putchar(int c)
 {
+  NKF_CTX *ctx = pynkf_ctx;
   size_t size;
   unsigned char *p;
 
-  if (pynkf_guess_flag) {
+  if (ctx->guess_flag) {
     return;
   }
 
-  if (pynkf_ocount--){
-    *pynkf_optr++ = c;
+  if (ctx->ocount--){
+    *ctx->optr++ = c;
   }else{
-    size = pynkf_obufsize + pynkf_obufsize;
+    size = ctx->obufsize + ctx->obufsize;
 /*
     p = (unsigned char *)PyMem_Realloc(pynkf_outbuf, size + 1);
 */
-    p = (unsigned char *)realloc(pynkf_outbuf, size + 1);
-    if (pynkf_outbuf == NULL){ longjmp(env, 1); }
-    pynkf_outbuf = p;
-    pynkf_optr = pynkf_outbuf + pynkf_obufsize;
-    pynkf_ocount = pynkf_obufsize;
-    pynkf_obufsize = size;
-    *pynkf_optr++ = c;
-    pynkf_ocount--;
+    p = (unsigned char *)realloc(ctx->outbuf, size + 1);
+    if (p == NULL){ longjmp(ctx->env, 1); }
+    ctx->outbuf = p;
+    ctx->optr = ctx->outbuf + ctx->obufsize;
+    ctx->ocount = ctx->obufsize;
+    ctx->obufsize = size;
+    *ctx->optr++ = c;
+    ctx->ocount--;
   }
 }
 
 #define PERL_XS 1
+#define NKF_TLS __thread
+#define NKF_STATE_NEW(state) pynkf_state_keep(state)
+#define NKF_STATE_DISPOSE 1
+static void pynkf_state_keep(void *state);
 /*
 #include "../utf8tbl.c"
 #include "../nkf.c"
@@ -100,39 +122,93 @@ pynkf_putchar(int c)
 #include "utf8tbl.c"
 #include "nkf.c"
 
+/*
+ * スレッド毎の nkf_state はスレッド終了時に解放する
+ * (ワーカースレッドで変換する度にバッファが残らないようにする)
+ */
+static pthread_key_t pynkf_state_key;
+static pthread_once_t pynkf_state_once = PTHREAD_ONCE_INIT;
+static int pynkf_state_keyed;
+
+static void
+pynkf_state_free(void *p)
+{
+  nkf_state_t *state = (nkf_state_t *)p;
+  nkf_buf_dispose(state->std_gc_buf);
+  nkf_buf_dispose(state->broken_buf);
+  nkf_buf_dispose(state->nfc_buf);
+  nkf_xfree(state);
+}
+
+static void
+pynkf_state_key_create(void)
+{
+  pynkf_state_keyed = (pthread_key_create(&pynkf_state_key, pynkf_state_free) == 0);
+}
+
+static void
+pynkf_state_keep(void *state)
+{
+  pthread_once(&pynkf_state_once, pynkf_state_key_create);
+  if (pynkf_state_keyed){
+    pthread_setspecific(pynkf_state_key, state);
+  }
+}
+
+/*
+ * 変換コンテキストを作成する
+ * 戻値 : 使用後 nkf_ctx_free() で解放すること
+ */
+extern NKF_CTX*
+nkf_ctx_new(void)
+{
+  return (NKF_CTX *)calloc(1, sizeof(NKF_CTX));
+}
+
+extern void
+nkf_ctx_free(NKF_CTX* ctx)
+{
+  free(ctx);
+}
+
 /*
 static PyObject *
 pynkf_convert(unsigned char* str, int strlen, char* opts, int optslen)
 */
+/*
+ * コンテキストを指定して変換する
+ * 戻値 : 変換結果 アロケートメモリなので使用後freeすること
+ */
 extern unsigned char*
-nkf_convert(unsigned char* str, int strlen, char* opts, int optslen)
+nkf_ctx_convert(NKF_CTX* ctx, unsigned char* str, int strlen, char* opts, int optslen)
 {
 /*
   PyObject * res;
 */
 
-  pynkf_ibufsize = strlen + 1;
-  pynkf_obufsize = pynkf_ibufsize * 1.5 + 256;
+  ctx->ibufsize = strlen + 1;
+  ctx->obufsize = ctx->ibufsize * 1.5 + 256;
 /*
   pynkf_outbuf = (unsigned char *)PyMem_Malloc(pynkf_obufsize);
 */
-  pynkf_outbuf = (unsigned char *)malloc(pynkf_obufsize);
+  ctx->outbuf = (unsigned char *)malloc(ctx->obufsize + 1);
 
-  if (pynkf_outbuf == NULL){
+  if (ctx->outbuf == NULL){
 /*
     PyErr_NoMemory();
 */
     return NULL;
   }
-  pynkf_outbuf[0] = '\0';
-  pynkf_ocount = pynkf_obufsize;
-  pynkf_optr = pynkf_outbuf;
-  pynkf_icount = 0;
-  pynkf_inbuf  = str;
-  pynkf_iptr = pynkf_inbuf;
-  pynkf_guess_flag = 0;
+  ctx->outbuf[0] = '\0';
+  ctx->ocount = ctx->obufsize;
+  ctx->optr = ctx->outbuf;
+  ctx->icount = 0;
+  ctx->inbuf  = str;
+  ctx->iptr = ctx->inbuf;
+  ctx->guess_flag = 0;
+  pynkf_ctx = ctx;
 
-  if (setjmp(env) == 0){
+  if (setjmp(ctx->env) == 0){
 
     reinit();
 
@@ -145,17 +221,210 @@ nkf_convert(unsigned char* str, int strlen, char* opts, int optslen)
     PyMem_Free(pynkf_outbuf);
     PyErr_NoMemory();
 */
-    free(pynkf_outbuf);
+    free(ctx->outbuf);
+    ctx->outbuf = NULL;
+    pynkf_ctx = NULL;
     return NULL;
   }
 
-  *pynkf_optr = 0;
+  *ctx->optr = 0;
+  pynkf_ctx = NULL;
 /*
   res = PyBytes_FromString(pynkf_outbuf);
   PyMem_Free(pynkf_outbuf);
   return res;
 */
-  return pynkf_outbuf;
+  return ctx->outbuf;
+}
+
+extern unsigned char*
+nkf_convert(unsigned char* str, int strlen, char* opts, int optslen)
+{
+  return nkf_ctx_convert(&pynkf_default_ctx, str, strlen, opts, optslen);
+}
+
+/*
+ * 変換ハンドル
+ * nkf_open() で reinit() + options() を1回だけ行い、その結果 (reinit() が初期化する変数) を
+ * 写しとして保持する。変換毎にはオプション文字列を解析せず写しを書き戻すだけとし、
+ * 出力バッファも変換毎に確保せず拡張しながら使い回す
+ */
+#if defined(UTF8_INPUT_ENABLE) || defined(UTF8_OUTPUT_ENABLE)
+#define NKF_VARS_UTF8		X(ms_ucs_map_f)
+#else
+#define NKF_VARS_UTF8
+#endif
+#ifdef UTF8_INPUT_ENABLE
+#define NKF_VARS_UTF8_INPUT	X(no_cp932ext_f) X(no_best_fit_chars_f) X(encode_fallback) X(unicode_subchar) X(input_endian)
+#else
+#define NKF_VARS_UTF8_INPUT
+#endif
+#ifdef UTF8_OUTPUT_ENABLE
+#define NKF_VARS_UTF8_OUTPUT	X(output_bom_f) X(output_endian)
+#else
+#define NKF_VARS_UTF8_OUTPUT
+#endif
+#ifdef UNICODE_NORMALIZATION
+#define NKF_VARS_NFC		X(nfc_f)
+#else
+#define NKF_VARS_NFC
+#endif
+#ifdef INPUT_OPTION
+#define NKF_VARS_INPUT		X(cap_f) X(url_f) X(numchar_f)
+#else
+#define NKF_VARS_INPUT
+#endif
+#ifdef CHECK_OPTION
+#define NKF_VARS_CHECK		X(noout_f) X(debug_f) X(iconv_for_check)
+#else
+#define NKF_VARS_CHECK
+#endif
+#ifdef EXEC_IO
+#define NKF_VARS_EXEC		X(exec_f)
+#else
+#define NKF_VARS_EXEC
+#endif
+#ifdef SHIFTJIS_CP932
+#define NKF_VARS_CP932		X(cp51932_f) X(cp932inv_f)
+#else
+#define NKF_VARS_CP932
+#endif
+#ifdef X0212_ENABLE
+#define NKF_VARS_X0212		X(x0212_f) X(x0213_f)
+#else
+#define NKF_VARS_X0212
+#endif
+#ifdef OVERWRITE
+#define NKF_VARS_OVERWRITE	X(overwrite_f) X(preserve_time_f) X(backup_f) X(backup_suffix)
+#else
+#define NKF_VARS_OVERWRITE
+#endif
+
+/* reinit() が初期化し options() が設定する変数 */
+#define NKF_VARS \
+  X(unbuf_f) X(estab_f) X(nop_f) X(binmode_f) X(rot_f) X(hira_f) X(alpha_f) \
+  X(mime_f) X(mime_decode_f) X(mimebuf_f) X(broken_f) X(iso8859_f) X(mimeout_f) \
+  X(x0201_f) X(iso2022jp_f) \
+  NKF_VARS_UTF8 NKF_VARS_UTF8_INPUT NKF_VARS_UTF8_OUTPUT NKF_VARS_NFC NKF_VARS_INPUT \
+  NKF_VARS_CHECK X(guess_f) NKF_VARS_EXEC NKF_VARS_CP932 NKF_VARS_X0212 NKF_VARS_OVERWRITE \
+  X(hold_count) X(mimeout_mode) X(base64_count) X(f_line) X(f_prev) \
+  X(fold_preserve_f) X(fold_f) X(fold_len) X(kanji_intro) X(ascii_intro) X(fold_margin) \
+  X(o_zconv) X(o_fconv) X(o_eol_conv) X(o_rot_conv) X(o_hira_conv) X(o_base64conv) \
+  X(o_iso2022jp_check_conv) X(o_putc) X(i_getc) X(i_ungetc) X(i_bgetc) X(i_bungetc) \
+  X(o_mputc) X(i_mgetc) X(i_mungetc) X(i_mgetc_buf) X(i_mungetc_buf) \
+  X(output_mode) X(input_mode) X(mime_decode_mode) X(file_out_f) X(eolmode_f) \
+  X(input_eol) X(prev_cr) X(option_mode) X(z_prev2) X(z_prev1) \
+  X(input_codename) X(input_encoding) X(output_encoding)
+
+struct nkf_handle {
+  NKF_CTX ctx;
+  struct {
+#define X(v) __typeof__(v) v;
+    NKF_VARS
+#undef X
+    int mimeout_count;
+    unsigned char prefix_table[256];
+  } opts;
+};
+
+/* 解析済みオプションを保存する */
+static void
+pynkf_opts_save(NKF_HANDLE *h)
+{
+#define X(v) h->opts.v = v;
+  NKF_VARS
+#undef X
+  h->opts.mimeout_count = mimeout_state.count;
+  memcpy(h->opts.prefix_table, prefix_table, sizeof(prefix_table));
+}
+
+/* reinit() + options() の代わりに保存したオプションを書き戻す */
+static void
+pynkf_opts_load(NKF_HANDLE *h)
+{
+  struct input_code *p = input_code_list;
+  while (p->name){
+    status_reinit(p++);
+  }
+#define X(v) v = h->opts.v;
+  NKF_VARS
+#undef X
+  mimeout_state.count = h->opts.mimeout_count;
+  memcpy(prefix_table, h->opts.prefix_table, sizeof(prefix_table));
+  nkf_state_init();
+}
+
+/*
+ * 変換ハンドルを作成する
+ * 戻値 : 使用後 nkf_close() で解放すること
+ */
+extern NKF_HANDLE*
+nkf_open(char* opts, int optslen)
+{
+  NKF_HANDLE *h;
+
+  if ((h = (NKF_HANDLE *)calloc(1, sizeof(NKF_HANDLE))) == NULL){
+    return NULL;
+  }
+  reinit();
+  options((unsigned char *)opts);
+  pynkf_opts_save(h);
+
+  h->ctx.obufsize = 1024;
+  if ((h->ctx.outbuf = (unsigned char *)malloc(h->ctx.obufsize + 1)) == NULL){
+    free(h);
+    return NULL;
+  }
+  return h;
+}
+
+/*
+ * ハンドルで変換する
+ * 戻値 : 変換結果 ハンドル内のバッファなので free しないこと
+ *        次の nkf_handle_convert()/nkf_close() 呼出しまで有効
+ *        outlen が NULL でなければ変換結果のbyte数を返す
+ */
+extern unsigned char*
+nkf_handle_convert(NKF_HANDLE* h, unsigned char* str, int strlen, int* outlen)
+{
+  NKF_CTX *ctx = &h->ctx;
+
+  ctx->ibufsize = strlen + 1;
+  ctx->ocount = ctx->obufsize;
+  ctx->optr = ctx->outbuf;
+  ctx->icount = 0;
+  ctx->inbuf  = str;
+  ctx->iptr = ctx->inbuf;
+  ctx->guess_flag = 0;
+  pynkf_ctx = ctx;
+
+  if (setjmp(ctx->env) == 0){
+    pynkf_opts_load(h);
+    kanji_convert(NULL);
+  }else{
+    pynkf_ctx = NULL;
+    return NULL;
+  }
+
+  /* 入力終端の '\0' も変換されるので長さには含めない */
+  if (ctx->optr > ctx->outbuf && ctx->optr[-1] == 0){
+    ctx->optr--;
+  }
+  *ctx->optr = 0;
+  pynkf_ctx = NULL;
+  if (outlen != NULL){
+    *outlen = ctx->optr - ctx->outbuf;
+  }
+  return ctx->outbuf;
+}
+
+extern void
+nkf_close(NKF_HANDLE* h)
+{
+  if (h != NULL){
+    free(h->ctx.outbuf);
+    free(h);
+  }
 }
 
 /*
@@ -168,20 +437,23 @@ nkf_guess(unsigned char* str, int strlen)
 /*
   PyObject * res;
 */
+  NKF_CTX *ctx = &pynkf_default_ctx;
   const char *codename;
 
-  pynkf_ibufsize = strlen + 1;
-  pynkf_icount = 0;
-  pynkf_inbuf  = str;
-  pynkf_iptr = pynkf_inbuf;
+  ctx->ibufsize = strlen + 1;
+  ctx->icount = 0;
+  ctx->inbuf  = str;
+  ctx->iptr = ctx->inbuf;
 
-  pynkf_guess_flag = 1;
+  ctx->guess_flag = 1;
+  pynkf_ctx = ctx;
   reinit();
   guess_f = 1;
 
   kanji_convert(NULL);
 
   codename = get_guessed_code();
+  pynkf_ctx = NULL;
 
 /*
   res = PyUnicode_FromString(codename);
@@ -0,0 +1,330 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* mkaribtbl                                                                  */
+/* aribTOutf8.c が使用する ARIB符号集合 → UTF-8 変換テーブル aribtbl.h を     */
+/* 標準出力に生成する (ビルド時に実行する)                                    */
+/*                                                                            */
+/*   漢字・平仮名・カタカナ : 従来の aribTOsjis + nkf_convert("-S -w") の     */
+/*                            変換結果をそのまま記録し出力を一致させる        */
+/*   JIS互換漢字1面/2面     : nkf の JIS X 0213 テーブルから作成する          */
+/*   JIS X0201 片仮名       : 半角カタカナ U+FF61-                            */
+/*   追加記号               : 第1引数の変換表 (aribgaiji.map) から作成する    */
+/*                            漢字集合の90-94区にも同じ記号を割り当てる       */
+/*   DRCS                   : 第2引数の変換表 (aribdrcs.map) から作成する     */
+/*                                                                            */
+/* 使用方法： mkaribtbl aribgaiji.map aribdrcs.map > aribtbl.h                */
+/*                                                                            */
+/* 出力形式                                                                   */
+/*   aribUtf8Pool[]  : UTF-8 バイト列を連結したもの                           */
+/*   各テーブル要素  : プール内オフセット<<3 | バイト数  0:変換不可           */
+/******************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnkf.h"
+#include "config.h"
+#include "utf8tbl.h"
+
+#define POOL_MAX	(1024*1024)
+#define ENTRY_MAX	7				// 1要素の最大バイト数 (オフセットと3bitで表す)
+
+static uint8_t	pool[POOL_MAX];
+static uint32_t	poolSize = 0;
+
+// UTF-8 バイト列をプールに追加して要素値を返す
+static uint32_t poolAdd(const uint8_t *utf8, size_t len)
+{
+	if(len==0){
+		return(0);
+	}
+	if(len>ENTRY_MAX || poolSize+len>POOL_MAX){
+		fprintf(stderr, "mkaribtbl: entry too long %zu\n", len);
+		exit(1);
+	}
+	memcpy(pool+poolSize, utf8, len);
+	poolSize += len;
+	return((poolSize-len)<<3 | len);
+}
+
+static size_t ucsToUtf8(uint32_t c, uint8_t *out)
+{
+	if(c<0x80){
+		out[0] = c;
+		return(1);
+	}else if(c<0x800){
+		out[0] = 0xc0 | c>>6;
+		out[1] = 0x80 | (c & 0x3f);
+		return(2);
+	}else if(c<0x10000){
+		out[0] = 0xe0 | c>>12;
+		out[1] = 0x80 | (c>>6 & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		return(3);
+	}
+	out[0] = 0xf0 | c>>18;
+	out[1] = 0x80 | (c>>12 & 0x3f);
+	out[2] = 0x80 | (c>>6 & 0x3f);
+	out[3] = 0x80 | (c & 0x3f);
+	return(4);
+}
+
+// 従来の変換経路 aribTOsjis + nkf_convert の結果を要素にする
+static uint32_t legacyEntry(const uint8_t *arib, size_t len)
+{
+	const char *option = "-S -w";
+	uint8_t *sjis, *utf8;
+	uint32_t rtn = 0;
+
+	if((sjis = aribTOsjis((uint8_t *)arib, len))==NULL){
+		return(0);
+	}
+	if(sjis[0]!='\0' && (utf8 = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
+		rtn = poolAdd(utf8, strlen((char *)utf8));
+		free(utf8);
+	}
+	free(sjis);
+	return(rtn);
+}
+
+// JIS X 0213 面区点から要素を作る
+static uint32_t x0213Entry(int plane, int row, int cell)
+{
+	const unsigned short *p = (plane==1) ? euc_to_utf8_2bytes_x0213[row-1] : x0212_to_utf8_2bytes_x0213[row-1];
+	unsigned short euc = (row+0x20)<<8 | (cell+0x20);
+	uint32_t c;
+	uint8_t utf8[ENTRY_MAX+1];
+	size_t len;
+
+	// 結合文字 (基底文字+結合文字の2文字)
+	if(plane==1){
+		for(int i=0; i<sizeof_x0213_combining_table; i++){
+			if(x0213_combining_table[i][0]==euc){
+				len = ucsToUtf8(x0213_combining_table[i][1], utf8);
+				len += ucsToUtf8(x0213_combining_table[i][2], utf8+len);
+				return(poolAdd(utf8, len));
+			}
+		}
+	}
+	if(p==NULL || (c = p[cell-1])==0){
+		return(0);
+	}
+	// サロゲートペアは別表から下位を求める
+	if(c>=0xd800 && c<=0xdbff){
+		const unsigned short (*tbl)[3] = (plane==1) ? x0213_1_surrogate_table : x0213_2_surrogate_table;
+		int size = (plane==1) ? sizeof_x0213_1_surrogate_table : sizeof_x0213_2_surrogate_table;
+		int i;
+		for(i=0; i<size && tbl[i][0]!=euc; i++){
+			;
+		}
+		if(i==size){
+			return(0);
+		}
+		c = 0x10000 + ((c-0xd800)<<10) + (tbl[i][2]-0xdc00);
+	}
+	len = ucsToUtf8(c, utf8);
+	return(poolAdd(utf8, len));
+}
+
+// 変換不可の追加記号 従来通り全角？とする
+static uint32_t unknownEntry(void)
+{
+	static uint32_t entry = 0;
+
+	if(entry==0){
+		entry = poolAdd((const uint8_t *)"\xef\xbc\x9f", 3);
+	}
+	return(entry);
+}
+
+/******************************************************************************/
+/* 変換表を読む                                                               */
+/*   1行1符号  [終端符号] 符号 U+XXXX [U+XXXX ...]  # 以降は備考              */
+/*   withFinal : 先頭に終端符号の欄がある (DRCS)                              */
+/*   setEntry  : 読んだ符号毎に呼ぶ 戻値 false:範囲外の符号                   */
+/******************************************************************************/
+static void readMap(const char *file, bool withFinal, bool (*setEntry)(unsigned final, unsigned code, uint32_t entry))
+{
+	char line[256];
+	int lineNo = 0;
+	FILE *fp;
+
+	if((fp=fopen(file, "r"))==NULL){
+		fprintf(stderr, "mkaribtbl: file open error : %s\n", file);
+		exit(1);
+	}
+	while(fgets(line, sizeof(line), fp)!=NULL){
+		unsigned final = 0, code;
+		uint8_t utf8[ENTRY_MAX+4];
+		size_t len = 0;
+		char *p, *next;
+
+		lineNo++;
+		if((p=strchr(line, '#'))!=NULL){
+			*p = '\0';
+		}
+		if((p=strtok(line, " \t\r\n"))==NULL){
+			continue;
+		}
+		if(withFinal){
+			final = strtoul(p, &next, 16);
+			if(*next!='\0' || (p=strtok(NULL, " \t\r\n"))==NULL){
+				goto error;
+			}
+		}
+		code = strtoul(p, &next, 16);
+		if(*next!='\0'){
+			goto error;
+		}
+		while((p=strtok(NULL, " \t\r\n"))!=NULL){
+			if((p[0]!='U' && p[0]!='u') || p[1]!='+'){
+				goto error;
+			}
+			uint32_t c = strtoul(p+2, &next, 16);
+			if(*next!='\0' || c==0 || c>0x10ffff){
+				goto error;
+			}
+			len += ucsToUtf8(c, utf8+len);
+			if(len>ENTRY_MAX){
+				fprintf(stderr, "mkaribtbl: %s:%d entry too long\n", file, lineNo);
+				exit(1);
+			}
+		}
+		if(len==0 || !setEntry(final, code, poolAdd(utf8, len))){
+			goto error;
+		}
+	}
+	fclose(fp);
+	return;
+
+error:
+	fprintf(stderr, "mkaribtbl: %s:%d format error\n", file, lineNo);
+	exit(1);
+}
+
+static uint32_t kanji[3][94*94];
+static uint32_t addCode[94*94];
+static uint32_t drcs0[94*94];
+static uint32_t drcs[15][96];
+
+// 区点符号 (GL 2byte) を表の添字にする -1:範囲外
+static int kuten(unsigned code)
+{
+	unsigned c1 = code>>8, c2 = code & 0xff;
+
+	if(code>0xffff || c1<0x21 || c1>0x7e || c2<0x21 || c2>0x7e){
+		return(-1);
+	}
+	return((c1-0x21)*94 + (c2-0x21));
+}
+
+// 追加記号 85-94区 漢字集合では 90-94区のみ
+static bool setGaiji(unsigned final, unsigned code, uint32_t entry)
+{
+	int i = kuten(code);
+
+	if(i<0 || (code>>8)<0x75){
+		return(false);
+	}
+	addCode[i] = entry;
+	if((code>>8)>=0x7a){
+		kanji[0][i] = entry;
+	}
+	return(true);
+}
+
+static bool setDrcs(unsigned final, unsigned code, uint32_t entry)
+{
+	if(final==0x40){
+		int i = kuten(code);
+		if(i<0){
+			return(false);
+		}
+		drcs0[i] = entry;
+		return(true);
+	}
+	if(final<0x41 || final>0x4f || code<0x21 || code>0x7e){
+		return(false);
+	}
+	drcs[final-0x41][code-0x20] = entry;
+	return(true);
+}
+
+static void printTable(const char *comment, const char *name, uint32_t *tbl, int num)
+{
+	fprintf(stdout, "\n// %s\n", comment);
+	fprintf(stdout, "static const uint32_t %s[%d] = {", name, num);
+	for(int i=0; i<num; i++){
+		fprintf(stdout, "%s0x%05x,", (i%12==0) ? "\n\t" : " ", tbl[i]);
+	}
+	fprintf(stdout, "\n};\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static uint32_t kana[3][96];
+	uint8_t arib[4];
+
+	if(argc<3){
+		fprintf(stderr, "Usage: %s aribgaiji.map aribdrcs.map\n", argv[0]);
+		return(1);
+	}
+
+	// 漢字 (デフォルト G0=漢字 GL=G0)
+	for(int row=1; row<=94; row++){
+		for(int cell=1; cell<=94; cell++){
+			arib[0] = row+0x20;
+			arib[1] = cell+0x20;
+			kanji[0][(row-1)*94+cell-1] = legacyEntry(arib, 2);
+			kanji[1][(row-1)*94+cell-1] = x0213Entry(1, row, cell);
+			kanji[2][(row-1)*94+cell-1] = x0213Entry(2, row, cell);
+		}
+	}
+
+	// 平仮名 (デフォルト GR=G2=平仮名) カタカナ (LS3R で GR=G3=カタカナ)
+	for(int c=0x21; c<=0x7e; c++){
+		arib[0] = c|0x80;
+		kana[0][c-0x20] = legacyEntry(arib, 1);
+		arib[0] = 0x1b;
+		arib[1] = 0x7c;
+		arib[2] = c|0x80;
+		kana[1][c-0x20] = legacyEntry(arib, 3);
+	}
+	// JIS X0201 片仮名 0x21-0x5F
+	for(int c=0x21; c<=0x5f; c++){
+		uint8_t utf8[4];
+		kana[2][c-0x20] = poolAdd(utf8, ucsToUtf8(0xff61+c-0x21, utf8));
+	}
+
+	// 追加記号 変換表にない符号は全角？ 漢字集合 90-94区も同じ
+	for(int i=0; i<94*94; i++){
+		addCode[i] = unknownEntry();
+		if(i>=(0x7a-0x21)*94){
+			kanji[0][i] = addCode[i];
+		}
+	}
+	readMap(argv[1], false, setGaiji);
+	readMap(argv[2], true, setDrcs);
+
+	fprintf(stdout, "// aribtbl.h : mkaribtbl が生成したファイル 編集しないこと\n");
+	fprintf(stdout, "// 要素値 : aribUtf8Pool 内オフセット<<3 | バイト数 (0:変換不可)\n");
+	printTable("漢字 (JIS X 0208) 区点 (区-1)*94+(点-1)", "aribKanjiUtf8", kanji[0], 94*94);
+	printTable("JIS互換漢字1面 (JIS X 0213 1面)", "aribCompat1Utf8", kanji[1], 94*94);
+	printTable("JIS互換漢字2面 (JIS X 0213 2面)", "aribCompat2Utf8", kanji[2], 94*94);
+	printTable("平仮名 符号-0x20", "aribHiraganaUtf8", kana[0], 96);
+	printTable("カタカナ 符号-0x20", "aribKatakanaUtf8", kana[1], 96);
+	printTable("JIS X0201 片仮名 符号-0x20", "aribX0201Utf8", kana[2], 96);
+	printTable("追加記号 区点 (区-1)*94+(点-1)", "aribAddCodeUtf8", addCode, 94*94);
+	printTable("2バイト DRCS-0 区点 (区-1)*94+(点-1)", "aribDrcs0Utf8", drcs0, 94*94);
+	printTable("1バイト DRCS-1〜15 (終端符号-0x41)*96 + 符号-0x20", "aribDrcsUtf8", drcs[0], 15*96);
+
+	fprintf(stdout, "\nstatic const uint8_t aribUtf8Pool[%u] = {", poolSize);
+	for(uint32_t i=0; i<poolSize; i++){
+		fprintf(stdout, "%s0x%02x,", (i%16==0) ? "\n\t" : " ", pool[i]);
+	}
+	fprintf(stdout, "\n};\n");
+
+	return(0);
+}
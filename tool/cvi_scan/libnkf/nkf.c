@@ -29,6 +29,17 @@
 #include "config.h"
 #include "nkf.h"
 #include "utf8tbl.h"
+
+/* 変換状態を保持する変数の記憶域クラス
+ * libnkf.c はスレッド毎に独立して変換できるよう __thread を指定する */
+#ifndef NKF_TLS
+#define NKF_TLS
+#endif
+/* nkf_state を確保した時に呼ばれる
+ * libnkf.c はスレッド終了時に解放するよう登録する */
+#ifndef NKF_STATE_NEW
+#define NKF_STATE_NEW(state)
+#endif
 #ifdef __WIN32__
 #include <windows.h>
 #include <locale.h>
@@ -333,9 +344,9 @@ struct input_code{
     int _file_stat;
 };
 
-static const char *input_codename = NULL; /* NULL: unestablished, "": BINARY */
-static nkf_encoding *input_encoding = NULL;
-static nkf_encoding *output_encoding = NULL;
+static NKF_TLS const char *input_codename = NULL; /* NULL: unestablished, "": BINARY */
+static NKF_TLS nkf_encoding *input_encoding = NULL;
+static NKF_TLS nkf_encoding *output_encoding = NULL;
 
 #if defined(UTF8_INPUT_ENABLE) || defined(UTF8_OUTPUT_ENABLE)
 /* UCS Mapping
@@ -348,22 +359,22 @@ static nkf_encoding *output_encoding = NULL;
 #define UCS_MAP_MS      1
 #define UCS_MAP_CP932   2
 #define UCS_MAP_CP10001 3
-static int ms_ucs_map_f = UCS_MAP_ASCII;
+static NKF_TLS int ms_ucs_map_f = UCS_MAP_ASCII;
 #endif
 #ifdef UTF8_INPUT_ENABLE
 /* no NEC special, NEC-selected IBM extended and IBM extended characters */
-static  int     no_cp932ext_f = FALSE;
+static NKF_TLS  int     no_cp932ext_f = FALSE;
 /* ignore ZERO WIDTH NO-BREAK SPACE */
-static  int     no_best_fit_chars_f = FALSE;
-static  int     input_endian = ENDIAN_BIG;
-static  int     input_bom_f = FALSE;
-static  nkf_char     unicode_subchar = '?'; /* the regular substitution character */
-static  void    (*encode_fallback)(nkf_char c) = NULL;
+static NKF_TLS  int     no_best_fit_chars_f = FALSE;
+static NKF_TLS  int     input_endian = ENDIAN_BIG;
+static NKF_TLS  int     input_bom_f = FALSE;
+static NKF_TLS  nkf_char     unicode_subchar = '?'; /* the regular substitution character */
+static NKF_TLS  void    (*encode_fallback)(nkf_char c) = NULL;
 static  void    w_status(struct input_code *, nkf_char);
 #endif
 #ifdef UTF8_OUTPUT_ENABLE
-static  int     output_bom_f = FALSE;
-static  int     output_endian = ENDIAN_BIG;
+static NKF_TLS  int     output_bom_f = FALSE;
+static NKF_TLS  int     output_endian = ENDIAN_BIG;
 #endif
 
 static  void    std_putc(nkf_char c);
@@ -387,36 +398,36 @@ static unsigned char   stdobuf[IOBUF_SIZE];
 #define NKF_UNSPECIFIED (-TRUE)
 
 /* flags */
-static int             unbuf_f = FALSE;
-static int             estab_f = FALSE;
-static int             nop_f = FALSE;
-static int             binmode_f = TRUE;       /* binary mode */
-static int             rot_f = FALSE;          /* rot14/43 mode */
-static int             hira_f = FALSE;          /* hira/kata henkan */
-static int             alpha_f = FALSE;        /* convert JIx0208 alphbet to ASCII */
-static int             mime_f = MIME_DECODE_DEFAULT;   /* convert MIME B base64 or Q */
-static int             mime_decode_f = FALSE;  /* mime decode is explicitly on */
-static int             mimebuf_f = FALSE;      /* MIME buffered input */
-static int             broken_f = FALSE;       /* convert ESC-less broken JIS */
-static int             iso8859_f = FALSE;      /* ISO8859 through */
-static int             mimeout_f = FALSE;       /* base64 mode */
-static int             x0201_f = NKF_UNSPECIFIED;   /* convert JIS X 0201 */
-static int             iso2022jp_f = FALSE;    /* replace non ISO-2022-JP with GETA */
+static NKF_TLS int             unbuf_f = FALSE;
+static NKF_TLS int             estab_f = FALSE;
+static NKF_TLS int             nop_f = FALSE;
+static NKF_TLS int             binmode_f = TRUE;       /* binary mode */
+static NKF_TLS int             rot_f = FALSE;          /* rot14/43 mode */
+static NKF_TLS int             hira_f = FALSE;          /* hira/kata henkan */
+static NKF_TLS int             alpha_f = FALSE;        /* convert JIx0208 alphbet to ASCII */
+static NKF_TLS int             mime_f = MIME_DECODE_DEFAULT;   /* convert MIME B base64 or Q */
+static NKF_TLS int             mime_decode_f = FALSE;  /* mime decode is explicitly on */
+static NKF_TLS int             mimebuf_f = FALSE;      /* MIME buffered input */
+static NKF_TLS int             broken_f = FALSE;       /* convert ESC-less broken JIS */
+static NKF_TLS int             iso8859_f = FALSE;      /* ISO8859 through */
+static NKF_TLS int             mimeout_f = FALSE;       /* base64 mode */
+static NKF_TLS int             x0201_f = NKF_UNSPECIFIED;   /* convert JIS X 0201 */
+static NKF_TLS int             iso2022jp_f = FALSE;    /* replace non ISO-2022-JP with GETA */
 
 #ifdef UNICODE_NORMALIZATION
-static int nfc_f = FALSE;
-static nkf_char (*i_nfc_getc)(FILE *) = std_getc; /* input of ugetc */
-static nkf_char (*i_nfc_ungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS int nfc_f = FALSE;
+static NKF_TLS nkf_char (*i_nfc_getc)(FILE *) = std_getc; /* input of ugetc */
+static NKF_TLS nkf_char (*i_nfc_ungetc)(nkf_char c ,FILE *f) = std_ungetc;
 #endif
 
 #ifdef INPUT_OPTION
-static int cap_f = FALSE;
-static nkf_char (*i_cgetc)(FILE *) = std_getc; /* input of cgetc */
-static nkf_char (*i_cungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS int cap_f = FALSE;
+static NKF_TLS nkf_char (*i_cgetc)(FILE *) = std_getc; /* input of cgetc */
+static NKF_TLS nkf_char (*i_cungetc)(nkf_char c ,FILE *f) = std_ungetc;
 
-static int url_f = FALSE;
-static nkf_char (*i_ugetc)(FILE *) = std_getc; /* input of ugetc */
-static nkf_char (*i_uungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS int url_f = FALSE;
+static NKF_TLS nkf_char (*i_ugetc)(FILE *) = std_getc; /* input of ugetc */
+static NKF_TLS nkf_char (*i_uungetc)(nkf_char c ,FILE *f) = std_ungetc;
 #endif
 
 #define PREFIX_EUCG3    NKF_INT32_C(0x8F00)
@@ -434,45 +445,45 @@ static nkf_char (*i_uungetc)(nkf_char c ,FILE *f) = std_ungetc;
 #define UTF16_TO_UTF32(lead, trail) (((lead) << 10) + (trail) - NKF_INT32_C(0x35FDC00))
 
 #ifdef NUMCHAR_OPTION
-static int numchar_f = FALSE;
-static nkf_char (*i_ngetc)(FILE *) = std_getc; /* input of ugetc */
-static nkf_char (*i_nungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS int numchar_f = FALSE;
+static NKF_TLS nkf_char (*i_ngetc)(FILE *) = std_getc; /* input of ugetc */
+static NKF_TLS nkf_char (*i_nungetc)(nkf_char c ,FILE *f) = std_ungetc;
 #endif
 
 #ifdef CHECK_OPTION
-static int noout_f = FALSE;
+static NKF_TLS int noout_f = FALSE;
 static void no_putc(nkf_char c);
-static int debug_f = FALSE;
+static NKF_TLS int debug_f = FALSE;
 static void debug(const char *str);
-static nkf_char (*iconv_for_check)(nkf_char c2,nkf_char c1,nkf_char c0) = 0;
+static NKF_TLS nkf_char (*iconv_for_check)(nkf_char c2,nkf_char c1,nkf_char c0) = 0;
 #endif
 
-static int guess_f = 0; /* 0: OFF, 1: ON, 2: VERBOSE */
+static NKF_TLS int guess_f = 0; /* 0: OFF, 1: ON, 2: VERBOSE */
 static  void    set_input_codename(const char *codename);
 
 #ifdef EXEC_IO
-static int exec_f = 0;
+static NKF_TLS int exec_f = 0;
 #endif
 
 #ifdef SHIFTJIS_CP932
 /* invert IBM extended characters to others */
-static int cp51932_f = FALSE;
+static NKF_TLS int cp51932_f = FALSE;
 
 /* invert NEC-selected IBM extended characters to IBM extended characters */
-static int cp932inv_f = TRUE;
+static NKF_TLS int cp932inv_f = TRUE;
 
 /* static nkf_char cp932_conv(nkf_char c2, nkf_char c1); */
 #endif /* SHIFTJIS_CP932 */
 
-static int x0212_f = FALSE;
-static int x0213_f = FALSE;
+static NKF_TLS int x0212_f = FALSE;
+static NKF_TLS int x0213_f = FALSE;
 
-static unsigned char prefix_table[256];
+static NKF_TLS unsigned char prefix_table[256];
 
 static void e_status(struct input_code *, nkf_char);
 static void s_status(struct input_code *, nkf_char);
 
-struct input_code input_code_list[] = {
+NKF_TLS struct input_code input_code_list[] = {
     {"EUC-JP",    0, 0, 0, {0, 0, 0}, e_status, e_iconv, 0},
     {"Shift_JIS", 0, 0, 0, {0, 0, 0}, s_status, s_iconv, 0},
 #ifdef UTF8_INPUT_ENABLE
@@ -483,28 +494,28 @@ struct input_code input_code_list[] = {
     {NULL,        0, 0, 0, {0, 0, 0}, NULL, NULL, 0}
 };
 
-static int              mimeout_mode = 0; /* 0, -1, 'Q', 'B', 1, 2 */
-static int              base64_count = 0;
+static NKF_TLS int              mimeout_mode = 0; /* 0, -1, 'Q', 'B', 1, 2 */
+static NKF_TLS int              base64_count = 0;
 
 /* X0208 -> ASCII converter */
 
 /* fold parameter */
-static int             f_line = 0;    /* chars in line */
-static int             f_prev = 0;
-static int             fold_preserve_f = FALSE; /* preserve new lines */
-static int             fold_f  = FALSE;
-static int             fold_len  = 0;
+static NKF_TLS int             f_line = 0;    /* chars in line */
+static NKF_TLS int             f_prev = 0;
+static NKF_TLS int             fold_preserve_f = FALSE; /* preserve new lines */
+static NKF_TLS int             fold_f  = FALSE;
+static NKF_TLS int             fold_len  = 0;
 
 /* options */
-static unsigned char   kanji_intro = DEFAULT_J;
-static unsigned char   ascii_intro = DEFAULT_R;
+static NKF_TLS unsigned char   kanji_intro = DEFAULT_J;
+static NKF_TLS unsigned char   ascii_intro = DEFAULT_R;
 
 /* Folding */
 
 #define FOLD_MARGIN  10
 #define DEFAULT_FOLD 60
 
-static int             fold_margin  = FOLD_MARGIN;
+static NKF_TLS int             fold_margin  = FOLD_MARGIN;
 
 /* process default */
 
@@ -522,40 +533,40 @@ no_connection(nkf_char c2, nkf_char c1)
     no_connection2(c2,c1,0);
 }
 
-static nkf_char (*iconv)(nkf_char c2,nkf_char c1,nkf_char c0) = no_connection2;
-static void (*oconv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS nkf_char (*iconv)(nkf_char c2,nkf_char c1,nkf_char c0) = no_connection2;
+static NKF_TLS void (*oconv)(nkf_char c2,nkf_char c1) = no_connection;
 
-static void (*o_zconv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_fconv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_eol_conv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_rot_conv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_hira_conv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_base64conv)(nkf_char c2,nkf_char c1) = no_connection;
-static void (*o_iso2022jp_check_conv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_zconv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_fconv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_eol_conv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_rot_conv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_hira_conv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_base64conv)(nkf_char c2,nkf_char c1) = no_connection;
+static NKF_TLS void (*o_iso2022jp_check_conv)(nkf_char c2,nkf_char c1) = no_connection;
 
 /* static redirections */
 
-static  void   (*o_putc)(nkf_char c) = std_putc;
+static NKF_TLS  void   (*o_putc)(nkf_char c) = std_putc;
 
-static  nkf_char    (*i_getc)(FILE *f) = std_getc; /* general input */
-static  nkf_char    (*i_ungetc)(nkf_char c,FILE *f) =std_ungetc;
+static NKF_TLS  nkf_char    (*i_getc)(FILE *f) = std_getc; /* general input */
+static NKF_TLS  nkf_char    (*i_ungetc)(nkf_char c,FILE *f) =std_ungetc;
 
-static  nkf_char    (*i_bgetc)(FILE *) = std_getc; /* input of mgetc */
-static  nkf_char    (*i_bungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS  nkf_char    (*i_bgetc)(FILE *) = std_getc; /* input of mgetc */
+static NKF_TLS  nkf_char    (*i_bungetc)(nkf_char c ,FILE *f) = std_ungetc;
 
-static  void   (*o_mputc)(nkf_char c) = std_putc ; /* output of mputc */
+static NKF_TLS  void   (*o_mputc)(nkf_char c) = std_putc ; /* output of mputc */
 
-static  nkf_char    (*i_mgetc)(FILE *) = std_getc; /* input of mgetc */
-static  nkf_char    (*i_mungetc)(nkf_char c ,FILE *f) = std_ungetc;
+static NKF_TLS  nkf_char    (*i_mgetc)(FILE *) = std_getc; /* input of mgetc */
+static NKF_TLS  nkf_char    (*i_mungetc)(nkf_char c ,FILE *f) = std_ungetc;
 
 /* for strict mime */
-static  nkf_char    (*i_mgetc_buf)(FILE *) = std_getc; /* input of mgetc_buf */
-static  nkf_char    (*i_mungetc_buf)(nkf_char c,FILE *f) = std_ungetc;
+static NKF_TLS  nkf_char    (*i_mgetc_buf)(FILE *) = std_getc; /* input of mgetc_buf */
+static NKF_TLS  nkf_char    (*i_mungetc_buf)(nkf_char c,FILE *f) = std_ungetc;
 
 /* Global states */
-static int output_mode = ASCII;    /* output kanji mode */
-static int input_mode =  ASCII;    /* input kanji mode */
-static int mime_decode_mode =   FALSE;    /* MIME mode B base64, Q hex */
+static NKF_TLS int output_mode = ASCII;    /* output kanji mode */
+static NKF_TLS int input_mode =  ASCII;    /* input kanji mode */
+static NKF_TLS int mime_decode_mode =   FALSE;    /* MIME mode B base64, Q hex */
 
 /* X0201 / X0208 conversion tables */
 
@@ -665,20 +676,20 @@ static const unsigned char fv[] = {
 
 
 
-static int option_mode = 0;
-static int             file_out_f = FALSE;
+static NKF_TLS int option_mode = 0;
+static NKF_TLS int             file_out_f = FALSE;
 #ifdef OVERWRITE
-static int             overwrite_f = FALSE;
-static int             preserve_time_f = FALSE;
-static int             backup_f = FALSE;
-static char            *backup_suffix = "";
+static NKF_TLS int             overwrite_f = FALSE;
+static NKF_TLS int             preserve_time_f = FALSE;
+static NKF_TLS int             backup_f = FALSE;
+static NKF_TLS char            *backup_suffix = "";
 #endif
 
-static int eolmode_f = 0;   /* CR, LF, CRLF */
-static int input_eol = 0; /* 0: unestablished, EOF: MIXED */
-static nkf_char prev_cr = 0; /* CR or 0 */
+static NKF_TLS int eolmode_f = 0;   /* CR, LF, CRLF */
+static NKF_TLS int input_eol = 0; /* 0: unestablished, EOF: MIXED */
+static NKF_TLS nkf_char prev_cr = 0; /* CR or 0 */
 #ifdef EASYWIN /*Easy Win */
-static int             end_check;
+static NKF_TLS int             end_check;
 #endif /*Easy Win */
 
 static void *
@@ -847,7 +858,7 @@ nkf_buf_new(int length)
     return buf;
 }
 
-#if 0
+#ifdef NKF_STATE_DISPOSE
 static void
 nkf_buf_dispose(nkf_buf_t *buf)
 {
@@ -3316,7 +3327,7 @@ typedef struct {
     nkf_buf_t *nfc_buf;
 } nkf_state_t;
 
-static nkf_state_t *nkf_state = NULL;
+static NKF_TLS nkf_state_t *nkf_state = NULL;
 
 #define STD_GC_BUFSIZE (256)
 
@@ -3333,6 +3344,7 @@ nkf_state_init(void)
 	nkf_state->std_gc_buf = nkf_buf_new(STD_GC_BUFSIZE);
 	nkf_state->broken_buf = nkf_buf_new(3);
 	nkf_state->nfc_buf = nkf_buf_new(9);
+	NKF_STATE_NEW(nkf_state);
     }
     nkf_state->broken_state = 0;
     nkf_state->mimeout_state = 0;
@@ -3365,8 +3377,8 @@ std_putc(nkf_char c)
 }
 #endif /*WIN32DLL*/
 
-static nkf_char   hold_buf[HOLD_SIZE*2];
-static int             hold_count = 0;
+static NKF_TLS nkf_char   hold_buf[HOLD_SIZE*2];
+static NKF_TLS int             hold_count = 0;
 static nkf_char
 push_hold_buf(nkf_char c2)
 {
@@ -3990,7 +4002,7 @@ fold_conv(nkf_char c2, nkf_char c1)
     }
 }
 
-static nkf_char z_prev2=0,z_prev1=0;
+static NKF_TLS nkf_char z_prev2=0,z_prev1=0;
 
 static void
 z_conv(nkf_char c2, nkf_char c1)
@@ -4318,13 +4330,13 @@ static const nkf_char mime_encode_method[] = {
 #define MIME_BUF_SIZE   (1024)    /* 2^n ring buffer */
 #define MIME_BUF_MASK   (MIME_BUF_SIZE-1)
 #define mime_input_buf(n)        mime_input_state.buf[(n)&MIME_BUF_MASK]
-static struct {
+static NKF_TLS struct {
     unsigned char buf[MIME_BUF_SIZE];
     unsigned int  top;
     unsigned int  last;  /* decoded */
     unsigned int  input; /* undecoded */
 } mime_input_state;
-static nkf_char (*mime_iconv_back)(nkf_char c2,nkf_char c1,nkf_char c0) = NULL;
+static NKF_TLS nkf_char (*mime_iconv_back)(nkf_char c2,nkf_char c1,nkf_char c0) = NULL;
 
 #define MAXRECOVER 20
 
@@ -5050,7 +5062,7 @@ static const char basis_64[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 #define MIMEOUT_BUF_LENGTH 74
-static struct {
+static NKF_TLS struct {
     unsigned char buf[MIMEOUT_BUF_LENGTH+1];
     int count;
 } mimeout_state;
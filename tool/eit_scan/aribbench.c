@@ -0,0 +1,486 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* aribbench                                                                  */
+/* ARIB文字列変換のベンチマーク                                               */
+/*                                                                            */
+/* 使用方法： ./aribbench [TSfile ...]                                        */
+/*   合成したコーパス (短い番組名・長い番組記述・符号集合切替/追加記号)       */
+/*   と TSファイル内 EIT の短形式/拡張形式イベント記述子から取り出した        */
+/*   文字列を各変換方法で変換し MB/s (ARIB byte)・ns/char (変換後の文字数)    */
+/*   ・1回あたりのメモリ確保回数を出力する                                    */
+/*                                                                            */
+/* メモリ確保回数は -Wl,--wrap で malloc/calloc/realloc を数える              */
+/******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "libnkf.h"
+
+#define TS_PACKETSIZE	188
+#define MAX_SECTION		4096
+#define BENCH_SEC		0.3		// 1計測あたりの最低計測時間(秒)
+
+/****************************************************************/
+/* メモリ確保回数                                               */
+/****************************************************************/
+static uint64_t allocCount = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocCount++;
+	return(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocCount++;
+	return(__real_calloc(nmemb, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocCount++;
+	return(__real_realloc(ptr, size));
+}
+
+/****************************************************************/
+/* コーパス                                                     */
+/****************************************************************/
+typedef struct {
+	const char	*name;
+	uint8_t		**str;
+	size_t		*len;
+	size_t		numOfStr;
+	size_t		maxStr;
+	size_t		bytes;		// ARIB byte数合計
+	size_t		chars;		// 変換後の文字数合計 (UTF-8 の先頭byte数)
+} CORPUS;
+
+static bool corpusAdd(CORPUS *corpus, const uint8_t *arib, size_t len)
+{
+	if(len==0){
+		return(true);
+	}
+	if(corpus->numOfStr==corpus->maxStr){
+		size_t maxStr = (corpus->maxStr==0) ? 256 : corpus->maxStr*2;
+		uint8_t **str = realloc(corpus->str, maxStr*sizeof(uint8_t *));
+		size_t *lens = realloc(corpus->len, maxStr*sizeof(size_t));
+		if(str==NULL || lens==NULL){
+			return(false);
+		}
+		corpus->str		= str;
+		corpus->len		= lens;
+		corpus->maxStr	= maxStr;
+	}
+	if((corpus->str[corpus->numOfStr] = malloc(len))==NULL){
+		return(false);
+	}
+	memcpy(corpus->str[corpus->numOfStr], arib, len);
+	corpus->len[corpus->numOfStr] = len;
+	corpus->numOfStr++;
+	corpus->bytes += len;
+
+	uint8_t utf8[ARIB_UTF8_BUFSIZE(len)];
+	size_t n = aribTOutf8(arib, len, utf8, sizeof(utf8));
+	for(size_t i=0; i<n; i++){
+		if((utf8[i] & 0xc0)!=0x80){
+			corpus->chars++;
+		}
+	}
+	return(true);
+}
+
+static void corpusFree(CORPUS *corpus)
+{
+	for(size_t i=0; i<corpus->numOfStr; i++){
+		free(corpus->str[i]);
+	}
+	free(corpus->str);
+	free(corpus->len);
+}
+
+// 漢字 (GL 2byte) 平仮名 (GR 1byte) 英数 (LS1 ... LS0) を並べる
+static size_t genKanji(uint8_t *p, int n)
+{
+	for(int i=0; i<n; i++){
+		p[i*2]		= 0x30+rand()%0x20;
+		p[i*2+1]	= 0x21+rand()%94;
+	}
+	return(n*2);
+}
+
+static size_t genHiragana(uint8_t *p, int n)
+{
+	for(int i=0; i<n; i++){
+		p[i] = 0xa1+rand()%83;
+	}
+	return(n);
+}
+
+static size_t genAscii(uint8_t *p, int n)
+{
+	size_t len = 0;
+
+	p[len++] = 0x0e;
+	for(int i=0; i<n; i++){
+		p[len++] = 0x30+rand()%0x4a;
+	}
+	p[len++] = 0x0f;
+	return(len);
+}
+
+// 短い番組名 20-40byte 程度
+static void genTitles(CORPUS *corpus, int num)
+{
+	uint8_t buf[255];
+
+	for(int i=0; i<num; i++){
+		size_t len = 0;
+		len += genKanji(buf+len, 2+rand()%6);
+		len += genHiragana(buf+len, 2+rand()%6);
+		if(rand()%2){
+			len += genAscii(buf+len, 2+rand()%4);
+		}
+		len += genKanji(buf+len, 1+rand()%3);
+		corpusAdd(corpus, buf, len);
+	}
+}
+
+// 長い番組記述 (拡張形式イベント記述子の項目記述) 200-255byte
+static void genTexts(CORPUS *corpus, int num)
+{
+	uint8_t buf[255+64];
+
+	for(int i=0; i<num; i++){
+		size_t len = 0;
+		while(len<200){
+			switch(rand()%4){
+			case 0:		len += genAscii(buf+len, 4+rand()%12); break;
+			case 1:		len += genHiragana(buf+len, 4+rand()%12); break;
+			default:	len += genKanji(buf+len, 4+rand()%12); break;
+			}
+		}
+		corpusAdd(corpus, buf, (len>255) ? 255 : len);
+	}
+}
+
+// 符号集合の指示・呼出しや追加記号・SS2/SS3 を頻繁に含む文字列
+static void genMixed(CORPUS *corpus, int num)
+{
+	static const uint8_t esc[][4] = {
+		{0x1b, 0x24, 0x3b},			// ESC $ ;   G0 = 追加記号
+		{0x1b, 0x24, 0x42},			// ESC $ B   G0 = 漢字
+		{0x1b, 0x29, 0x4a},			// ESC ) J   G1 = 英数
+		{0x1b, 0x2b, 0x31},			// ESC + 1   G3 = カタカナ
+		{0x1b, 0x2b, 0x49},			// ESC + I   G3 = JIS X0201 片仮名
+		{0x1b, 0x7c},				// LS3R      GR = G3
+		{0x1b, 0x7d},				// LS2R      GR = G2
+		{0x19},						// SS2
+		{0x1d},						// SS3
+		{0x89},						// MSZ
+		{0x8a},						// NSZ
+		{0x20},						// SP
+	};
+	static const int escLen[] = {3, 3, 3, 3, 3, 2, 2, 1, 1, 1, 1, 1};
+	uint8_t buf[255+64];
+
+	for(int i=0; i<num; i++){
+		size_t len = 0;
+		int n = 8+rand()%24;
+		for(int k=0; k<n && len<200; k++){
+			int e = rand()%(sizeof(escLen)/sizeof(escLen[0]));
+			memcpy(buf+len, esc[e], escLen[e]);
+			len += escLen[e];
+			switch(rand()%3){
+			case 0:		len += genKanji(buf+len, 1+rand()%3); break;
+			case 1:		len += genHiragana(buf+len, 1+rand()%3); break;
+			default:	buf[len++] = 0x21+rand()%94; break;
+			}
+		}
+		// 終了時に漢字へ戻す
+		memcpy(buf+len, esc[1], 3);
+		len += 3;
+		corpusAdd(corpus, buf, len);
+	}
+}
+
+/****************************************************************/
+/* TSファイルの EIT から文字列を取り出す                        */
+/****************************************************************/
+static void eitStrings(CORPUS *corpus, uint8_t *sec, size_t secLen)
+{
+	size_t sectionLength = ((sec[1] & 0x0f)<<8 | sec[2]) + 3;
+
+	if(sec[0]<0x4e || sec[0]>0x6f || sectionLength>secLen || sectionLength<14+4){
+		return;
+	}
+	for(size_t off=14; off+12<=sectionLength-4; ){
+		size_t loopLength = (sec[off+10] & 0x0f)<<8 | sec[off+11];
+		uint8_t *d = sec+off+12;
+		uint8_t *end = d+loopLength;
+
+		off += 12+loopLength;
+		if(off>sectionLength-4){
+			break;
+		}
+		for(; d+2<=end && d+2+d[1]<=end; d+=2+d[1]){
+			uint8_t *p = d+2;
+			uint8_t *pe = d+2+d[1];
+			if(d[0]==0x4d && d[1]>=5){			// 短形式イベント記述子
+				p += 3;
+				if(p+1+*p<=pe){
+					corpusAdd(corpus, p+1, *p);
+					p += 1+*p;
+				}
+				if(p<pe && p+1+*p<=pe){
+					corpusAdd(corpus, p+1, *p);
+				}
+			}else if(d[0]==0x4e && d[1]>=6){	// 拡張形式イベント記述子
+				uint8_t *items = p+5;
+				uint8_t *itemsEnd = items+p[4];
+				for(p=items; p<itemsEnd && itemsEnd<=pe; ){
+					if(p+1+*p>itemsEnd){
+						break;
+					}
+					corpusAdd(corpus, p+1, *p);
+					p += 1+*p;
+					if(p+1+*p>itemsEnd){
+						break;
+					}
+					corpusAdd(corpus, p+1, *p);
+					p += 1+*p;
+				}
+			}
+		}
+	}
+}
+
+static void tsStrings(CORPUS *corpus, char *file)
+{
+	uint8_t packet[TS_PACKETSIZE];
+	uint8_t sec[3][MAX_SECTION];
+	size_t secLen[3] = {0, 0, 0};
+	FILE *fp;
+
+	if((fp=fopen(file, "rb"))==NULL){
+		fprintf(stderr, "file open error : %s\n", file);
+		return;
+	}
+	while(fread(packet, TS_PACKETSIZE, 1, fp)==1){
+		uint16_t pid = (packet[1] & 0x1f)<<8 | packet[2];
+		int k = (pid==0x12) ? 0 : (pid==0x26) ? 1 : (pid==0x27) ? 2 : -1;
+		size_t off = 4;
+
+		if(packet[0]!=0x47 || k<0 || !(packet[3] & 0x10)){
+			continue;
+		}
+		if(packet[3] & 0x20){
+			off += 1+packet[4];
+		}
+		if(off>=TS_PACKETSIZE){
+			continue;
+		}
+		// ペイロード先頭で前のセクションを処理して新しいセクションを始める
+		if(packet[1] & 0x40){
+			size_t pointer = packet[off];
+			if(off+1+pointer>TS_PACKETSIZE){		// pointer_field 不正
+				secLen[k] = 0;
+				continue;
+			}
+			if(secLen[k]>0 && secLen[k]+pointer<=MAX_SECTION){
+				memcpy(sec[k]+secLen[k], packet+off+1, pointer);
+				eitStrings(corpus, sec[k], secLen[k]+pointer);
+			}
+			off += 1+pointer;
+			secLen[k] = 0;
+			// パケット内で完結するセクションは続けて処理する
+			while(off+3<=TS_PACKETSIZE && packet[off]!=0xff){
+				size_t sectionLength = ((packet[off+1] & 0x0f)<<8 | packet[off+2]) + 3;
+				if(off+sectionLength>TS_PACKETSIZE){
+					break;
+				}
+				eitStrings(corpus, packet+off, sectionLength);
+				off += sectionLength;
+			}
+			if(off>=TS_PACKETSIZE || packet[off]==0xff){
+				continue;
+			}
+		}else if(secLen[k]==0){
+			continue;
+		}
+		if(secLen[k]+TS_PACKETSIZE-off<=MAX_SECTION){
+			memcpy(sec[k]+secLen[k], packet+off, TS_PACKETSIZE-off);
+			secLen[k] += TS_PACKETSIZE-off;
+		}else{
+			secLen[k] = 0;
+		}
+	}
+	fclose(fp);
+}
+
+/****************************************************************/
+/* 変換方法                                                     */
+/* 戻値は変換結果のbyte数 (最適化で消えないよう合計して使う)    */
+/****************************************************************/
+static const char		*nkfOption = "-S -w";
+static NKF_HANDLE		*handle = NULL;
+static ARIB_CACHE		*cache = NULL;
+
+// 従来の aribTOsjis + nkf_convert (いずれもアロケートメモリを返す)
+static size_t convLegacy(const uint8_t *arib, size_t len)
+{
+	uint8_t *sjis, *utf8;
+	size_t n = 0;
+
+	if((sjis = aribTOsjis((uint8_t *)arib, len))==NULL){
+		return(0);
+	}
+	if((utf8 = nkf_convert(sjis, strlen((char *)sjis), (char *)nkfOption, strlen(nkfOption)))!=NULL){
+		n = strlen((char *)utf8);
+		free(utf8);
+	}
+	free(sjis);
+	return(n);
+}
+
+// aribTOsjisBuf + オプション解析済みの nkf ハンドル
+static size_t convHandle(const uint8_t *arib, size_t len)
+{
+	uint8_t sjis[ARIB_SJIS_BUFSIZE(len)];
+	int n = 0;
+
+	aribTOsjisBuf(arib, len, sjis, sizeof(sjis));
+	nkf_handle_convert(handle, sjis, strlen((char *)sjis), &n);
+	return(n);
+}
+
+// SJIS のみ (nkf を含まない)
+static size_t convSjisBuf(const uint8_t *arib, size_t len)
+{
+	uint8_t sjis[ARIB_SJIS_BUFSIZE(len)];
+
+	return(aribTOsjisBuf(arib, len, sjis, sizeof(sjis)));
+}
+
+// ARIB → UTF-8 直接変換
+static size_t convUtf8(const uint8_t *arib, size_t len)
+{
+	uint8_t utf8[ARIB_UTF8_BUFSIZE(len)];
+
+	return(aribTOutf8(arib, len, utf8, sizeof(utf8)));
+}
+
+// インターンキャッシュ (2回目以降はすべて検索のみ)
+static size_t convCache(const uint8_t *arib, size_t len)
+{
+	size_t n = 0;
+
+	aribCacheUtf8(cache, arib, len, &n);
+	return(n);
+}
+
+typedef struct {
+	const char	*name;
+	size_t		(*conv)(const uint8_t *, size_t);
+} CONVERTER;
+
+static const CONVERTER converters[] = {
+	{"aribTOsjis+nkf_convert",		convLegacy},
+	{"aribTOsjisBuf+nkf_handle",	convHandle},
+	{"aribTOsjisBuf",				convSjisBuf},
+	{"aribTOutf8",					convUtf8},
+	{"aribCacheUtf8",				convCache},
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec*1e-9);
+}
+
+static void bench(CORPUS *corpus, const CONVERTER *conv)
+{
+	uint64_t rounds = 0, allocs;
+	size_t sink = 0;
+	double start, elapsed;
+
+	// 1周目はキャッシュ・テーブルを温めるため計測しない
+	for(size_t i=0; i<corpus->numOfStr; i++){
+		sink += conv->conv(corpus->str[i], corpus->len[i]);
+	}
+
+	sink = 0;
+	allocs = allocCount;
+	start = now();
+	do{
+		for(size_t i=0; i<corpus->numOfStr; i++){
+			sink += conv->conv(corpus->str[i], corpus->len[i]);
+		}
+		rounds++;
+	}while((elapsed = now()-start) < BENCH_SEC);
+	allocs = allocCount-allocs;
+
+	fprintf(stdout, "%-10s %-26s %10.1f %10.2f %10.2f %12zu\n",
+		corpus->name, conv->name,
+		corpus->bytes*rounds/elapsed/1e6,
+		elapsed*1e9/(corpus->chars*rounds),
+		(double)allocs/(corpus->numOfStr*rounds),
+		sink/rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	CORPUS corpus[4] = {
+		{.name = "title"},
+		{.name = "text"},
+		{.name = "mixed"},
+		{.name = "ts"},
+	};
+	int numOfCorpus = 3;
+
+	srand(1);
+	genTitles(&corpus[0], 2000);
+	genTexts(&corpus[1], 500);
+	genMixed(&corpus[2], 1000);
+	for(int i=1; i<argc; i++){
+		tsStrings(&corpus[3], argv[i]);
+	}
+	if(corpus[3].numOfStr>0){
+		numOfCorpus = 4;
+	}
+
+	if((handle = nkf_open((char *)nkfOption, strlen(nkfOption)))==NULL || (cache = aribCacheNew())==NULL){
+		fprintf(stderr, "memory allocation error\n");
+		return(1);
+	}
+
+	fprintf(stdout, "%-10s %-26s %10s %10s %10s %12s\n", "corpus", "converter", "MB/s", "ns/char", "alloc/call", "out byte");
+	for(int i=0; i<numOfCorpus; i++){
+		fprintf(stderr, "%s : %zu strings %zu byte %zu chars\n", corpus[i].name, corpus[i].numOfStr, corpus[i].bytes, corpus[i].chars);
+	}
+	for(int i=0; i<numOfCorpus; i++){
+		for(size_t k=0; k<sizeof(converters)/sizeof(converters[0]); k++){
+			bench(&corpus[i], &converters[k]);
+		}
+	}
+
+	nkf_close(handle);
+	aribCacheFree(cache);
+	for(int i=0; i<4; i++){
+		corpusFree(&corpus[i]);
+	}
+	return(0);
+}
@@ -10,6 +10,12 @@
 #include <unistd.h>
 
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "libnkf.h"
 
@@ -35,9 +41,87 @@
 typedef struct {
 	uint16_t	pid;
 	uint16_t	sid;
-	char		*file;
+	char		*file;				// 先頭のファイル
+	char		**files;			// --file 及びオプション以外の引数で指定したファイル
+	uint32_t	numOfFiles;
+	bool		batch;				// 複数ファイルまたはディレクトリ指定
+	uint32_t	jobs;				// --jobs ワーカースレッド数 0:CPU数
+	uint8_t		numOfFields;		// --fields 指定項目数 0:従来のダンプ出力
+	uint8_t		fields[32];			// --fields 指定項目(FIELD_ID) 指定順に出力する
+	uint32_t	fieldMask;			// --fields 指定項目のビットマスク 1<<FIELD_ID
+	bool		timeFilter;			// --from/--to 指定あり
+	int64_t		from;				// --from 開始時間がこの時刻以上のイベントを出力 (UNIX時間)
+	int64_t		to;					// --to   開始時間がこの時刻未満のイベントを出力 (UNIX時間)
+	char		*indexOut;			// --index-out 作成する検索インデックスファイル
+	char		*index;				// --index     検索するインデックスファイル
+	char		*query;				// --query     検索語 空白区切りで全てを含むイベントを出力
+	bool		report;				// --report    番組表の受信完了状況を出力
+	bool		verbose;			// --verbose   --fields の段毎の処理状況・--from/--to の該当segmentを標準エラーに出力
 } ARG_PARAM;
 
+// --fields で指定可能な出力項目
+typedef enum {
+	FIELD_SID,			// サービス識別
+	FIELD_ONID,			// オリジナルネットワーク識別
+	FIELD_TSID,			// トランスポートストリーム識別
+	FIELD_TABLE_ID,		// テーブル識別
+	FIELD_VERSION,		// バージョン番号
+	FIELD_EVENT_ID,		// イベント識別
+	FIELD_START,		// 開始時間
+	FIELD_DURATION,		// 継続時間
+	FIELD_EPOCH,		// 開始時間 UNIX時間
+	FIELD_END_EPOCH,	// 終了時間 UNIX時間
+	FIELD_FREE_CA,		// スクランブル 0:無料 1:有料
+	FIELD_GENRE,		// コンテント記述子 先頭ジャンル
+	FIELD_TITLE,		// 短形式イベント記述子 番組名
+	FIELD_TEXT,			// 短形式イベント記述子 番組記述
+	FIELD_EXTENDED,		// 拡張形式イベント記述子 項目名:項目記述
+	FIELD_COMPONENT,	// コンポーネント記述子 映像種類名
+	FIELD_AUDIO,		// 音声コンポーネント記述子 音声種類名
+	FIELD_SERIES,		// シリーズ記述子 シリーズ名
+	FIELD_MAX
+} FIELD_ID;
+
+// 記述子ループを走査しないと得られない項目
+#define FIELD_DESCRIPTOR_MASK	(~((1U<<FIELD_GENRE)-1) & ((1U<<FIELD_MAX)-1))
+
+static const char *fieldName[FIELD_MAX] = {
+	"sid", "onid", "tsid", "table_id", "version", "event_id", "start", "duration", "epoch", "end_epoch", "free_ca",
+	"genre", "title", "text", "extended", "component", "audio", "series"
+};
+
+// ARIB文字列 セクションバッファ内を指すだけで変換はしない
+// 変換は出力時に選択された項目のみ行う
+typedef struct {
+	uint8_t		*ptr;
+	uint8_t		len;
+} ARIB_SPAN;
+
+#define MAX_EXT_ITEMS	32
+
+// --fields 出力用イベント情報
+typedef struct {
+	uint16_t	serviceId;
+	uint16_t	transportStreamId;
+	uint16_t	originalNetworkId;
+	uint8_t		tableId;
+	uint8_t		versionNumber;
+	uint16_t	eventId;
+	uint64_t	startTime;
+	uint32_t	duration;
+	uint8_t		freeCaMode;
+	bool		genreValid;
+	uint8_t		genre;						// content_nibble_level1<<4 | content_nibble_level2
+	ARIB_SPAN	title;						// 0x4D event_name_char
+	ARIB_SPAN	text;						// 0x4D text_char
+	ARIB_SPAN	component;					// 0x50 text_char
+	ARIB_SPAN	audio;						// 0xC4 text_char
+	ARIB_SPAN	series;						// 0xD5 series_name_char
+	uint8_t		numOfItems;
+	ARIB_SPAN	itemDescription[MAX_EXT_ITEMS];	// 0x4E item_description_char 長さ0は直前項目の続き
+	ARIB_SPAN	item[MAX_EXT_ITEMS];			// 0x4E item_char
+} EPG_EVENT;
+
 // TSヘッダ
 typedef struct {
 	uint8_t		sync_byte:8;					// 8bit 0x47 固定
@@ -622,6 +706,182 @@ static bool isdigit_n(int mode, char *num, char *out, size_t size)
 	return(rtn);
 }
 
+// --fields 引数解析 カンマ区切りの項目名をFIELD_IDの並びにする
+static bool parseFields(char *arg, ARG_PARAM *param)
+{
+	char *work, *save, *tok;
+	bool rtn = true;
+
+	if((work = strdup(arg))==NULL){
+		return(false);
+	}
+	param->numOfFields = 0;
+	param->fieldMask = 0;
+	for(tok=strtok_r(work, ",", &save); tok!=NULL; tok=strtok_r(NULL, ",", &save)){
+		int f;
+		for(f=0; f<FIELD_MAX; f++){
+			if(!strcmp(tok, fieldName[f])){
+				break;
+			}
+		}
+		if(f==FIELD_MAX || param->numOfFields >= sizeof(param->fields)){
+			fprintf(stderr, "--fields unknown field %s\n", tok);
+			rtn = false;
+			break;
+		}
+		param->fields[param->numOfFields++] = f;
+		param->fieldMask |= 1U<<f;
+	}
+	free(work);
+
+	if(rtn && param->numOfFields==0){
+		fprintf(stderr, "--fields arg error %s\n", arg);
+		rtn = false;
+	}
+	return(rtn);
+}
+
+// JST 年月日時分秒を UNIX時間に変換する
+static int64_t jstToEpoch(int year, int month, int day, int hour, int min, int sec)
+{
+	// 3月始まりの年にして 0000/03/01 からの日数を求める
+	int y = year - (month<=2);
+	int era = (y>=0 ? y : y-399) / 400;
+	int yoe = y - era*400;
+	int doy = (153*(month + (month>2 ? -3 : 9)) + 2)/5 + day-1;
+	int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+	int64_t days = (int64_t)era*146097 + doe - 719468;
+
+	return(days*86400 + hour*3600 + min*60 + sec - 9*60*60);
+}
+
+// --from/--to 引数解析
+// "YYYY/MM/DD[ hh:mm[:ss]]" "YYYYMMDDhhmm" は JST、"@999" は UNIX時間とする
+static bool parseTime(char *arg, int64_t *out)
+{
+	int year, month, day, hour = 0, min = 0, sec = 0;
+	char tail;
+
+	if(*arg=='@'){
+		char *end;
+		*out = strtoll(arg+1, &end, 10);
+		return(*(arg+1)!='\0' && *end=='\0');
+	}
+	if(strlen(arg)==12 && sscanf(arg, "%4d%2d%2d%2d%2d%c", &year, &month, &day, &hour, &min, &tail)==5){
+		;
+	}else if(sscanf(arg, "%d/%d/%d%c", &year, &month, &day, &tail)==3){
+		;
+	}else if(sscanf(arg, "%d/%d/%d %d:%d%c", &year, &month, &day, &hour, &min, &tail)==5){
+		;
+	}else if(sscanf(arg, "%d/%d/%d %d:%d:%d%c", &year, &month, &day, &hour, &min, &sec, &tail)==6){
+		;
+	}else{
+		return(false);
+	}
+	if(month<1 || month>12 || day<1 || day>31 || hour<0 || hour>24 || min<0 || min>59 || sec<0 || sec>59){
+		return(false);
+	}
+	*out = jstToEpoch(year, month, day, hour, min, sec);
+	return(true);
+}
+
+// 処理するファイルを追加する
+static bool addFile(ARG_PARAM *param, char *file)
+{
+	char **files = realloc(param->files, sizeof(char *)*(param->numOfFiles+1));
+
+	if(files==NULL || (files[param->numOfFiles] = strdup(file))==NULL){
+		fprintf(stderr, "--file memory allocation error\n");
+		return(false);
+	}
+	param->files = files;
+	if(param->numOfFiles++==0){
+		param->file = files[0];
+	}
+	param->batch = (param->numOfFiles>1);
+	return(true);
+}
+
+static int fileCompare(const void *a, const void *b)
+{
+	return(strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+// ディレクトリ指定はディレクトリ内の通常ファイル(名前順)に置き換える
+static bool expandFiles(ARG_PARAM *param)
+{
+	char **files = NULL;
+	uint32_t numOfFiles = 0, maxFiles = 0;
+
+	for(uint32_t i=0; i<param->numOfFiles; i++){
+		struct stat st;
+		char **entry = &param->files[i];
+		uint32_t numOfEntry = 1;
+		DIR *dir;
+		struct dirent *de;
+
+		if(stat(param->files[i], &st)==0 && S_ISDIR(st.st_mode)){
+			if((dir=opendir(param->files[i]))==NULL){
+				fprintf(stderr, "directory open error : %s\n", param->files[i]);
+				return(false);
+			}
+			param->batch = true;
+			entry = NULL;
+			numOfEntry = 0;
+			while((de=readdir(dir))!=NULL){
+				char *path;
+				if(de->d_name[0]=='.'){
+					continue;
+				}
+				if((path = malloc(strlen(param->files[i])+strlen(de->d_name)+2))==NULL){
+					closedir(dir);
+					return(false);
+				}
+				sprintf(path, "%s/%s", param->files[i], de->d_name);
+				if(stat(path, &st)!=0 || !S_ISREG(st.st_mode)){
+					free(path);
+					continue;
+				}
+				char **e = realloc(entry, sizeof(char *)*(numOfEntry+1));
+				if(e==NULL){
+					free(path);
+					closedir(dir);
+					return(false);
+				}
+				entry = e;
+				entry[numOfEntry++] = path;
+			}
+			closedir(dir);
+			qsort(entry, numOfEntry, sizeof(char *), fileCompare);
+		}
+
+		if(numOfFiles+numOfEntry>maxFiles){
+			maxFiles = (numOfFiles+numOfEntry)*2;
+			char **f = realloc(files, sizeof(char *)*maxFiles);
+			if(f==NULL){
+				return(false);
+			}
+			files = f;
+		}
+		if(numOfEntry>0){
+			memcpy(files+numOfFiles, entry, sizeof(char *)*numOfEntry);
+			numOfFiles += numOfEntry;
+		}
+		if(entry!=&param->files[i]){
+			free(entry);
+		}
+	}
+	free(param->files);
+	param->files = files;
+	param->numOfFiles = numOfFiles;
+	if(numOfFiles==0){
+		fprintf(stderr, "Please specify the ts file\n");
+		return(false);
+	}
+	param->file = files[0];
+	return(true);
+}
+
 // 実行時オプション解析
 bool parseOption(int argc, char *argv[], ARG_PARAM *param)
 {
@@ -631,23 +891,34 @@ bool parseOption(int argc, char *argv[], ARG_PARAM *param)
 		{"pid",			required_argument,	NULL,	'p'},
 		{"sid",			required_argument,	NULL,	's'},
 		{"file",		required_argument,	NULL,	'f'},
+		{"fields",		required_argument,	NULL,	'F'},
+		{"from",		required_argument,	NULL,	'B'},
+		{"to",			required_argument,	NULL,	'E'},
+		{"index-out",	required_argument,	NULL,	'O'},
+		{"index",		required_argument,	NULL,	'I'},
+		{"query",		required_argument,	NULL,	'Q'},
+		{"report",		no_argument,		NULL,	'R'},
+		{"jobs",		required_argument,	NULL,	'j'},
+		{"verbose",		no_argument,		NULL,	'v'},
 		{NULL,			0,					NULL,	0}
 	};
 
 	bool rtn = true;
 	int c;
 	char buf[16];
+	char *end;
 
 	//memset(param, '\0', sizeof(ARG_PARAM));
 	while(true){
-		if ((c = getopt_long(argc, argv, "hp:s:f:", long_options,
+		if ((c = getopt_long(argc, argv, "hp:s:f:F:B:E:O:I:Q:Rj:v", long_options,
 			NULL)) == -1) {
 			break;
 		}
 
 		switch(c){
 		case 'h':
-			fprintf(stderr, "usege %s --pid 999 --sid 999 --file file path\n", argv[0]);
+			fprintf(stderr, "usege %s --pid 999 --sid 999 [--fields sid,event_id,start,duration,title] [--from YYYY/MM/DD hh:mm] [--to YYYY/MM/DD hh:mm] [--index-out index file] [--report] [--jobs 9] [--verbose] --file file path [file or directory ...]\n"
+				"      %s --index index file --query keyword\n", argv[0], argv[0]);
 			return(false);
 			break;
 		case 'p':
@@ -675,7 +946,9 @@ bool parseOption(int argc, char *argv[], ARG_PARAM *param)
 		case 'f':
 			if(optarg){
 				if(strncmp(optarg, "-", 1) && strncmp(optarg, "--", 2)){
-					param->file = strdup(optarg);
+					if(!addFile(param, optarg)){
+						rtn = false;
+					}
 				}else{
 					fprintf(stderr, "--file arg error %s  --file filename\n", optarg);
 					rtn = false;
@@ -685,6 +958,41 @@ bool parseOption(int argc, char *argv[], ARG_PARAM *param)
 				rtn = false;
 			}
 			break;
+		case 'F':
+			if(!parseFields(optarg, param)){
+				rtn = false;
+			}
+			break;
+		case 'B':
+		case 'E':
+			if(!parseTime(optarg, (c=='B') ? &param->from : &param->to)){
+				fprintf(stderr, "--%s arg error %s  YYYY/MM/DD hh:mm or YYYYMMDDhhmm or @epoch\n", (c=='B') ? "from" : "to", optarg);
+				rtn = false;
+			}
+			param->timeFilter = true;
+			break;
+		case 'O':
+			param->indexOut = strdup(optarg);
+			break;
+		case 'I':
+			param->index = strdup(optarg);
+			break;
+		case 'Q':
+			param->query = strdup(optarg);
+			break;
+		case 'R':
+			param->report = true;
+			break;
+		case 'v':
+			param->verbose = true;
+			break;
+		case 'j':
+			param->jobs = strtol(optarg, &end, 10);
+			if(*optarg=='\0' || *end!='\0' || param->jobs<1 || param->jobs>256){
+				fprintf(stderr, "--jobs arg error %s\n", optarg);
+				rtn = false;
+			}
+			break;
 		default:
 			fprintf(stderr, "Error: Unknown character code %c\n", c);
 			rtn = false;
@@ -701,15 +1009,42 @@ bool parseOption(int argc, char *argv[], ARG_PARAM *param)
 	}
 
 	if(optind==1){
-		fprintf(stderr, "usege %s --pid 999 --sid 999 --file file path\n", argv[0]);
+		fprintf(stderr, "usege %s --pid 999 --sid 999 [--fields sid,event_id,start,duration,title] [--from YYYY/MM/DD hh:mm] [--to YYYY/MM/DD hh:mm] [--index-out index file] [--report] [--jobs 9] [--verbose] --file file path [file or directory ...]\n"
+			"      %s --index index file --query keyword\n", argv[0], argv[0]);
 		return(false);
 	}
 
+	// オプション以外の引数もファイルとする
+	for(; optind<argc && rtn; optind++){
+		rtn = addFile(param, argv[optind]);
+	}
+	if(!rtn){
+		return(false);
+	}
+
+	// 検索はインデックスファイルのみ使用する
+	if(param->query!=NULL){
+		if(param->index==NULL){
+			fprintf(stderr, "Please specify the index file\n" );
+			rtn = false;
+		}
+		return(rtn);
+	}
+
 	if(param->file==NULL){
 		fprintf(stderr, "Please specify the ts file\n" );
 		rtn = false;
 	}
 
+	if(rtn && !expandFiles(param)){
+		rtn = false;
+	}
+
+	if(param->timeFilter && param->from>=param->to){
+		fprintf(stderr, "--from must be earlier than --to\n" );
+		rtn = false;
+	}
+
 	return(rtn);
 }
 
@@ -739,13 +1074,105 @@ static void calc_bcd(int *out, uint8_t bcd)
 	*out = (bcd>>4 & 0x0f) * 10 + (bcd & 0x0f);
 } 
 
+/****************************************************************/
+/* 日付変換テーブル                                             */
+/* 放送で使用する期間(2000/01/01 から 16bit MJD の上限まで)の   */
+/* MJD→年月日曜日を起動時に1日ずつ進めて作成しておき、         */
+/* イベント毎の除算を不要にする                                 */
+/* 範囲外の日付は calc_mjd() で計算する                         */
+/****************************************************************/
+#define MJD_TABLE_BASE	51544		// 2000/01/01 (土)
+#define MJD_TABLE_SIZE	(0x10000-MJD_TABLE_BASE)	// 2038/04/22 (16bit MJD の上限) まで
+#define MJD_UNIX_EPOCH	40587		// 1970/01/01
+#define JST_OFFSET		(9*60*60)	// EIT の時刻は JST
+
+typedef struct {
+	uint16_t	year;
+	uint8_t		month;				// 0-11 (struct tm と同じ)
+	uint8_t		day:5;				// 1-31
+	uint8_t		week:3;				// 0:日曜日
+} MJD_DATE;
+
+static MJD_DATE	mjdTable[MJD_TABLE_SIZE];
+static uint8_t	bcdTable[256];
+static bool		mjdTableReady = false;
+
+// 日付変換テーブル作成 スレッド起動前に1度呼ぶこと
+static void mjdTableInit(void)
+{
+	static const uint8_t mdays[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	int year = 2000, month = 0, day = 1, week = 6;
+
+	if(mjdTableReady){
+		return;
+	}
+	for(int i=0; i<MJD_TABLE_SIZE; i++){
+		mjdTable[i].year	= year;
+		mjdTable[i].month	= month;
+		mjdTable[i].day		= day;
+		mjdTable[i].week	= week;
+
+		week = (week==6) ? 0 : week+1;
+		bool leap = (year%4==0 && year%100!=0) || year%400==0;
+		if(++day > mdays[month] + ((month==1 && leap) ? 1 : 0)){
+			day = 1;
+			if(++month==12){
+				month = 0;
+				year++;
+			}
+		}
+	}
+	for(int i=0; i<256; i++){
+		calc_bcd(&day, i);
+		bcdTable[i] = day;
+	}
+	mjdTableReady = true;
+}
+
+// start_time の MJD 部分(上位16bit)
+#define START_MJD(startTime)	((uint16_t)((startTime)>>24 & 0xffff))
+
 static void dateTime(struct tm *tp, uint64_t startTime)
 {
-	uint16_t mjd = (startTime>>32 & 0xff) << 8 | (startTime>>24 & 0xff) ;
-	calc_mjd(&tp->tm_year, &tp->tm_mon, &tp->tm_mday, &tp->tm_wday, mjd);
-	calc_bcd(&tp->tm_hour, startTime>>16 & 0xff);
-	calc_bcd(&tp->tm_min, startTime>>8 & 0xff);
-	calc_bcd(&tp->tm_sec, startTime & 0xff);
+	uint16_t mjd = START_MJD(startTime);
+
+	if(!mjdTableReady){
+		mjdTableInit();
+	}
+	if(mjd >= MJD_TABLE_BASE && mjd - MJD_TABLE_BASE < MJD_TABLE_SIZE){
+		MJD_DATE *d = &mjdTable[mjd - MJD_TABLE_BASE];
+		tp->tm_year	= d->year;
+		tp->tm_mon	= d->month;
+		tp->tm_mday	= d->day;
+		tp->tm_wday	= d->week;
+	}else{
+		calc_mjd(&tp->tm_year, &tp->tm_mon, &tp->tm_mday, &tp->tm_wday, mjd);
+	}
+	tp->tm_hour	= bcdTable[startTime>>16 & 0xff];
+	tp->tm_min	= bcdTable[startTime>>8 & 0xff];
+	tp->tm_sec	= bcdTable[startTime & 0xff];
+}
+
+// start_time(MJD+BCD JST) を UNIX時間に変換する
+static int64_t epochTime(uint64_t startTime)
+{
+	if(!mjdTableReady){
+		mjdTableInit();
+	}
+	return(((int64_t)START_MJD(startTime) - MJD_UNIX_EPOCH) * 86400
+			+ bcdTable[startTime>>16 & 0xff] * 3600
+			+ bcdTable[startTime>>8 & 0xff] * 60
+			+ bcdTable[startTime & 0xff]
+			- JST_OFFSET);
+}
+
+// duration(BCD 時分秒) を秒数に変換する
+static int32_t durationSec(uint32_t duration)
+{
+	if(!mjdTableReady){
+		mjdTableInit();
+	}
+	return(bcdTable[duration>>16 & 0xff] * 3600 + bcdTable[duration>>8 & 0xff] * 60 + bcdTable[duration & 0xff]);
 }
 
 /************************************
@@ -1055,6 +1482,106 @@ EitDescriptor_set(uint8_t *sectionData, EitDescriptor *edesc)
 	return;
 }
 
+/****************************************************************/
+/* --from/--to 時間範囲による絞り込み                           */
+/* スケジュール(table_id 0x50-0x57,0x60-0x67)は                 */
+/*   table_id 下位3bit : 4日単位のブロック                      */
+/*   section_number    : 0x40毎に1日 0x08毎に3時間のsegment     */
+/* なので (table_id&0x07)*0x100+section_number を8で割った値が  */
+/* 1日目0時からの3時間単位のsegment番号となる                   */
+/* 1日目0時は判定するセクションの先頭イベントの開始日時から     */
+/* 求め、範囲に該当するsegment番号の区間を計算して記述子を      */
+/* 読まずに範囲外のセクションを読み飛ばす                       */
+/****************************************************************/
+#define SEGMENT_SEC		(3*60*60)
+
+typedef struct {
+	int64_t		from;				// [from, to) UNIX時間
+	int64_t		to;
+	bool		verbose;			// --verbose 1日目が変わる毎に該当segmentを標準エラーに出力
+	bool		baseValid;			// baseMjd 確定済
+	uint16_t	baseMjd;			// スケジュール1日目のMJD
+	int32_t		firstSegment;		// 範囲に該当するsegment番号 (1日目0時からの3時間単位)
+	int32_t		lastSegment;
+} TIME_WINDOW;
+
+#define IS_SCHEDULE(tableId)	(((tableId)>=0x50 && (tableId)<=0x57) || ((tableId)>=0x60 && (tableId)<=0x67))
+#define SCHEDULE_SEGMENTS	(8*32)			// table_id 8個 × 32segment (8日分)
+#define SCHEDULE_SEGMENT(tableId, sectionNumber)	((((tableId)&0x07)<<8 | (sectionNumber)) >> 3)
+
+// 1日目の日付から該当segment区間を求める
+static void timeWindowBase(TIME_WINDOW *w, uint16_t baseMjd)
+{
+	int64_t base = ((int64_t)baseMjd - MJD_UNIX_EPOCH) * 86400 - JST_OFFSET;
+	int64_t first, last;
+
+	if(w->baseValid && w->baseMjd==baseMjd){
+		return;
+	}
+	w->baseValid	= true;
+	w->baseMjd		= baseMjd;
+	// 負数の切り捨てに注意し、int64 のまま 0〜SCHEDULE_SEGMENTS に丸めてから int32 にする
+	// (--to 省略時は INT64_MAX)
+	first = (w->from<=base) ? 0 : (w->from-base)/SEGMENT_SEC;
+	last = (w->to<=base) ? -1 : (w->to-1-base)/SEGMENT_SEC;
+	w->firstSegment	= (first>SCHEDULE_SEGMENTS) ? SCHEDULE_SEGMENTS : (int32_t)first;
+	w->lastSegment	= (last>SCHEDULE_SEGMENTS) ? SCHEDULE_SEGMENTS : (int32_t)last;
+	if(!w->verbose){
+		return;
+	}
+	if(w->lastSegment<0 || w->firstSegment>=SCHEDULE_SEGMENTS){
+		fprintf(stderr, "time window : schedule day1 mjd %" PRIu16 " no segment in range\n", baseMjd);
+	}else{
+		int32_t lastSegment = (w->lastSegment<SCHEDULE_SEGMENTS) ? w->lastSegment : SCHEDULE_SEGMENTS-1;
+		fprintf(stderr, "time window : schedule day1 mjd %" PRIu16 " segment %" PRId32 "-%" PRId32 " (table_id %02x/%02x-%02x/%02x)\n",
+			baseMjd, w->firstSegment, lastSegment,
+			0x50+w->firstSegment/32, (w->firstSegment%32)*8, 0x50+lastSegment/32, (lastSegment%32)*8+7);
+	}
+}
+
+// 受信したスケジュールセクションの先頭イベントから1日目の日付を更新する
+// (日付が変わると1日目も変わるので読んだセクション毎に確認する)
+static void timeWindowLearn(TIME_WINDOW *w, EIT *eit, EitDescriptor *edesc)
+{
+	if(IS_SCHEDULE(eit->tableId) && edesc->startTime!=0xffffffffffULL){
+		timeWindowBase(w, START_MJD(edesc->startTime) - (SCHEDULE_SEGMENT(eit->tableId, eit->sectionNumber)>>3));
+	}
+}
+
+// セクションヘッダと先頭イベントの開始日時だけで範囲外と判断できる場合 true
+// 1日目は判定するセクション自身の先頭イベントから求めるので
+// 日付が変わった直後に前の1日目で範囲内のセクションを読み飛ばすことは無い
+// (イベントの無いセクションは直前に求めた1日目で判断する)
+static bool sectionOutOfWindow(TIME_WINDOW *w, EIT *eit)
+{
+	EitDescriptor edesc;
+	int32_t segment;
+
+	if(!IS_SCHEDULE(eit->tableId)){
+		return(false);
+	}
+	if(eit->sectionLength>=11+4+12){
+		EitDescriptor_set(eit->sectionData, &edesc);
+		timeWindowLearn(w, eit, &edesc);
+	}
+	if(!w->baseValid){
+		return(false);
+	}
+	segment = SCHEDULE_SEGMENT(eit->tableId, eit->sectionNumber);
+	return(segment < w->firstSegment || segment > w->lastSegment);
+}
+
+static bool eventInWindow(TIME_WINDOW *w, EitDescriptor *edesc)
+{
+	int64_t start;
+
+	if(edesc->startTime==0xffffffffffULL){
+		return(false);
+	}
+	start = epochTime(edesc->startTime);
+	return(start >= w->from && start < w->to);
+}
+
 /***
 static void
 DescriptorX48_set(uint8_t *descriptor, DescriptorX48 *x48)
@@ -1300,6 +1827,26 @@ DescriptorXC5_set(uint8_t *descriptor, DescriptorXC5 *xC5)
 }
 
 
+// ARIB文字列を SJIS を経由して UTF-8 に変換し出力する (従来の変換経路)
+// 記述子内の文字列は255byte以下なので SJIS は自動変数に変換する
+// nkf はオプション解析済みのハンドルを初回に作成して使い回す
+static void printAribText(uint8_t *arib, size_t len)
+{
+	static NKF_HANDLE *sjisToUtf8 = NULL;
+	const char *option = "-S -w";
+	uint8_t sjis[ARIB_SJIS_BUFSIZE(255)];
+	uint8_t *p;
+	size_t sjisLen;
+
+	if(sjisToUtf8==NULL && (sjisToUtf8 = nkf_open((char *)option, strlen(option)))==NULL){
+		return;
+	}
+	sjisLen = aribTOsjisBuf(arib, len, sjis, sizeof(sjis));
+	if((p = nkf_handle_convert(sjisToUtf8, sjis, sjisLen, NULL))!=NULL){
+		fprintf(stdout, "\t\t%s\n", p);
+	}
+}
+
 static void printEIT(EIT *eit)
 {
 	fprintf(stdout, "------------------------------------------------------\n");
@@ -1422,8 +1969,8 @@ static void printEitDescriptor(EitDescriptor *edesc)
 	fprintf(stdout, "\t[EVENT INFOMATION]\n");
 	fprintf(stdout, "\teventId               : %04" PRIx16 " [%" PRId16 "]\n", edesc->eventId, edesc->eventId);
 	dateTime(&t, edesc->startTime);
-	fprintf(stdout, "\tstartTime             : %010" PRIx64 " [mjd %" PRId16 " %04" PRId32 "/%02" PRId32 "/%02" PRId32 " %02" PRId32 ":%02" PRId32 ":%02" PRId32 " [%" PRId32 "]""\n",
-		(uint64_t)edesc->startTime, (uint16_t)((edesc->startTime>>32 & 0xff) << 8 | (edesc->startTime>>24 & 0xff )), t.tm_year,t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, t.tm_wday);
+	fprintf(stdout, "\tstartTime             : %010" PRIx64 " [mjd %" PRId16 " %04" PRId32 "/%02" PRId32 "/%02" PRId32 " %02" PRId32 ":%02" PRId32 ":%02" PRId32 " [%" PRId32 "] epoch %" PRId64 "]\n",
+		(uint64_t)edesc->startTime, START_MJD(edesc->startTime), t.tm_year,t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, t.tm_wday, epochTime(edesc->startTime));
 	fprintf(stdout, "\tduration              : %08" PRIx32"\n",  edesc->duration);
 	fprintf(stdout, "\trunningStatus         : %02" PRIx8"\n",  edesc->runningStatus);
 	fprintf(stdout, "\tfreeCaMode            : %" PRIx8"\n",    edesc->freeCaMode);
@@ -1473,7 +2020,6 @@ static void printDescriptorXCB(DescriptorXCB *xCB)
 
 static void printDescriptorX4D(DescriptorX4D *x4D)
 {
-	const char *option = "-S -w";
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  x4D->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", x4D->descriptorLength, x4D->descriptorLength);
 	fprintf(stdout, "\t\tISO639LanguageCode jpn:0x6A706E: %06" PRIx32 "\n", x4D->ISO639LanguageCode);
@@ -1481,15 +2027,7 @@ static void printDescriptorX4D(DescriptorX4D *x4D)
 	fprintf(stdout, "\t\teventNameChar                  : "); 
 	if(x4D->eventNameLength>0){
 		hex_dump(x4D->eventNameChar,x4D->eventNameLength,2);
-   		 uint8_t *sjis = aribTOsjis(x4D->eventNameChar, x4D->eventNameLength);
-   		 if(sjis!=NULL){
-			uint8_t  *p;
-   		 	if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-   		 }
+   		 printAribText(x4D->eventNameChar, x4D->eventNameLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1498,15 +2036,7 @@ static void printDescriptorX4D(DescriptorX4D *x4D)
 	fprintf(stdout, "\t\ttextChar                       : "); 
 	if(x4D->textLength>0){
 		hex_dump(x4D->textChar,x4D->textLength,2);
-		uint8_t *sjis = aribTOsjis(x4D->textChar, x4D->textLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(x4D->textChar, x4D->textLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1516,7 +2046,6 @@ static void printDescriptorX4D(DescriptorX4D *x4D)
 
 static void printDescriptorX4E(DescriptorX4E *x4E)
 {
-	const char *option = "-S -w";
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  x4E->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", x4E->descriptorLength, x4E->descriptorLength);
 	fprintf(stdout, "\t\tdescriptorNumber               : %02" PRIx8"\n",  x4E->descriptorNumber);
@@ -1528,15 +2057,7 @@ static void printDescriptorX4E(DescriptorX4E *x4E)
 
 	if(x4E->itemDescriptionLength>0){
 		hex_dump(x4E->itemDescriptionChar,x4E->itemDescriptionLength,2);
-		uint8_t *sjis = aribTOsjis(x4E->itemDescriptionChar, x4E->itemDescriptionLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(x4E->itemDescriptionChar, x4E->itemDescriptionLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1545,15 +2066,7 @@ static void printDescriptorX4E(DescriptorX4E *x4E)
 	fprintf(stdout, "\t\titemChar                       : "); 
 	if(x4E->itemLength>0){
 		hex_dump(x4E->itemChar,x4E->itemLength,2);
-		uint8_t *sjis = aribTOsjis(x4E->itemChar, x4E->itemLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(x4E->itemChar, x4E->itemLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1562,15 +2075,7 @@ static void printDescriptorX4E(DescriptorX4E *x4E)
 	fprintf(stdout, "\t\ttextChar                       : "); 
 	if(x4E->textLength>0){
 		hex_dump(x4E->textChar,x4E->textLength,2);
-		uint8_t *sjis = aribTOsjis(x4E->textChar, x4E->textLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(x4E->textChar, x4E->textLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1618,16 +2123,7 @@ static void printDescriptorX50(DescriptorX50 *x50)
 	uint8_t txtLength = x50->descriptorLength-6;
 	if(txtLength>0){
 		hex_dump(x50->textChar,txtLength, 2);
-		const char *option = "-S -w";
-    	uint8_t *sjis = aribTOsjis(x50->textChar, txtLength);
-    	if(sjis!=NULL){
-			uint8_t  *p;
-    		if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-    	}
+		printAribText(x50->textChar, txtLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1638,7 +2134,6 @@ static void printDescriptorX50(DescriptorX50 *x50)
 static void printDescriptorXC4(DescriptorXC4 *xC4)
 {
 	uint8_t txtLength;
-	const char *option = "-S -w";
 
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  xC4->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", xC4->descriptorLength, xC4->descriptorLength);
@@ -1706,15 +2201,7 @@ static void printDescriptorXC4(DescriptorXC4 *xC4)
 	fprintf(stdout, "\t\ttextChar                       : "); 
 	if(txtLength>0){
 		hex_dump(xC4->textChar,txtLength, 2);
-		uint8_t *sjis = aribTOsjis(xC4->textChar, txtLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(xC4->textChar, txtLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1725,7 +2212,6 @@ static void printDescriptorXC4(DescriptorXC4 *xC4)
 
 static void printDescriptorXC7(DescriptorXC7 *xC7)
 {
-	const char *option = "-S -w";
 
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  xC7->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", xC7->descriptorLength, xC7->descriptorLength);
@@ -1763,15 +2249,7 @@ static void printDescriptorXC7(DescriptorXC7 *xC7)
 	fprintf(stdout, "\t\ttextChar                       : ");
 	if(xC7->textLength>0){
 		hex_dump(xC7->textChar, xC7->textLength, 2);
-		uint8_t *sjis = aribTOsjis(xC7->textChar, xC7->textLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(xC7->textChar, xC7->textLength);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -1965,7 +2443,6 @@ static void printDescriptorXDC(DescriptorXDC *xDC)
 
 static void printDescriptorXD5(DescriptorXD5 *xD5)
 {
-	const char *option = "-S -w";
 
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  xD5->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", xD5->descriptorLength, xD5->descriptorLength);
@@ -1979,15 +2456,7 @@ static void printDescriptorXD5(DescriptorXD5 *xD5)
 	fprintf(stdout, "\t\tseriesNameChar                 : " );
 	if(xD5->descriptorLength-8>0){
 		hex_dump(xD5->seriesNameChar, xD5->descriptorLength-8, 2);
-		uint8_t *sjis = aribTOsjis(xD5->seriesNameChar, xD5->descriptorLength-8);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(xD5->seriesNameChar, xD5->descriptorLength-8);
 	}else{
 		fprintf(stdout, "\n");
 	}
@@ -2012,7 +2481,6 @@ static void printDescriptorX42(DescriptorX42 *x42)
 // DescriptorXC5 ハイパーリンク記述子
 static void printDescriptorXC5(DescriptorXC5 *xC5)
 {
-	const char *option = "-S -w";
 
 	fprintf(stdout, "\t\tdescriptorTag                  : %02" PRIx8"\n",  xC5->descriptorTag);
 	fprintf(stdout, "\t\tdescriptorLength               : %02" PRIx8 " [%" PRId8 "]\n", xC5->descriptorLength, xC5->descriptorLength);
@@ -2141,15 +2609,7 @@ static void printDescriptorXC5(DescriptorXC5 *xC5)
 		if(xC5->selectorLength>0){
 			hex_dump((xC5->selector), xC5->selectorLength, 2);
 		}
-		uint8_t *sjis = aribTOsjis(xC5->selector, xC5->selectorLength);
-		if(sjis!=NULL){
-			uint8_t  *p;
-			if((p = nkf_convert(sjis, strlen((char *)sjis), (char *)option, strlen(option)))!=NULL){
-				fprintf(stdout, "\t\t%s\n", p);
-				free(p);
-			}
-			free(sjis);
-		}
+		printAribText(xC5->selector, xC5->selectorLength);
 		break;
 	default :
 		// 将来のためリザーブ
@@ -2337,62 +2797,2287 @@ static bool printDescriptor(uint8_t descriptorTag, uint8_t *descriptor)
 	return(rtn);
 }
 
+/****************************************************************/
+/* --fields 出力                                                */
+/* 記述子は文字列の位置と長さを EPG_EVENT に記録するだけとし    */
+/* 文字コード変換は指定された項目を出力する時にだけ行う         */
+/****************************************************************/
 
-int main(int argc, char *argv[])
+// 1イベント分の項目を収集する
+// 文字列はセクションバッファ内を指すので次のcreate_payload()呼出までに出力すること
+static void collectEvent(EIT *eit, EitDescriptor *edesc, uint32_t fieldMask, EPG_EVENT *ev)
 {
+	memset(ev, '\0', sizeof(EPG_EVENT));
+	ev->serviceId			= eit->serviceId;
+	ev->transportStreamId	= eit->transportStreamId;
+	ev->originalNetworkId	= eit->originalNetworkId;
+	ev->tableId				= eit->tableId;
+	ev->versionNumber		= eit->versionNumber;
+	ev->eventId				= edesc->eventId;
+	ev->startTime			= edesc->startTime;
+	ev->duration			= edesc->duration;
+	ev->freeCaMode			= edesc->freeCaMode;
+
+	// 記述子から得る項目が指定されていなければ記述子ループを読まない
+	if(!(fieldMask & FIELD_DESCRIPTOR_MASK)){
+		return;
+	}
 
-	uint8_t payload[MAX_PAYLOAD];
-	size_t	payload_len;
-	FILE *fp;
-	bool find;
-	EIT eit;
-	EitDescriptor edesc;
-	ARG_PARAM param;
+	for(int descriptorOffset=0; descriptorOffset+2<=edesc->descriptorsLoopLength; descriptorOffset+=*(edesc->descriptor+descriptorOffset+1) + 2){
+		uint8_t *descriptor = edesc->descriptor+descriptorOffset;
+		int txtLength;
 
-	param.pid = 0xffff;
-	param.sid = 0xffff;
-	if(parseOption(argc, argv, &param)){
-		fprintf(stdout,"parseOption() return true\n");
-		fprintf(stdout,"pid     = %d\n", param.pid);
-		fprintf(stdout,"sid     = %d\n", param.sid);
-		fprintf(stdout,"file    = %s\n", param.file);
+		// 記述子ループからはみ出す記述子以降は読まない
+		if(descriptorOffset+2+*(descriptor+1)>edesc->descriptorsLoopLength){
+			break;
+		}
 
-		// 未指定時、デフォルト0x12とする
-		if(param.pid==0xffff){
-			param.pid = 0x12;
+		switch(*descriptor){
+		case 0x4d: // 短形式イベント記述子
+			// 番組名・番組記述の長さが記述子長を超える場合はその項目を使わない
+			// (DescriptorX4D_set は長さを確認せずに text_length を読むので使わない)
+			if(*(descriptor+1)>=4){
+				uint8_t dlen = *(descriptor+1);
+				uint8_t nameLength = *(descriptor+5);
+				if(4+nameLength<=dlen){
+					ev->title.ptr	= descriptor+6;
+					ev->title.len	= nameLength;
+				}
+				if(5+nameLength<=dlen && 5+nameLength+*(descriptor+6+nameLength)<=dlen){
+					ev->text.ptr	= descriptor+7+nameLength;
+					ev->text.len	= *(descriptor+6+nameLength);
+				}
+			}
+			break;
+		case 0x4e: // 拡張形式イベント記述子 1記述子に複数項目を持つ場合がある
+			// 項目長は記述子の外を指す場合があるので length_of_items と記述子長の短い方までとする
+			// (DescriptorX4E_set は先頭項目の長さを確認せずに読むので使わない)
+			if(*(descriptor+1)>=5){
+				uint8_t *cur = descriptor+7;
+				uint8_t *end = cur+*(descriptor+6);
+				if(end>descriptor+2+*(descriptor+1)){
+					end = descriptor+2+*(descriptor+1);
+				}
+				while(cur<end && ev->numOfItems<MAX_EXT_ITEMS){
+					if(cur+1+*cur>=end){
+						break;
+					}
+					uint8_t *item = cur+1+*cur;
+					if(item+1+*item>end){
+						break;
+					}
+					ev->itemDescription[ev->numOfItems].len	= *cur;
+					ev->itemDescription[ev->numOfItems].ptr	= cur+1;
+					ev->item[ev->numOfItems].len			= *item;
+					ev->item[ev->numOfItems].ptr			= item+1;
+					cur = item+1+*item;
+					ev->numOfItems++;
+				}
+			}
+			break;
+		case 0x50: // コンポーネント記述子
+			{
+				DescriptorX50 x50;
+				DescriptorX50_set(descriptor, &x50);
+				txtLength = x50.descriptorLength-6;
+				if(txtLength>0){
+					ev->component.ptr	= x50.textChar;
+					ev->component.len	= txtLength;
+				}
+			}
+			break;
+		case 0x54: // コンテント記述子 先頭のジャンルのみ
+			if(*(descriptor+1)>=2){
+				ev->genreValid	= true;
+				ev->genre		= *(descriptor+2);
+			}
+			break;
+		case 0xc4: // 音声コンポーネント記述子
+			{
+				DescriptorXC4 xC4;
+				DescriptorXC4_set(descriptor, &xC4);
+				txtLength = xC4.descriptorLength-((xC4.ESMultiLingualFlag==1) ? 12 : 9);
+				if(txtLength>0){
+					ev->audio.ptr	= xC4.textChar;
+					ev->audio.len	= txtLength;
+				}
+			}
+			break;
+		case 0xd5: // シリーズ記述子
+			{
+				DescriptorXD5 xD5;
+				DescriptorXD5_set(descriptor, &xD5);
+				txtLength = xD5.descriptorLength-8;
+				if(txtLength>0){
+					ev->series.ptr	= xD5.seriesNameChar;
+					ev->series.len	= txtLength;
+				}
+			}
+			break;
+		default:
+			break;
 		}
-	}else{
-		fprintf(stdout,"parseOption() return false\n");
-		return(-1);
 	}
 
-	if((fp=fopen(param.file,"r"))==NULL){
-		fprintf(stderr, "file open error : %s\n", param.file);
-		return(-1);
-   	 }
+	return;
+}
 
-	while(!feof(fp)){
-		find = create_payload(param.pid, payload, &payload_len, &fp);
-		if(find){
-			memset(&eit, '\0', sizeof(EIT));
-			EIT_set(payload, &eit);
+// 区切り文字(TAB)と改行を空白に置き換えて出力する
+// 1byte毎にロックしないよう printFields で out をロックしてから呼ぶ
+static void printFieldText(FILE *out, const uint8_t *utf8)
+{
+	for(const uint8_t *p=utf8; *p!='\0'; p++){
+		putc_unlocked((*p=='\t' || *p=='\n' || *p=='\r') ? ' ' : *p, out);
+	}
+}
 
-			if(param.sid==0xffff || param.sid == eit.serviceId){
-				printEIT(&eit);
-			}
+// 番組名や項目名は p/f・スケジュールの各セクションで繰り返し現れるので
+// 変換結果を cache に残して2回目以降は検索だけで済ませる
+// cache はスレッド間で共有しないこと
+// 番組記述は繰り返さないものが多いので出力用の cache は FIELD_CACHE_LIMIT で上限を設ける
+// (拡張形式の項目記述は cache を通さない)
+#define FIELD_CACHE_LIMIT	(4*1024*1024)
 
-			memset(&edesc, '\0', sizeof(EitDescriptor));
-			for(int eDescriptorLength=0; eDescriptorLength<eit.sectionLength-11-4; eDescriptorLength+=12+edesc.descriptorsLoopLength){
-																				// 11 : EIT serviceId から lastTableId までのbyte数
-																				// 4  : EIT CRC32 のbyte数
-																				// eit.sectionLength-11-4 : EIT sectionData のbyte数
-																				// 12 : eventId から descriptorsLoopLength までのbyte数
-																				// edesc.descriptorsLoopLength : descriptor のbyte数
-																				// 12+sdesc.descriptorsLoopLength : EIT Descriptor 1つのbyte数
+static void printFieldSpan(FILE *out, ARIB_CACHE *cache, ARIB_SPAN *span)
+{
+	const uint8_t *utf8;
 
-				memset(&edesc, '\0', sizeof(EitDescriptor));
-				EitDescriptor_set(eit.sectionData+eDescriptorLength, &edesc);
-				uint8_t descriptorTag;
+	if(span->len==0){
+		return;
+	}
+	if(cache!=NULL && (utf8 = aribCacheUtf8(cache, span->ptr, span->len, NULL))!=NULL){
+		printFieldText(out, utf8);
+	}
+}
+
+// 拡張形式イベント記述子 項目名:項目記述 を " / " で連結して出力する
+// 項目名長0の項目は直前項目の続きなので符号集合の状態を持ち越して順に復号する
+static void printFieldExtended(FILE *out, ARIB_CACHE *cache, EPG_EVENT *ev)
+{
+	uint8_t utf8[ARIB_UTF8_FEEDSIZE(255)];
+	ARIB_DECODER dec;
+
+	for(int i=0; i<ev->numOfItems; ){
+		int k = i;
+
+		if(i>0){
+			fprintf(out, " / ");
+		}
+		printFieldSpan(out, cache, &ev->itemDescription[i]);
+		fputc(':', out);
+		aribDecoderInit(&dec);
+		do{
+			aribDecoderFeed(&dec, ev->item[k].ptr, ev->item[k].len, utf8, sizeof(utf8));
+			printFieldText(out, utf8);
+			k++;
+		}while(k<ev->numOfItems && ev->itemDescription[k].len==0);
+		aribDecoderFinish(&dec);
+		i = k;
+	}
+}
+
+static void printFieldsHeader(FILE *out, ARG_PARAM *param)
+{
+	fputc('#', out);
+	for(int i=0; i<param->numOfFields; i++){
+		fprintf(out, "%s%s", (i>0) ? "\t" : "", fieldName[param->fields[i]]);
+	}
+	fputc('\n', out);
+}
+
+// 指定項目をTAB区切り1行で出力する
+static void printFields(FILE *out, ARIB_CACHE *cache, EPG_EVENT *ev, ARG_PARAM *param)
+{
+	struct tm t;
+
+	flockfile(out);
+	for(int i=0; i<param->numOfFields; i++){
+		if(i>0){
+			fputc('\t', out);
+		}
+		switch(param->fields[i]){
+		case FIELD_SID:			fprintf(out, "%" PRIu16, ev->serviceId); break;
+		case FIELD_ONID:		fprintf(out, "%" PRIu16, ev->originalNetworkId); break;
+		case FIELD_TSID:		fprintf(out, "%" PRIu16, ev->transportStreamId); break;
+		case FIELD_TABLE_ID:	fprintf(out, "%02" PRIx8, ev->tableId); break;
+		case FIELD_VERSION:		fprintf(out, "%" PRIu8, ev->versionNumber); break;
+		case FIELD_EVENT_ID:	fprintf(out, "%" PRIu16, ev->eventId); break;
+		case FIELD_START:
+			// following の場合 all bit 1 は未定義
+			if(ev->startTime==0xffffffffffULL){
+				fputc('-', out);
+			}else{
+				dateTime(&t, ev->startTime);
+				fprintf(out, "%04d/%02d/%02d %02d:%02d:%02d", t.tm_year, t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+			}
+			break;
+		case FIELD_DURATION:
+			if(ev->duration==0xffffff){
+				fputc('-', out);
+			}else{
+				fprintf(out, "%02" PRIx32 ":%02" PRIx32 ":%02" PRIx32, ev->duration>>16 & 0xff, ev->duration>>8 & 0xff, ev->duration & 0xff);
+			}
+			break;
+		case FIELD_EPOCH:
+			if(ev->startTime==0xffffffffffULL){
+				fputc('-', out);
+			}else{
+				fprintf(out, "%" PRId64, epochTime(ev->startTime));
+			}
+			break;
+		case FIELD_END_EPOCH:
+			if(ev->startTime==0xffffffffffULL || ev->duration==0xffffff){
+				fputc('-', out);
+			}else{
+				fprintf(out, "%" PRId64, epochTime(ev->startTime) + durationSec(ev->duration));
+			}
+			break;
+		case FIELD_FREE_CA:		fprintf(out, "%" PRIu8, ev->freeCaMode); break;
+		case FIELD_GENRE:
+			if(ev->genreValid){
+				fprintf(out, "%02" PRIx8, ev->genre);
+			}
+			break;
+		case FIELD_TITLE:		printFieldSpan(out, cache, &ev->title); break;
+		case FIELD_TEXT:		printFieldSpan(out, cache, &ev->text); break;
+		case FIELD_EXTENDED:	printFieldExtended(out, cache, ev); break;
+		case FIELD_COMPONENT:	printFieldSpan(out, cache, &ev->component); break;
+		case FIELD_AUDIO:		printFieldSpan(out, cache, &ev->audio); break;
+		case FIELD_SERIES:		printFieldSpan(out, cache, &ev->series); break;
+		}
+	}
+	fputc('\n', out);
+	funlockfile(out);
+}
+
+
+/****************************************************************/
+/* 番組名・番組記述の全文検索インデックス                       */
+/* 番組記述は短形式の番組記述に拡張形式の項目を連結したもの     */
+/* --index-out : 重複を除いたイベントのUTF-8文字列から          */
+/*               2文字(bigram)の転置インデックスを作成する      */
+/* --query     : インデックスファイルをmmapして検索する         */
+/*               TSファイルは読まない                           */
+/*                                                              */
+/* ファイル構成 (数値は作成したマシンのバイト順 8byte境界)      */
+/*   INDEX_HEADER                                               */
+/*   INDEX_EVENT   [numOfEvents]                                */
+/*   INDEX_KEY     [numOfKeys]     key 昇順                     */
+/*   uint32_t      [numOfPostings] キー毎にイベント番号昇順     */
+/*   uint8_t       [textSize]      UTF-8文字列                  */
+/****************************************************************/
+#define INDEX_MAGIC		"EITIDX01"
+
+typedef struct {
+	char		magic[8];
+	uint32_t	numOfEvents;
+	uint32_t	numOfKeys;
+	uint32_t	numOfPostings;
+	uint32_t	textSize;
+} INDEX_HEADER;
+
+typedef struct {
+	uint16_t	originalNetworkId;
+	uint16_t	transportStreamId;
+	uint16_t	serviceId;
+	uint16_t	eventId;
+	int64_t		start;				// UNIX時間 INT64_MIN:未定義
+	int32_t		duration;			// 秒 -1:未定義
+	uint32_t	titleOffset;		// 文字列領域先頭からのオフセット
+	uint32_t	titleLength;
+	uint32_t	textOffset;
+	uint32_t	textLength;
+	uint8_t		tableId;
+	uint8_t		versionNumber;
+	uint8_t		reserved[2];
+} INDEX_EVENT;
+
+typedef struct {
+	uint64_t	key;				// 1文字目<<32 | 2文字目 (文字列末尾の1文字は2文字目を0とする)
+	uint32_t	offset;				// ポスティング先頭位置
+	uint32_t	count;
+} INDEX_KEY;
+
+#define INDEX_ALIGN(n)	(((n)+7) & ~(size_t)7)
+
+// 重複除去用イベント保持領域
+// (original_network_id, transport_stream_id, service_id, event_id) をキーとし
+// イベントのバイト列(event_id から記述子ループまで)をコピーして保持する
+// 文字コード変換は出力時に1イベント1回だけ行う
+typedef struct {
+	uint64_t	key;
+	uint16_t	originalNetworkId;
+	uint16_t	transportStreamId;
+	uint16_t	serviceId;
+	uint8_t		tableId;
+	uint8_t		versionNumber;
+	uint32_t	fileNo;				// 読み込んだファイル番号
+	uint16_t	length;
+	uint8_t		*data;				// アロケートメモリ
+} STORE_EVENT;
+
+typedef struct {
+	STORE_EVENT	*events;			// 登録順
+	uint32_t	numOfEvents;
+	uint32_t	maxEvents;
+	uint32_t	*slot;				// オープンアドレス法 events番号+1 0:空き
+	uint32_t	numOfSlots;			// 2のべき乗
+} EVENT_STORE;
+
+#define EVENT_KEY(onid, tsid, sid, eid)	((uint64_t)(onid)<<48 | (uint64_t)(tsid)<<32 | (uint64_t)(sid)<<16 | (eid))
+
+static uint32_t storeHash(uint64_t key)
+{
+	key ^= key>>33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key>>33;
+	return((uint32_t)key);
+}
+
+// ハッシュ表を作り直す grow:true の場合は倍の大きさにする
+static bool storeRehash(EVENT_STORE *store, bool grow)
+{
+	uint32_t numOfSlots = (store->numOfSlots==0) ? 1024 : store->numOfSlots*(grow ? 2 : 1);
+	uint32_t *slot;
+
+	if((slot = calloc(numOfSlots, sizeof(uint32_t)))==NULL){
+		return(false);
+	}
+	for(uint32_t i=0; i<store->numOfEvents; i++){
+		uint32_t h = storeHash(store->events[i].key) & (numOfSlots-1);
+		while(slot[h]!=0){
+			h = (h+1) & (numOfSlots-1);
+		}
+		slot[h] = i+1;
+	}
+	free(store->slot);
+	store->slot = slot;
+	store->numOfSlots = numOfSlots;
+	return(true);
+}
+
+// キーに対応するイベントを返す 未登録の場合は新規に確保する
+static STORE_EVENT *storeLookup(EVENT_STORE *store, uint64_t key, bool *found)
+{
+	uint32_t h;
+
+	// 使用率 3/4 を超えたら拡張する
+	if((store->numOfEvents+1)*4 > store->numOfSlots*3 && !storeRehash(store, true)){
+		return(NULL);
+	}
+	for(h=storeHash(key) & (store->numOfSlots-1); store->slot[h]!=0; h=(h+1) & (store->numOfSlots-1)){
+		if(store->events[store->slot[h]-1].key==key){
+			*found = true;
+			return(&store->events[store->slot[h]-1]);
+		}
+	}
+	if(store->numOfEvents==store->maxEvents){
+		uint32_t maxEvents = (store->maxEvents==0) ? 1024 : store->maxEvents*2;
+		STORE_EVENT *events = realloc(store->events, sizeof(STORE_EVENT)*maxEvents);
+		if(events==NULL){
+			return(NULL);
+		}
+		store->events = events;
+		store->maxEvents = maxEvents;
+	}
+	store->slot[h] = ++store->numOfEvents;
+	memset(&store->events[h=store->numOfEvents-1], '\0', sizeof(STORE_EVENT));
+	store->events[h].key = key;
+	*found = false;
+	return(&store->events[h]);
+}
+
+// 直前の storeLookup で追加したイベントを取り消す (data を設定できなかった場合)
+// 最後に追加したイベントは探索列の末尾にあるので空きに戻しても他の探索を妨げない
+static void storeCancel(EVENT_STORE *store, STORE_EVENT *se)
+{
+	uint32_t no = se-store->events+1;
+	uint32_t h;
+
+	for(h=storeHash(se->key) & (store->numOfSlots-1); store->slot[h]!=no; h=(h+1) & (store->numOfSlots-1)){
+	}
+	store->slot[h] = 0;
+	store->numOfEvents--;
+}
+
+// 登録済みイベントを置き換えるか判定する
+// 同じテーブルで version_number が新しい(5bit 周回を考慮)場合のみ置き換え
+// 同じバージョンや別テーブルの場合は先に登録した方(ファイル順で前)を残す
+static bool storeNewer(STORE_EVENT *old, STORE_EVENT *ev)
+{
+	uint8_t diff = (ev->versionNumber - old->versionNumber) & 0x1f;
+
+	return(old->tableId==ev->tableId && diff!=0 && diff<16);
+}
+
+// ev->data の所有権は store に移る (登録しなかった場合は解放する)
+// storeLookup は失敗時にイベントを追加しないので data==NULL のイベントは残らない
+static bool storePut(EVENT_STORE *store, STORE_EVENT *ev)
+{
+	bool found;
+	STORE_EVENT *se = storeLookup(store, ev->key, &found);
+
+	if(se==NULL){
+		fprintf(stderr, "event store memory allocation error\n");
+		free(ev->data);
+		return(false);
+	}
+	if(found){
+		if(!storeNewer(se, ev)){
+			free(ev->data);
+			return(true);
+		}
+		free(se->data);
+	}
+	*se = *ev;
+	return(true);
+}
+
+// 1イベントを登録する 同じ内容を何度も受信するので置き換えない場合はコピーしない
+static bool storeAdd(EVENT_STORE *store, EIT *eit, uint8_t *event, uint16_t length, uint32_t fileNo)
+{
+	STORE_EVENT ev;
+	bool found;
+	STORE_EVENT *se;
+
+	memset(&ev, '\0', sizeof(STORE_EVENT));
+	ev.key					= EVENT_KEY(eit->originalNetworkId, eit->transportStreamId, eit->serviceId, (event[0]<<8 | event[1]));
+	ev.originalNetworkId	= eit->originalNetworkId;
+	ev.transportStreamId	= eit->transportStreamId;
+	ev.serviceId			= eit->serviceId;
+	ev.tableId				= eit->tableId;
+	ev.versionNumber		= eit->versionNumber;
+	ev.fileNo				= fileNo;
+	ev.length				= length;
+
+	if((se = storeLookup(store, ev.key, &found))==NULL){
+		fprintf(stderr, "event store memory allocation error\n");
+		return(false);
+	}
+	if(found && !storeNewer(se, &ev)){
+		return(true);
+	}
+	if((ev.data = malloc(length))==NULL){
+		fprintf(stderr, "event store memory allocation error\n");
+		// 追加したイベントは data が無いので取り消す
+		if(!found){
+			storeCancel(store, se);
+		}
+		return(false);
+	}
+	memcpy(ev.data, event, length);
+	if(found){
+		free(se->data);
+	}
+	*se = ev;
+	return(true);
+}
+
+// src を dst に併合する src は空になる
+// ファイル順に併合すればスレッドの実行順に関係なく同じ結果となる
+static bool storeMerge(EVENT_STORE *dst, EVENT_STORE *src)
+{
+	bool rtn = true;
+
+	for(uint32_t i=0; i<src->numOfEvents; i++){
+		if(rtn){
+			rtn = storePut(dst, &src->events[i]);
+		}else{
+			free(src->events[i].data);
+		}
+	}
+	free(src->events);
+	free(src->slot);
+	memset(src, '\0', sizeof(EVENT_STORE));
+	return(rtn);
+}
+
+// イベントの開始時間 (未定義は最後)
+static uint64_t storeStartTime(STORE_EVENT *se)
+{
+	return((uint64_t)se->data[2]<<32 | (uint64_t)se->data[3]<<24 | se->data[4]<<16 | se->data[5]<<8 | se->data[6]);
+}
+
+static int storeCompare(const void *a, const void *b)
+{
+	const STORE_EVENT *x = a, *y = b;
+	uint64_t xs, ys;
+
+	if((x->key>>16)!=(y->key>>16)){
+		return((x->key>>16 < y->key>>16) ? -1 : 1);
+	}
+	// MJD+BCD なのでそのまま大小比較できる
+	xs = storeStartTime((STORE_EVENT *)x);
+	ys = storeStartTime((STORE_EVENT *)y);
+	if(xs!=ys){
+		return((xs<ys) ? -1 : 1);
+	}
+	return((x->key<y->key) ? -1 : (x->key>y->key));
+}
+
+// onid, tsid, sid, 開始時間 順に並べる
+static bool storeSort(EVENT_STORE *store)
+{
+	qsort(store->events, store->numOfEvents, sizeof(STORE_EVENT), storeCompare);
+	return(store->numOfSlots==0 || storeRehash(store, false));
+}
+
+// 保持したイベントから EIT ヘッダとイベント情報を作り直す
+static void storeEvent(STORE_EVENT *se, EIT *eit, EitDescriptor *edesc)
+{
+	memset(eit, '\0', sizeof(EIT));
+	eit->tableId			= se->tableId;
+	eit->versionNumber		= se->versionNumber;
+	eit->serviceId			= se->serviceId;
+	eit->transportStreamId	= se->transportStreamId;
+	eit->originalNetworkId	= se->originalNetworkId;
+	EitDescriptor_set(se->data, edesc);
+}
+
+static void storeFree(EVENT_STORE *store)
+{
+	for(uint32_t i=0; i<store->numOfEvents; i++){
+		free(store->events[i].data);
+	}
+	free(store->events);
+	free(store->slot);
+	memset(store, '\0', sizeof(EVENT_STORE));
+}
+
+// UTF-8 を1文字読み出して検索用に正規化する
+// 全角英数記号は半角に、英大文字は小文字にする 空白・制御文字は0を返す(bigramの区切り)
+static uint32_t nextSearchChar(const uint8_t **pp, const uint8_t *end)
+{
+	const uint8_t *p = *pp;
+	uint32_t c;
+	int n;
+
+	if(*p<0x80){
+		c = *p; n = 1;
+	}else if((*p & 0xe0)==0xc0){
+		c = *p & 0x1f; n = 2;
+	}else if((*p & 0xf0)==0xe0){
+		c = *p & 0x0f; n = 3;
+	}else if((*p & 0xf8)==0xf0){
+		c = *p & 0x07; n = 4;
+	}else{
+		*pp = p+1;
+		return(0);
+	}
+	if(p+n>end){
+		*pp = end;
+		return(0);
+	}
+	for(int i=1; i<n; i++){
+		c = c<<6 | (p[i] & 0x3f);
+	}
+	*pp = p+n;
+
+	if(c>=0xff01 && c<=0xff5e){
+		c -= 0xfee0;
+	}
+	if(c>='A' && c<='Z'){
+		c += 'a'-'A';
+	}
+	if(c<=0x20 || c==0x3000 || c==0x7f){
+		return(0);
+	}
+	return(c);
+}
+
+// 正規化した文字列をUCS4配列にする 区切りは0 戻値は文字数
+static size_t searchChars(const uint8_t *s, size_t len, uint32_t **out)
+{
+	const uint8_t *p = s, *end = s+len;
+	size_t n = 0;
+
+	if((*out = malloc(sizeof(uint32_t)*(len+1)))==NULL){
+		return(0);
+	}
+	while(p<end){
+		(*out)[n++] = nextSearchChar(&p, end);
+	}
+	return(n);
+}
+
+typedef struct {
+	uint64_t	key;
+	uint32_t	event;
+} INDEX_POSTING;
+
+static int postingCompare(const void *a, const void *b)
+{
+	const INDEX_POSTING *x = a, *y = b;
+
+	if(x->key!=y->key){
+		return((x->key<y->key) ? -1 : 1);
+	}
+	return((x->event<y->event) ? -1 : (x->event>y->event));
+}
+
+// 文字列のbigramを追加する
+static bool addPostings(INDEX_POSTING **post, size_t *num, size_t *max, const uint8_t *utf8, uint32_t event)
+{
+	uint32_t *chars;
+	size_t n;
+
+	if(utf8==NULL){
+		return(true);
+	}
+	n = searchChars(utf8, strlen((char *)utf8), &chars);
+	if(*num+n > *max){
+		size_t m = (*max==0) ? 65536 : *max;
+		while(m < *num+n){
+			m *= 2;
+		}
+		INDEX_POSTING *p = realloc(*post, sizeof(INDEX_POSTING)*m);
+		if(p==NULL){
+			free(chars);
+			return(false);
+		}
+		*post = p;
+		*max = m;
+	}
+	for(size_t i=0; i<n; i++){
+		if(chars[i]==0){
+			continue;
+		}
+		(*post)[*num].key	= (uint64_t)chars[i]<<32 | ((i+1<n) ? chars[i+1] : 0);
+		(*post)[*num].event	= event;
+		(*num)++;
+	}
+	free(chars);
+	return(true);
+}
+
+// 検索対象の番組記述 短形式の番組記述に拡張形式の 項目名:項目記述 を空白区切りで連結する
+// 戻値は malloc した文字列 NULL:メモリ不足
+static char *indexDescription(ARIB_CACHE *cache, EPG_EVENT *ev)
+{
+	const uint8_t *text = aribCacheUtf8(cache, ev->text.ptr, ev->text.len, NULL);
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out;
+
+	if((out = open_memstream(&buf, &size))==NULL){
+		return(NULL);
+	}
+	if(text!=NULL){
+		printFieldText(out, text);
+	}
+	if(ev->numOfItems>0){
+		if(text!=NULL && *text!='\0'){
+			putc_unlocked(' ', out);
+		}
+		printFieldExtended(out, cache, ev);
+	}
+	if(fclose(out)!=0){
+		free(buf);
+		return(NULL);
+	}
+	return(buf);
+}
+
+static bool writeIndex(EVENT_STORE *store, char *file)
+{
+	INDEX_HEADER header;
+	INDEX_POSTING *post = NULL;
+	size_t numOfPost = 0, maxPost = 0;
+	uint32_t numOfKeys = 0, numOfPostings = 0, textSize = 0;
+	INDEX_EVENT *events;
+	const uint8_t **title;
+	char **text;						// 番組記述+拡張形式の項目 各々 malloc
+	ARIB_CACHE *cache;
+	FILE *fp;
+	bool rtn = true;
+	static const uint8_t pad[8];
+
+	events = calloc(store->numOfEvents+1, sizeof(INDEX_EVENT));
+	title = calloc(store->numOfEvents+1, sizeof(uint8_t *));
+	text = calloc(store->numOfEvents+1, sizeof(char *));
+	cache = aribCacheNew();
+	if(events==NULL || title==NULL || text==NULL || cache==NULL){
+		rtn = false;
+	}
+
+	// 番組名・番組記述・拡張形式の項目だけをUTF-8に変換する
+	// 同じ番組名・番組記述・項目名は変換結果をキャッシュで共有する
+	for(uint32_t i=0; i<store->numOfEvents && rtn; i++){
+		STORE_EVENT *se = &store->events[i];
+		EIT eit;
+		EitDescriptor edesc;
+		EPG_EVENT ev;
+
+		storeEvent(se, &eit, &edesc);
+		collectEvent(&eit, &edesc, 1U<<FIELD_TITLE | 1U<<FIELD_TEXT | 1U<<FIELD_EXTENDED, &ev);
+		events[i].originalNetworkId	= se->originalNetworkId;
+		events[i].transportStreamId	= se->transportStreamId;
+		events[i].serviceId			= se->serviceId;
+		events[i].eventId			= edesc.eventId;
+		events[i].start				= (edesc.startTime==0xffffffffffULL) ? INT64_MIN : epochTime(edesc.startTime);
+		events[i].duration			= (edesc.duration==0xffffff) ? -1 : durationSec(edesc.duration);
+		events[i].tableId			= se->tableId;
+		events[i].versionNumber		= se->versionNumber;
+		title[i]					= aribCacheUtf8(cache, ev.title.ptr, ev.title.len, NULL);
+		text[i]						= indexDescription(cache, &ev);
+
+		rtn = text[i]!=NULL
+			&& addPostings(&post, &numOfPost, &maxPost, title[i], i)
+			&& addPostings(&post, &numOfPost, &maxPost, (uint8_t *)text[i], i);
+	}
+	if(!rtn){
+		fprintf(stderr, "index memory allocation error\n");
+		goto END;
+	}
+	qsort(post, numOfPost, sizeof(INDEX_POSTING), postingCompare);
+
+	// 同一キー同一イベントをまとめる
+	for(size_t i=0; i<numOfPost; i++){
+		if(i==0 || post[i].key!=post[i-1].key){
+			numOfKeys++;
+		}else if(post[i].event==post[i-1].event){
+			continue;
+		}
+		post[numOfPostings++] = post[i];
+	}
+
+	for(uint32_t i=0; i<store->numOfEvents; i++){
+		events[i].titleOffset	= textSize;
+		events[i].titleLength	= (title[i]==NULL) ? 0 : strlen((char *)title[i]);
+		textSize += events[i].titleLength;
+		events[i].textOffset	= textSize;
+		events[i].textLength	= strlen(text[i]);
+		textSize += events[i].textLength;
+	}
+
+	if((fp=fopen(file,"w"))==NULL){
+		fprintf(stderr, "file open error : %s\n", file);
+		rtn = false;
+		goto END;
+	}
+	memset(&header, '\0', sizeof(INDEX_HEADER));
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.numOfEvents		= store->numOfEvents;
+	header.numOfKeys		= numOfKeys;
+	header.numOfPostings	= numOfPostings;
+	header.textSize			= textSize;
+	fwrite(&header, sizeof(INDEX_HEADER), 1, fp);
+
+	fwrite(events, sizeof(INDEX_EVENT), store->numOfEvents, fp);
+	for(uint32_t i=0, offset=0; i<numOfPostings; ){
+		INDEX_KEY key;
+		key.key		= post[i].key;
+		key.offset	= offset;
+		for(key.count=0; i<numOfPostings && post[i].key==key.key; i++){
+			key.count++;
+		}
+		offset += key.count;
+		fwrite(&key, sizeof(INDEX_KEY), 1, fp);
+	}
+	for(uint32_t i=0; i<numOfPostings; i++){
+		fwrite(&post[i].event, sizeof(uint32_t), 1, fp);
+	}
+	fwrite(pad, INDEX_ALIGN(numOfPostings*sizeof(uint32_t)) - numOfPostings*sizeof(uint32_t), 1, fp);
+	for(uint32_t i=0; i<store->numOfEvents; i++){
+		fwrite(title[i], events[i].titleLength, 1, fp);
+		fwrite(text[i], events[i].textLength, 1, fp);
+	}
+	if(ferror(fp)){
+		fprintf(stderr, "file write error : %s\n", file);
+		rtn = false;
+	}
+	fclose(fp);
+
+	fprintf(stderr, "index %s : events %" PRIu32 " keys %" PRIu32 " postings %" PRIu32 " text %" PRIu32 "byte\n",
+		file, store->numOfEvents, numOfKeys, numOfPostings, textSize);
+END:
+	aribCacheFree(cache);
+	free(title);
+	for(uint32_t i=0; i<store->numOfEvents && text!=NULL; i++){
+		free(text[i]);
+	}
+	free(text);
+	free(events);
+	free(post);
+	return(rtn);
+}
+
+// mmap したインデックス
+typedef struct {
+	uint8_t			*map;
+	size_t			size;
+	INDEX_HEADER	*header;
+	INDEX_EVENT		*events;
+	INDEX_KEY		*keys;
+	uint32_t		*postings;
+	uint8_t			*text;
+} INDEX_MAP;
+
+// 検索時に範囲を確認しなくて済むよう、文字列・転置リストの参照が全て領域内にあることを確認する
+static bool checkIndex(INDEX_MAP *idx)
+{
+	INDEX_HEADER *h = idx->header;
+
+	for(uint32_t i=0; i<h->numOfEvents; i++){
+		INDEX_EVENT *e = &idx->events[i];
+		if((uint64_t)e->titleOffset+e->titleLength>h->textSize || (uint64_t)e->textOffset+e->textLength>h->textSize){
+			return(false);
+		}
+	}
+	for(uint32_t k=0; k<h->numOfKeys; k++){
+		// 1キーの転置リストはイベント番号昇順で重複しないので numOfEvents 以下
+		if((uint64_t)idx->keys[k].offset+idx->keys[k].count>h->numOfPostings || idx->keys[k].count>h->numOfEvents){
+			return(false);
+		}
+	}
+	for(uint32_t i=0; i<h->numOfPostings; i++){
+		if(idx->postings[i]>=h->numOfEvents){
+			return(false);
+		}
+	}
+	return(true);
+}
+
+static bool openIndex(char *file, INDEX_MAP *idx)
+{
+	struct stat st;
+	size_t offset;
+	int fd;
+
+	memset(idx, '\0', sizeof(INDEX_MAP));
+	if((fd=open(file, O_RDONLY))<0){
+		fprintf(stderr, "file open error : %s\n", file);
+		return(false);
+	}
+	if(fstat(fd, &st)<0 || (size_t)st.st_size<sizeof(INDEX_HEADER)){
+		fprintf(stderr, "index file error : %s\n", file);
+		close(fd);
+		return(false);
+	}
+	idx->size = st.st_size;
+	idx->map = mmap(NULL, idx->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(idx->map==MAP_FAILED){
+		fprintf(stderr, "mmap error : %s\n", file);
+		return(false);
+	}
+
+	idx->header = (INDEX_HEADER *)idx->map;
+	offset = INDEX_ALIGN(sizeof(INDEX_HEADER));
+	idx->events = (INDEX_EVENT *)(idx->map+offset);
+	offset += INDEX_ALIGN(sizeof(INDEX_EVENT)*(size_t)idx->header->numOfEvents);
+	idx->keys = (INDEX_KEY *)(idx->map+offset);
+	offset += INDEX_ALIGN(sizeof(INDEX_KEY)*(size_t)idx->header->numOfKeys);
+	idx->postings = (uint32_t *)(idx->map+offset);
+	offset += INDEX_ALIGN(sizeof(uint32_t)*(size_t)idx->header->numOfPostings);
+	idx->text = idx->map+offset;
+	offset += idx->header->textSize;
+
+	if(memcmp(idx->header->magic, INDEX_MAGIC, sizeof(idx->header->magic)) || offset!=idx->size || !checkIndex(idx)){
+		fprintf(stderr, "index file format error : %s\n", file);
+		munmap(idx->map, idx->size);
+		return(false);
+	}
+	return(true);
+}
+
+// key 以上の最初のキー位置を返す
+static uint32_t lowerKey(INDEX_MAP *idx, uint64_t key)
+{
+	uint32_t lo = 0, hi = idx->header->numOfKeys;
+
+	while(lo<hi){
+		uint32_t mid = lo + (hi-lo)/2;
+		if(idx->keys[mid].key<key){
+			lo = mid+1;
+		}else{
+			hi = mid;
+		}
+	}
+	return(lo);
+}
+
+// 検索語1つの候補イベント(昇順)を求める
+// 1文字の場合は1文字目が一致するキーを全て併合し、2文字以上は全bigramの積集合とする
+static uint32_t termCandidates(INDEX_MAP *idx, uint32_t *chars, size_t n, uint32_t *out)
+{
+	uint32_t num = 0;
+
+	if(n==1){
+		uint8_t *mark = calloc(idx->header->numOfEvents, 1);
+		if(mark==NULL){
+			return(0);
+		}
+		for(uint32_t k=lowerKey(idx, (uint64_t)chars[0]<<32); k<idx->header->numOfKeys && (idx->keys[k].key>>32)==chars[0]; k++){
+			for(uint32_t j=0; j<idx->keys[k].count; j++){
+				mark[idx->postings[idx->keys[k].offset+j]] = 1;
+			}
+		}
+		for(uint32_t e=0; e<idx->header->numOfEvents; e++){
+			if(mark[e]){
+				out[num++] = e;
+			}
+		}
+		free(mark);
+		return(num);
+	}
+
+	for(size_t i=0; i+1<n; i++){
+		uint64_t key = (uint64_t)chars[i]<<32 | chars[i+1];
+		uint32_t k = lowerKey(idx, key);
+		uint32_t *p, count, merged = 0;
+
+		if(k>=idx->header->numOfKeys || idx->keys[k].key!=key){
+			return(0);
+		}
+		p = idx->postings+idx->keys[k].offset;
+		count = idx->keys[k].count;
+		if(i==0){
+			memcpy(out, p, sizeof(uint32_t)*count);
+			num = count;
+			continue;
+		}
+		for(uint32_t a=0, b=0; a<num && b<count; ){
+			if(out[a]<p[b]){
+				a++;
+			}else if(out[a]>p[b]){
+				b++;
+			}else{
+				out[merged++] = out[a];
+				a++; b++;
+			}
+		}
+		num = merged;
+		if(num==0){
+			break;
+		}
+	}
+	return(num);
+}
+
+// bigramの並び順までは保持していないので正規化した文字列で検索語を照合する
+static bool matchText(uint8_t *utf8, uint32_t len, uint32_t *term, size_t n)
+{
+	uint32_t *chars;
+	size_t num = searchChars(utf8, len, &chars);
+	bool rtn = false;
+
+	for(size_t i=0; i+n<=num && !rtn; i++){
+		rtn = !memcmp(chars+i, term, sizeof(uint32_t)*n);
+	}
+	free(chars);
+	return(rtn);
+}
+
+// 空白区切りの検索語を全て含むイベントを出力する
+// 区切り文字(TAB)と改行を空白に置き換えて出力する (--fields と同じ)
+static void printIndexText(const uint8_t *utf8, uint32_t len)
+{
+	for(uint32_t i=0; i<len; i++){
+		fputc((utf8[i]=='\t' || utf8[i]=='\n' || utf8[i]=='\r') ? ' ' : utf8[i], stdout);
+	}
+}
+
+static int queryIndex(char *file, char *query)
+{
+	INDEX_MAP idx;
+	uint32_t *result = NULL, *cand = NULL, numOfResult = 0;
+	uint32_t *terms = NULL;
+	size_t numOfChars;
+	struct timespec t0, t1;
+	int rtn = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(!openIndex(file, &idx)){
+		return(-1);
+	}
+	numOfChars = searchChars((uint8_t *)query, strlen(query), &terms);
+	result = malloc(sizeof(uint32_t)*(idx.header->numOfEvents+1));
+	cand = malloc(sizeof(uint32_t)*(idx.header->numOfEvents+1));
+	if(terms==NULL || result==NULL || cand==NULL){
+		fprintf(stderr, "query memory allocation error\n");
+		rtn = -1;
+		goto END;
+	}
+
+	bool first = true;
+	for(size_t i=0; i<numOfChars; ){
+		size_t n;
+		uint32_t num, hit = 0, merged = 0;
+
+		if(terms[i]==0){
+			i++;
+			continue;
+		}
+		for(n=0; i+n<numOfChars && terms[i+n]!=0; n++){
+			;
+		}
+		num = termCandidates(&idx, terms+i, n, cand);
+		for(uint32_t c=0; c<num; c++){
+			INDEX_EVENT *e = &idx.events[cand[c]];
+			if(n==1 || matchText(idx.text+e->titleOffset, e->titleLength, terms+i, n)
+					|| matchText(idx.text+e->textOffset, e->textLength, terms+i, n)){
+				cand[hit++] = cand[c];
+			}
+		}
+		if(first){
+			memcpy(result, cand, sizeof(uint32_t)*hit);
+			numOfResult = hit;
+			first = false;
+		}else{
+			// 前の検索語の結果との積集合 (どちらも昇順)
+			for(uint32_t a=0, b=0; a<numOfResult && b<hit; ){
+				if(result[a]<cand[b]){
+					a++;
+				}else if(result[a]>cand[b]){
+					b++;
+				}else{
+					result[merged++] = result[a];
+					a++; b++;
+				}
+			}
+			numOfResult = merged;
+		}
+		i += n;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stdout, "#onid\ttsid\tsid\tevent_id\tstart\tduration\ttitle\ttext\n");
+	for(uint32_t r=0; r<numOfResult; r++){
+		INDEX_EVENT *e = &idx.events[result[r]];
+		fprintf(stdout, "%" PRIu16 "\t%" PRIu16 "\t%" PRIu16 "\t%" PRIu16 "\t",
+			e->originalNetworkId, e->transportStreamId, e->serviceId, e->eventId);
+		if(e->start==INT64_MIN){
+			fputc('-', stdout);
+		}else{
+			struct tm t;
+			time_t jst = e->start + JST_OFFSET;
+			gmtime_r(&jst, &t);
+			fprintf(stdout, "%04d/%02d/%02d %02d:%02d:%02d", t.tm_year+1900, t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+		}
+		if(e->duration<0){
+			fprintf(stdout, "\t-\t");
+		}else{
+			fprintf(stdout, "\t%02" PRId32 ":%02" PRId32 ":%02" PRId32 "\t", e->duration/3600, e->duration/60%60, e->duration%60);
+		}
+		printIndexText(idx.text+e->titleOffset, e->titleLength);
+		fputc('\t', stdout);
+		printIndexText(idx.text+e->textOffset, e->textLength);
+		fputc('\n', stdout);
+	}
+	fprintf(stderr, "query \"%s\" : %" PRIu32 " events (index events %" PRIu32 " keys %" PRIu32 ") %.3fms\n",
+		query, numOfResult, idx.header->numOfEvents, idx.header->numOfKeys,
+		(t1.tv_sec-t0.tv_sec)*1000.0 + (t1.tv_nsec-t0.tv_nsec)/1000000.0);
+
+END:
+	free(terms);
+	free(result);
+	free(cand);
+	munmap(idx.map, idx.size);
+	return(rtn);
+}
+
+/****************************************************************/
+/* --report 番組表の受信完了状況                                */
+/* セクションヘッダだけを読み (sid, table_id, segment) 毎に     */
+/* 受信済みsection_numberのビットマップを作り                   */
+/* last_section_number / segment_last_section_number /          */
+/* last_table_id から期待されるセクションと比較する             */
+/* 記述子は読まない                                             */
+/* 受信時刻は PID 0x14 の TDT/TOT から求める                    */
+/****************************************************************/
+#define REPORT_TABLES	(0x6f - 0x4e + 1)		// table_id 0x4E-0x6F
+#define REPORT_NO_TIME	INT64_MIN
+
+typedef struct {
+	bool		valid;
+	uint8_t		versionNumber;
+	uint8_t		lastSectionNumber;
+	uint8_t		lastTableId;
+	uint8_t		segmentLast[32];				// segment毎の segment_last_section_number (受信したsegmentのみ有効)
+	uint8_t		received[32];					// section_number 0-255 の受信ビットマップ
+	uint32_t	numOfReceived;
+	uint64_t	completePacket;					// 全セクション受信したパケット番号 0:未完了
+	int64_t		completeTime;					// その時点の TDT/TOT 時刻
+} REPORT_TABLE;
+
+typedef struct {
+	uint16_t		originalNetworkId;
+	uint16_t		transportStreamId;
+	uint16_t		serviceId;
+	REPORT_TABLE	table[REPORT_TABLES];
+} REPORT_SERVICE;
+
+typedef struct {
+	REPORT_SERVICE	*service;
+	uint32_t		numOfServices;
+	uint32_t		maxServices;
+	uint64_t		packets;					// 読んだパケット数
+	uint64_t		sections;					// 読んだEITセクション数
+	int64_t			firstTime;					// 最初の TDT/TOT 時刻
+	int64_t			lastTime;					// 最新の TDT/TOT 時刻
+} REPORT;
+
+// PID単位のセクション組み立て
+// 1パケットに複数セクションがある場合やアダプテーションフィールド付きも扱う
+typedef struct {
+	uint16_t	pid;
+	bool		sync;							// セクション先頭から受信中
+	int8_t		continuityCounter;
+	size_t		len;
+	uint8_t		buf[4096+TS_PACKETSIZE];
+} SECTION_ASSEMBLER;
+
+typedef void (*SECTION_CALLBACK)(void *ctx, uint8_t *section, size_t len);
+
+static void sectionEmit(SECTION_ASSEMBLER *sa, SECTION_CALLBACK cb, void *ctx)
+{
+	size_t done = 0;
+
+	while(sa->len-done>=3){
+		uint8_t *sec = sa->buf+done;
+		size_t secLen = 3 + ((sec[1]&0x0f)<<8 | sec[2]);
+		// 0xFF はスタッフィング 以降このパケットにセクションは無い
+		if(sec[0]==0xff){
+			done = sa->len;
+			sa->sync = false;
+			break;
+		}
+		if(sa->len-done<secLen){
+			break;
+		}
+		cb(ctx, sec, secLen);
+		done += secLen;
+	}
+	if(done>0){
+		memmove(sa->buf, sa->buf+done, sa->len-done);
+		sa->len -= done;
+	}
+}
+
+static void sectionFeed(SECTION_ASSEMBLER *sa, uint8_t *packet, SECTION_CALLBACK cb, void *ctx)
+{
+	uint8_t afc = packet[3]>>4 & 0x03;
+	int8_t cc = packet[3] & 0x0f;
+	size_t offset = 4;
+
+	if(!(afc & 0b01)){
+		return;
+	}
+	if(afc & 0b10){
+		offset += 1+packet[4];
+	}
+	if(offset>=TS_PACKETSIZE){
+		sa->sync = false;
+		sa->len = 0;
+		return;
+	}
+	// 連続性指標が飛んだら組み立て中のセクションは破棄する
+	if(sa->continuityCounter>=0 && cc==sa->continuityCounter){
+		return;
+	}
+	if(sa->continuityCounter>=0 && cc!=((sa->continuityCounter+1) & 0x0f)){
+		sa->sync = false;
+		sa->len = 0;
+	}
+	sa->continuityCounter = cc;
+
+	if(packet[1] & 0x40){
+		size_t pointer = packet[offset++];
+		if(offset+pointer>TS_PACKETSIZE){
+			sa->sync = false;
+			sa->len = 0;
+			return;
+		}
+		// ポインタフィールドまでは前のセクションの続き
+		if(sa->sync && pointer>0){
+			memcpy(sa->buf+sa->len, packet+offset, pointer);
+			sa->len += pointer;
+			sectionEmit(sa, cb, ctx);
+		}
+		sa->sync = true;
+		sa->len = 0;
+		offset += pointer;
+	}else if(!sa->sync){
+		return;
+	}
+	if(sa->len+TS_PACKETSIZE-offset > sizeof(sa->buf)){
+		sa->sync = false;
+		sa->len = 0;
+		return;
+	}
+	memcpy(sa->buf+sa->len, packet+offset, TS_PACKETSIZE-offset);
+	sa->len += TS_PACKETSIZE-offset;
+	sectionEmit(sa, cb, ctx);
+}
+
+// TDT(0x70)/TOT(0x73) JST_time
+static void reportTime(void *ctx, uint8_t *section, size_t len)
+{
+	REPORT *rep = ctx;
+
+	if((section[0]==0x70 || section[0]==0x73) && len>=8){
+		uint64_t jst = (uint64_t)section[3]<<32 | (uint64_t)section[4]<<24 | section[5]<<16 | section[6]<<8 | section[7];
+		rep->lastTime = epochTime(jst);
+		if(rep->firstTime==REPORT_NO_TIME){
+			rep->firstTime = rep->lastTime;
+		}
+	}
+}
+
+static REPORT_SERVICE *reportService(REPORT *rep, EIT *eit)
+{
+	for(uint32_t i=0; i<rep->numOfServices; i++){
+		REPORT_SERVICE *s = &rep->service[i];
+		if(s->serviceId==eit->serviceId && s->transportStreamId==eit->transportStreamId && s->originalNetworkId==eit->originalNetworkId){
+			return(s);
+		}
+	}
+	if(rep->numOfServices==rep->maxServices){
+		uint32_t maxServices = (rep->maxServices==0) ? 64 : rep->maxServices*2;
+		REPORT_SERVICE *service = realloc(rep->service, sizeof(REPORT_SERVICE)*maxServices);
+		if(service==NULL){
+			return(NULL);
+		}
+		rep->service = service;
+		rep->maxServices = maxServices;
+	}
+	REPORT_SERVICE *s = &rep->service[rep->numOfServices++];
+	memset(s, '\0', sizeof(REPORT_SERVICE));
+	s->originalNetworkId	= eit->originalNetworkId;
+	s->transportStreamId	= eit->transportStreamId;
+	s->serviceId			= eit->serviceId;
+	return(s);
+}
+
+// 期待されるセクション数 受信していないsegmentは1セクション以上あるものとして数える
+static uint32_t expectedSections(REPORT_TABLE *t, uint8_t segment)
+{
+	uint8_t first = segment*8;
+
+	if(first>t->lastSectionNumber){
+		return(0);
+	}
+	if(t->received[segment]==0 || t->segmentLast[segment]<first){
+		return(1);
+	}
+	return(t->segmentLast[segment]-first+1);
+}
+
+static uint32_t receivedSections(REPORT_TABLE *t, uint8_t segment)
+{
+	uint32_t n = 0;
+	for(int i=0; i<8; i++){
+		n += t->received[segment] >> i & 1;
+	}
+	return(n);
+}
+
+static bool tableComplete(REPORT_TABLE *t)
+{
+	for(int segment=0; segment<32; segment++){
+		if(receivedSections(t, segment) < expectedSections(t, segment)){
+			return(false);
+		}
+	}
+	return(true);
+}
+
+static void reportSection(void *ctx, uint8_t *section, size_t len)
+{
+	REPORT *rep = ctx;
+	REPORT_SERVICE *s;
+	REPORT_TABLE *t;
+	EIT eit;
+
+	if(section[0]<0x4e || section[0]>0x6f || len<3+11+4){
+		return;
+	}
+	EIT_set(section, &eit);
+	if(eit.sectionLength+3!=len || (s = reportService(rep, &eit))==NULL){
+		return;
+	}
+	rep->sections++;
+
+	// バージョンが変わったら受信状況をやり直す
+	t = &s->table[eit.tableId-0x4e];
+	if(!t->valid || t->versionNumber!=eit.versionNumber){
+		memset(t, '\0', sizeof(REPORT_TABLE));
+		t->valid			= true;
+		t->versionNumber	= eit.versionNumber;
+	}
+	t->lastSectionNumber	= eit.lastSectionNumber;
+	t->lastTableId			= eit.lastTableId;
+	// p/f は segment の概念が無いので last_section_number までを1segmentとする
+	if(eit.tableId<0x50){
+		t->segmentLast[0]	= eit.lastSectionNumber;
+	}else{
+		t->segmentLast[eit.sectionNumber>>3]	= eit.segmentLastSectionNumber;
+	}
+	if(t->received[eit.sectionNumber>>3] & 1<<(eit.sectionNumber&7)){
+		return;
+	}
+	t->received[eit.sectionNumber>>3] |= 1<<(eit.sectionNumber&7);
+	t->numOfReceived++;
+	if(t->completePacket==0 && tableComplete(t)){
+		t->completePacket	= rep->packets;
+		t->completeTime		= rep->lastTime;
+	}
+}
+
+static void printReportTime(REPORT *rep, uint64_t packet, int64_t time)
+{
+	if(time!=REPORT_NO_TIME && rep->firstTime!=REPORT_NO_TIME){
+		fprintf(stdout, "+%" PRId64 "s", time - rep->firstTime);
+	}else{
+		fprintf(stdout, "packet %" PRIu64 " (%.1fMB)", packet, packet*(double)TS_PACKETSIZE/(1024*1024));
+	}
+}
+
+static void printReport(REPORT *rep, uint16_t sid)
+{
+	uint32_t numOfTables = 0, numOfComplete = 0;
+	uint64_t lastPacket = 0;
+	int64_t lastTime = REPORT_NO_TIME;
+
+	for(uint32_t i=0; i<rep->numOfServices; i++){
+		REPORT_SERVICE *s = &rep->service[i];
+		if(sid!=0xffff && sid!=s->serviceId){
+			continue;
+		}
+		fprintf(stdout, "service onid %" PRIu16 " tsid %" PRIu16 " sid %" PRIu16 "\n",
+			s->originalNetworkId, s->transportStreamId, s->serviceId);
+
+		for(int tid=0x4e; tid<=0x6f; tid++){
+			REPORT_TABLE *t = &s->table[tid-0x4e];
+			// last_table_id から期待されるが未受信のテーブル
+			if(!t->valid){
+				bool expected = false;
+				for(int base=(tid<0x60 ? 0x50 : 0x60); base<tid && tid>=0x50; base++){
+					REPORT_TABLE *b = &s->table[base-0x4e];
+					if(b->valid && b->lastTableId>=tid){
+						expected = true;
+						break;
+					}
+				}
+				if(expected){
+					numOfTables++;
+					fprintf(stdout, "\ttable %02x : not received\n", tid);
+				}
+				continue;
+			}
+
+			uint32_t expected = 0;
+			for(int segment=0; segment<32; segment++){
+				expected += expectedSections(t, segment);
+			}
+			numOfTables++;
+			fprintf(stdout, "\ttable %02x version %2" PRIu8 " : sections %3" PRIu32 "/%3" PRIu32 " ",
+				tid, t->versionNumber, t->numOfReceived, expected);
+			if(t->completePacket!=0){
+				numOfComplete++;
+				fprintf(stdout, "complete at ");
+				printReportTime(rep, t->completePacket, t->completeTime);
+				fputc('\n', stdout);
+				if(t->completePacket>lastPacket){
+					lastPacket	= t->completePacket;
+					lastTime	= t->completeTime;
+				}
+				continue;
+			}
+			fprintf(stdout, "missing segment");
+			for(int segment=0; segment<32; segment++){
+				uint32_t e = expectedSections(t, segment), r = receivedSections(t, segment);
+				if(r>=e){
+					continue;
+				}
+				if(tid<0x50){
+					fprintf(stdout, " p/f(%" PRIu32 "/%" PRIu32 ")", r, e);
+				}else{
+					// 1日目0時からの3時間単位 segment
+					int g = (tid&0x07)*32 + segment;
+					fprintf(stdout, " day%d/%02dh", g/8+1, g%8*3);
+					if(r>0){
+						fprintf(stdout, "(%" PRIu32 "/%" PRIu32 ")", r, e);
+					}
+				}
+			}
+			fputc('\n', stdout);
+		}
+	}
+
+	fprintf(stdout, "packets %" PRIu64 " eit sections %" PRIu64 " tables %" PRIu32 " complete %" PRIu32 "\n",
+		rep->packets, rep->sections, numOfTables, numOfComplete);
+	if(rep->firstTime!=REPORT_NO_TIME){
+		fprintf(stdout, "capture time %" PRId64 "s\n", rep->lastTime - rep->firstTime);
+	}
+	if(numOfTables>0 && numOfComplete==numOfTables){
+		fprintf(stdout, "all tables complete at ");
+		printReportTime(rep, lastPacket, lastTime);
+		fputc('\n', stdout);
+	}else{
+		fprintf(stdout, "incomplete\n");
+	}
+}
+
+// TSを1回読んで EIT PID と TDT/TOT PID のセクションを組み立てる
+static int reportScan(FILE *fp, ARG_PARAM *param)
+{
+	SECTION_ASSEMBLER *eitAsm, *timeAsm;
+	REPORT rep;
+	uint8_t packet[TS_PACKETSIZE];
+
+	eitAsm = calloc(1, sizeof(SECTION_ASSEMBLER));
+	timeAsm = calloc(1, sizeof(SECTION_ASSEMBLER));
+	if(eitAsm==NULL || timeAsm==NULL){
+		free(eitAsm);
+		free(timeAsm);
+		return(-1);
+	}
+	eitAsm->pid = param->pid;
+	eitAsm->continuityCounter = -1;
+	timeAsm->pid = 0x14;
+	timeAsm->continuityCounter = -1;
+	memset(&rep, '\0', sizeof(REPORT));
+	rep.firstTime = rep.lastTime = REPORT_NO_TIME;
+
+	while(fread(packet, TS_PACKETSIZE, 1, fp)==1){
+		uint16_t pid = (packet[1] & 0x1f)<<8 | packet[2];
+		if(packet[0]!=0x47){
+			break;
+		}
+		rep.packets++;
+		if(pid==eitAsm->pid){
+			sectionFeed(eitAsm, packet, reportSection, &rep);
+		}else if(pid==timeAsm->pid){
+			sectionFeed(timeAsm, packet, reportTime, &rep);
+		}
+	}
+
+	printReport(&rep, param->sid);
+	free(rep.service);
+	free(eitAsm);
+	free(timeAsm);
+	return(0);
+}
+
+/****************************************************************/
+/* 複数ファイル一括処理                                         */
+/* ファイル単位にワーカースレッドへ割り当て、各スレッドは       */
+/* イベントのバイト列をファイル毎の EVENT_STORE にコピーする    */
+/* 文字コード変換は併合後に1イベント1回だけ行う                 */
+/* 全スレッド終了後にファイル指定順に併合するので               */
+/* 同じ入力からは常に同じ結果となる                             */
+/****************************************************************/
+typedef struct {
+	ARG_PARAM		*param;
+	EVENT_STORE		*stores;			// ファイル毎
+	uint32_t		next;				// 次に処理するファイル番号
+	bool			failed;				// 読めなかったファイルがある
+	pthread_mutex_t	lock;
+} BATCH;
+
+// 1ファイル分のイベントを store に登録する
+static bool scanFile(ARG_PARAM *param, uint32_t fileNo, EVENT_STORE *store)
+{
+	uint8_t payload[MAX_PAYLOAD];
+	size_t	payload_len;
+	FILE *fp;
+	EIT eit;
+	EitDescriptor edesc;
+	TIME_WINDOW window;
+	bool rtn = true;
+
+	memset(&window, '\0', sizeof(TIME_WINDOW));
+	window.from = param->from;
+	window.to = param->to;
+	window.verbose = param->verbose;
+
+	if((fp=fopen(param->files[fileNo],"r"))==NULL){
+		fprintf(stderr, "file open error : %s\n", param->files[fileNo]);
+		return(false);
+	}
+	while(!feof(fp) && rtn){
+		if(!create_payload(param->pid, payload, &payload_len, &fp)){
+			continue;
+		}
+		EIT_set(payload, &eit);
+		if(eit.tableId<0x4e || eit.tableId>0x6f || eit.sectionLength<11+4 || eit.sectionLength+3>payload_len){
+			continue;
+		}
+		if(param->sid!=0xffff && param->sid!=eit.serviceId){
+			continue;
+		}
+		if(param->timeFilter && sectionOutOfWindow(&window, &eit)){
+			continue;
+		}
+		for(int eDescriptorLength=0; eDescriptorLength+12<=eit.sectionLength-11-4 && rtn; eDescriptorLength+=12+edesc.descriptorsLoopLength){
+			EitDescriptor_set(eit.sectionData+eDescriptorLength, &edesc);
+			if(eDescriptorLength+12+edesc.descriptorsLoopLength>eit.sectionLength-11-4){
+				break;
+			}
+			if(param->timeFilter && !eventInWindow(&window, &edesc)){
+				continue;
+			}
+			rtn = storeAdd(store, &eit, eit.sectionData+eDescriptorLength, 12+edesc.descriptorsLoopLength, fileNo);
+		}
+	}
+	fclose(fp);
+	return(rtn);
+}
+
+static void *batchWorker(void *arg)
+{
+	BATCH *batch = arg;
+	uint32_t fileNo;
+
+	while(true){
+		pthread_mutex_lock(&batch->lock);
+		fileNo = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if(fileNo>=batch->param->numOfFiles){
+			break;
+		}
+		if(!scanFile(batch->param, fileNo, &batch->stores[fileNo])){
+			pthread_mutex_lock(&batch->lock);
+			batch->failed = true;
+			pthread_mutex_unlock(&batch->lock);
+		}
+	}
+	return(NULL);
+}
+
+// 全ファイルを読み store に併合する
+// 読めなかったファイルがあれば *allRead を false とし、残りのファイルは併合する
+static bool batchScan(ARG_PARAM *param, EVENT_STORE *store, bool *allRead)
+{
+	BATCH batch;
+	pthread_t *threads;
+	uint32_t jobs = (param->jobs>0) ? param->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t started = 0;
+	bool rtn = true;
+
+	if(jobs<1){
+		jobs = 1;
+	}
+	if(jobs>param->numOfFiles){
+		jobs = param->numOfFiles;
+	}
+	memset(&batch, '\0', sizeof(BATCH));
+	batch.param = param;
+	batch.stores = calloc(param->numOfFiles, sizeof(EVENT_STORE));
+	threads = calloc(jobs, sizeof(pthread_t));
+	if(batch.stores==NULL || threads==NULL){
+		free(batch.stores);
+		free(threads);
+		return(false);
+	}
+	pthread_mutex_init(&batch.lock, NULL);
+
+	for(uint32_t i=0; i<jobs; i++){
+		if(pthread_create(&threads[i], NULL, batchWorker, &batch)!=0){
+			break;
+		}
+		started++;
+	}
+	// スレッドを作れなかった場合は自スレッドで処理する
+	if(started==0){
+		batchWorker(&batch);
+	}
+	for(uint32_t i=0; i<started; i++){
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&batch.lock);
+	*allRead = !batch.failed;
+
+	for(uint32_t i=0; i<param->numOfFiles; i++){
+		fprintf(stderr, "file %s : events %" PRIu32 "\n", param->files[i], batch.stores[i].numOfEvents);
+		if(!storeMerge(store, &batch.stores[i])){
+			rtn = false;
+		}
+	}
+	fprintf(stderr, "files %" PRIu32 " jobs %" PRIu32 " merged events %" PRIu32 "\n", param->numOfFiles, jobs, store->numOfEvents);
+
+	free(batch.stores);
+	free(threads);
+	return(rtn);
+}
+
+// 併合したイベントを --fields の形式で出力する
+static void printStore(EVENT_STORE *store, ARG_PARAM *param)
+{
+	ARIB_CACHE *cache = aribCacheNew();
+
+	if(cache!=NULL){
+		aribCacheLimit(cache, FIELD_CACHE_LIMIT);
+	}
+
+	printFieldsHeader(stdout, param);
+	for(uint32_t i=0; i<store->numOfEvents; i++){
+		EIT eit;
+		EitDescriptor edesc;
+		EPG_EVENT ev;
+
+		storeEvent(&store->events[i], &eit, &edesc);
+		collectEvent(&eit, &edesc, param->fieldMask, &ev);
+		printFields(stdout, cache, &ev, param);
+	}
+	aribCacheFree(cache);
+}
+
+/****************************************************************/
+/* 1ファイルの --fields 出力 段階別スレッド処理                 */
+/*                                                              */
+/*   読込 ─→ 分離 ─┬→ 変換0 ─┬→ 出力                          */
+/*                 ├→ 変換1 ─┤                                 */
+/*                 └→ 変換n ─┘                                 */
+/*                                                              */
+/* 読込   : ファイルを CHUNK 単位で読む                         */
+/* 分離   : 指定PIDのセクションを組み立て、ヘッダで sid/時間の  */
+/*          範囲外を除いて WORK にコピーする (自スレッド)       */
+/* 変換   : 記述子の解析と文字コード変換 WORK 毎に出力を作る    */
+/* 出力   : WORK を分離した順に標準出力に書く                   */
+/*                                                              */
+/* 段の間は単一生産者・単一消費者のリングバッファでつなぐ       */
+/* 分離は k 番目の WORK を変換 k%n に渡し、出力は同じ順で       */
+/* 変換 k%n から受け取るので並べ替えをしなくても順序が保たれる  */
+/* 各段の処理数・待ち回数・CPU時間は --verbose で終了時に出力   */
+/****************************************************************/
+#define PIPE_CHUNKS			8
+#define PIPE_CHUNK_SIZE		(TS_PACKETSIZE*2048)
+#define PIPE_WORKS_PER_JOB	8					// 変換スレッドあたりの WORK 数
+#define PIPE_SPIN			16					// 待ちで sched_yield する回数 以降は条件変数で眠る
+
+// 単一生産者・単一消費者のリングバッファ NULL は終端
+// 満杯と空は同時に起きないので眠るのは生産者か消費者の一方だけ
+typedef struct {
+	void		**slot;
+	size_t		mask;							// 要素数-1 (要素数は2のべき乗)
+	pthread_mutex_t	lock;						// 眠る・起こす時だけ使う
+	pthread_cond_t	cond;
+	_Alignas(64) size_t	head;					// 消費者のみ書き込む
+	_Alignas(64) size_t	tail;					// 生産者のみ書き込む
+	_Alignas(64) bool	sleeping;				// 相手が cond で待っている
+} PIPE_RING;
+
+typedef struct {
+	size_t		len;
+	uint8_t		data[PIPE_CHUNK_SIZE];
+} PIPE_CHUNK;
+
+typedef struct {
+	size_t		sectionLen;
+	uint8_t		section[4096+TS_PACKETSIZE];
+	char		*text;							// 変換で作成した出力
+	size_t		textLen;
+} PIPE_WORK;
+
+// 段毎の統計 各段のスレッドだけが書き込み、全スレッド終了後に出力する
+typedef struct {
+	char		name[24];
+	uint64_t	items;							// 処理した CHUNK/WORK 数
+	uint64_t	count;							// 段毎の数 (読込:byte 分離:パケット 変換:イベント 出力:byte)
+	uint64_t	waits;							// 入力待ち・空き待ちの回数
+	double		cpu;							// スレッドのCPU時間(秒)
+} PIPE_STAGE;
+
+typedef struct {
+	ARG_PARAM		*param;
+	FILE			*fp;
+	uint32_t		jobs;
+	PIPE_CHUNK		*chunks;
+	PIPE_WORK		*works;
+	PIPE_RING		chunkFree;					// 分離 → 読込
+	PIPE_RING		chunkFull;					// 読込 → 分離
+	PIPE_RING		workFree;					// 出力 → 分離
+	PIPE_RING		*workIn;					// 分離 → 変換k
+	PIPE_RING		*workOut;					// 変換k → 出力
+	uint64_t		dispatched;					// 分離が渡した WORK 数
+	bool			lost;						// 分離 同期外れ中
+	uint64_t		syncLoss;					// 分離 同期外れの回数
+	uint64_t		skipped;					// 分離 同期外れで読み飛ばしたbyte数
+	TIME_WINDOW		window;						// 分離のみ更新する 変換は from/to だけ読む
+	PIPE_STAGE		reader;
+	PIPE_STAGE		demux;
+	PIPE_STAGE		*worker;
+	PIPE_STAGE		writer;
+} PIPELINE;
+
+typedef struct {
+	PIPELINE		*pl;
+	uint32_t		no;
+} PIPE_WORKER_ARG;
+
+static bool ringInit(PIPE_RING *ring, size_t size)
+{
+	size_t n = 1;
+
+	while(n<size){
+		n <<= 1;
+	}
+	memset(ring, '\0', sizeof(PIPE_RING));
+	if((ring->slot = calloc(n, sizeof(void *)))==NULL){
+		return(false);
+	}
+	ring->mask = n-1;
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+	return(true);
+}
+
+static void ringFree(PIPE_RING *ring)
+{
+	if(ring->slot==NULL){
+		return;
+	}
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->cond);
+	free(ring->slot);
+	ring->slot = NULL;
+}
+
+// 生産者: 空きが無い 消費者: 要素が無い
+// head/tail と sleeping は SEQ_CST で読み書きし、眠る側が sleeping を立ててから確認し
+// 起こす側が head/tail を進めてから sleeping を確認すれば少なくとも一方が相手の書込みを見る
+static bool ringBlocked(PIPE_RING *ring, bool producer, size_t pos)
+{
+	if(producer){
+		return(pos - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) > ring->mask);
+	}
+	return(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)==pos);
+}
+
+// 相手の段が進むまで待つ 1CPUでも回るよう最初から CPU を譲り
+// PIPE_SPIN 回譲っても進まなければ相手が起こすまで眠る
+// (読込がI/O待ちの間に他の段が起き続けないようにする)
+static void ringWait(PIPE_RING *ring, bool producer, size_t pos, PIPE_STAGE *stage)
+{
+	uint32_t spin = 0;
+
+	if(!ringBlocked(ring, producer, pos)){
+		return;
+	}
+	stage->waits++;
+	while(ringBlocked(ring, producer, pos)){
+		if(++spin < PIPE_SPIN){
+			sched_yield();
+			continue;
+		}
+		pthread_mutex_lock(&ring->lock);
+		__atomic_store_n(&ring->sleeping, true, __ATOMIC_SEQ_CST);
+		while(ringBlocked(ring, producer, pos)){
+			pthread_cond_wait(&ring->cond, &ring->lock);
+		}
+		__atomic_store_n(&ring->sleeping, false, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+// 相手が眠っていれば起こす
+static void ringWake(PIPE_RING *ring)
+{
+	if(__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_signal(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+static void ringPush(PIPE_RING *ring, void *item, PIPE_STAGE *stage)
+{
+	size_t tail = ring->tail;
+
+	ringWait(ring, true, tail, stage);
+	ring->slot[tail & ring->mask] = item;
+	__atomic_store_n(&ring->tail, tail+1, __ATOMIC_SEQ_CST);
+	ringWake(ring);
+}
+
+static void *ringPop(PIPE_RING *ring, PIPE_STAGE *stage)
+{
+	size_t head = ring->head;
+	void *item;
+
+	ringWait(ring, false, head, stage);
+	item = ring->slot[head & ring->mask];
+	__atomic_store_n(&ring->head, head+1, __ATOMIC_SEQ_CST);
+	ringWake(ring);
+	return(item);
+}
+
+static double threadCpuTime(void)
+{
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)!=0){
+		return(0.0);
+	}
+	return(ts.tv_sec + ts.tv_nsec/1e9);
+}
+
+// 読込 CHUNK 単位で読む 同期は分離が確認する
+static void *pipeReader(void *arg)
+{
+	PIPELINE *pl = arg;
+	PIPE_CHUNK *chunk;
+
+	while(true){
+		chunk = ringPop(&pl->chunkFree, &pl->reader);
+		if(chunk==NULL){
+			break;
+		}
+		// chunkFree の生産者は分離だけなので空の CHUNK は戻さない
+		chunk->len = fread(chunk->data, 1, PIPE_CHUNK_SIZE, pl->fp);
+		if(chunk->len==0){
+			break;
+		}
+		pl->reader.items++;
+		pl->reader.count += chunk->len;
+		ringPush(&pl->chunkFull, chunk, &pl->reader);
+	}
+	ringPush(&pl->chunkFull, NULL, &pl->reader);
+	pl->reader.cpu = threadCpuTime();
+	return(NULL);
+}
+
+// 分離 組み立てたセクションをヘッダだけで選別して変換に渡す
+static void pipeSection(void *ctx, uint8_t *section, size_t len)
+{
+	PIPELINE *pl = ctx;
+	ARG_PARAM *param = pl->param;
+	PIPE_WORK *work;
+	EIT eit;
+
+	EIT_set(section, &eit);
+	if(eit.tableId<0x4e || eit.tableId>0x6f || eit.sectionLength<11+4){
+		return;
+	}
+	if(param->sid!=0xffff && param->sid!=eit.serviceId){
+		return;
+	}
+	// 時間範囲外のセクションはヘッダと先頭イベントだけで読み飛ばす
+	if(param->timeFilter && sectionOutOfWindow(&pl->window, &eit)){
+		return;
+	}
+
+	work = ringPop(&pl->workFree, &pl->demux);
+	memcpy(work->section, section, len);
+	work->sectionLen = len;
+	ringPush(&pl->workIn[pl->dispatched % pl->jobs], work, &pl->demux);
+	pl->dispatched++;
+	pl->demux.items++;
+}
+
+// 変換 WORK のイベントを --fields 形式の文字列にする
+static void *pipeWorker(void *arg)
+{
+	PIPE_WORKER_ARG *wa = arg;
+	PIPELINE *pl = wa->pl;
+	ARG_PARAM *param = pl->param;
+	PIPE_STAGE *stage = &pl->worker[wa->no];
+	ARIB_CACHE *cache = aribCacheNew();
+	PIPE_WORK *work;
+	EIT eit;
+	EitDescriptor edesc;
+	EPG_EVENT ev;
+
+	if(cache!=NULL){
+		aribCacheLimit(cache, FIELD_CACHE_LIMIT);
+	}
+
+	while((work = ringPop(&pl->workIn[wa->no], stage))!=NULL){
+		FILE *out = open_memstream(&work->text, &work->textLen);
+		if(out!=NULL){
+			EIT_set(work->section, &eit);
+			for(int eDescriptorLength=0; eDescriptorLength+12<=eit.sectionLength-11-4; eDescriptorLength+=12+edesc.descriptorsLoopLength){
+				EitDescriptor_set(eit.sectionData+eDescriptorLength, &edesc);
+				if(eDescriptorLength+12+edesc.descriptorsLoopLength>eit.sectionLength-11-4){
+					break;
+				}
+				if(param->timeFilter && !eventInWindow(&pl->window, &edesc)){
+					continue;
+				}
+				collectEvent(&eit, &edesc, param->fieldMask, &ev);
+				printFields(out, cache, &ev, param);
+				stage->count++;
+			}
+			fclose(out);
+		}
+		stage->items++;
+		ringPush(&pl->workOut[wa->no], work, stage);
+	}
+	ringPush(&pl->workOut[wa->no], NULL, stage);
+	aribCacheFree(cache);
+	stage->cpu = threadCpuTime();
+	return(NULL);
+}
+
+// 出力 分離した順に変換k から受け取る
+static void *pipeWriter(void *arg)
+{
+	PIPELINE *pl = arg;
+	PIPE_WORK *work;
+
+	for(uint64_t seq=0; (work = ringPop(&pl->workOut[seq % pl->jobs], &pl->writer))!=NULL; seq++){
+		if(work->text!=NULL){
+			fwrite(work->text, 1, work->textLen, stdout);
+			pl->writer.count += work->textLen;
+			free(work->text);
+			work->text = NULL;
+		}
+		pl->writer.items++;
+		ringPush(&pl->workFree, work, &pl->writer);
+	}
+	fflush(stdout);
+	pl->writer.cpu = threadCpuTime();
+	return(NULL);
+}
+
+// 変換に終端を渡して終了を待つ 変換は出力に終端を渡す
+static void pipeStopWorkers(PIPELINE *pl, pthread_t *workers)
+{
+	for(uint32_t i=0; i<pl->jobs; i++){
+		ringPush(&pl->workIn[i], NULL, &pl->demux);
+	}
+	for(uint32_t i=0; i<pl->jobs; i++){
+		pthread_join(workers[i], NULL);
+	}
+}
+
+static void printPipeStage(PIPE_STAGE *stage, const char *unit)
+{
+	fprintf(stderr, "pipeline %-10s : items %-10" PRIu64 " %s %-12" PRIu64 " waits %-8" PRIu64 " cpu %.3fs\n",
+			stage->name, stage->items, unit, stage->count, stage->waits, stage->cpu);
+}
+
+/****************************************************************/
+/* パケットの同期を確認して EIT PID のセクションを組み立てる    */
+/* 0x47 が 188byte 間隔で並ばない場合は同期を取り直す           */
+/* 次のパケット先頭を確認できない末尾は残して処理したbyte数を   */
+/* 返す last:true はファイル末尾で次のパケットを確認しない      */
+/****************************************************************/
+static size_t pipeDemux(PIPELINE *pl, SECTION_ASSEMBLER *eitAsm, uint8_t *buf, size_t len, bool last)
+{
+	size_t pos = 0;
+
+	while(len-pos>=TS_PACKETSIZE){
+		if(len-pos==TS_PACKETSIZE && !last){
+			break;
+		}
+		if(buf[pos]==0x47 && (len-pos==TS_PACKETSIZE || buf[pos+TS_PACKETSIZE]==0x47)){
+			uint8_t *packet = buf+pos;
+			pl->lost = false;
+			pl->demux.count++;
+			if(((packet[1] & 0x1f)<<8 | packet[2])==eitAsm->pid){
+				sectionFeed(eitAsm, packet, pipeSection, pl);
+			}
+			pos += TS_PACKETSIZE;
+			continue;
+		}
+		// 同期外れ 次の 0x47 + 188byte 先も 0x47 の位置まで読み飛ばす
+		if(!pl->lost){
+			pl->lost = true;
+			pl->syncLoss++;
+		}
+		pl->skipped++;
+		pos++;
+	}
+	return(pos);
+}
+
+static int pipelineScan(FILE *fp, ARG_PARAM *param)
+{
+	PIPELINE pl;
+	PIPE_WORKER_ARG *args;
+	pthread_t reader, writer, *workers;
+	uint32_t started = 0;
+	uint32_t numOfWorks;
+	uint32_t numOfRings;
+	SECTION_ASSEMBLER *eitAsm;
+	PIPE_CHUNK *chunk;
+	uint8_t stitch[TS_PACKETSIZE*3];
+	size_t carry = 0, off, used;
+	int rtn = 0;
+
+	memset(&pl, '\0', sizeof(PIPELINE));
+	pl.param = param;
+	pl.fp = fp;
+	pl.jobs = (param->jobs>0) ? param->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	if(pl.jobs<1){
+		pl.jobs = 1;
+	}
+	numOfRings = pl.jobs;
+	numOfWorks = pl.jobs*PIPE_WORKS_PER_JOB;
+	pl.window.from = param->from;
+	pl.window.to = param->to;
+	pl.window.verbose = param->verbose;
+	strcpy(pl.reader.name, "reader");
+	strcpy(pl.demux.name, "demux");
+	strcpy(pl.writer.name, "writer");
+
+	pl.chunks = malloc(sizeof(PIPE_CHUNK)*PIPE_CHUNKS);
+	pl.works = calloc(numOfWorks, sizeof(PIPE_WORK));
+	pl.workIn = calloc(pl.jobs, sizeof(PIPE_RING));
+	pl.workOut = calloc(pl.jobs, sizeof(PIPE_RING));
+	pl.worker = calloc(pl.jobs, sizeof(PIPE_STAGE));
+	args = calloc(pl.jobs, sizeof(PIPE_WORKER_ARG));
+	workers = calloc(pl.jobs, sizeof(pthread_t));
+	eitAsm = calloc(1, sizeof(SECTION_ASSEMBLER));
+	if(pl.chunks==NULL || pl.works==NULL || pl.workIn==NULL || pl.workOut==NULL || pl.worker==NULL
+	|| args==NULL || workers==NULL || eitAsm==NULL
+	|| !ringInit(&pl.chunkFree, PIPE_CHUNKS) || !ringInit(&pl.chunkFull, PIPE_CHUNKS+1)
+	|| !ringInit(&pl.workFree, numOfWorks)){
+		fprintf(stderr, "memory allocate error\n");
+		rtn = -1;
+		goto END;
+	}
+	for(uint32_t i=0; i<numOfRings; i++){
+		// 変換k に同時に渡る WORK は全体の数を超えない +1 は終端
+		if(!ringInit(&pl.workIn[i], numOfWorks+1) || !ringInit(&pl.workOut[i], numOfWorks+1)){
+			fprintf(stderr, "memory allocate error\n");
+			rtn = -1;
+			goto END;
+		}
+	}
+	for(uint32_t i=0; i<PIPE_CHUNKS; i++){
+		ringPush(&pl.chunkFree, &pl.chunks[i], &pl.demux);
+	}
+	for(uint32_t i=0; i<numOfWorks; i++){
+		ringPush(&pl.workFree, &pl.works[i], &pl.demux);
+	}
+	eitAsm->pid = param->pid;
+	eitAsm->continuityCounter = -1;
+
+	// 変換 → 出力 → 読込の順に作る 変換は作れた数で分配する
+	for(uint32_t i=0; i<pl.jobs; i++){
+		args[i].pl = &pl;
+		args[i].no = i;
+		snprintf(pl.worker[i].name, sizeof(pl.worker[i].name), "worker%" PRIu32, i);
+		if(pthread_create(&workers[i], NULL, pipeWorker, &args[i])!=0){
+			break;
+		}
+		started++;
+	}
+	if(started==0){
+		fprintf(stderr, "thread create error\n");
+		rtn = -1;
+		goto END;
+	}
+	pl.jobs = started;
+	if(pthread_create(&writer, NULL, pipeWriter, &pl)!=0){
+		fprintf(stderr, "thread create error\n");
+		pipeStopWorkers(&pl, workers);
+		rtn = -1;
+		goto END;
+	}
+	if(pthread_create(&reader, NULL, pipeReader, &pl)!=0){
+		fprintf(stderr, "thread create error\n");
+		pipeStopWorkers(&pl, workers);
+		pthread_join(writer, NULL);
+		rtn = -1;
+		goto END;
+	}
+
+	printFieldsHeader(stdout, param);
+	fflush(stdout);
+	// CHUNK 境界を跨ぐパケットは stitch に繋いでから処理する
+	while((chunk = ringPop(&pl.chunkFull, &pl.demux))!=NULL){
+		off = 0;
+		if(carry>0){
+			size_t take = (chunk->len < sizeof(stitch)-carry) ? chunk->len : sizeof(stitch)-carry;
+			memcpy(stitch+carry, chunk->data, take);
+			used = pipeDemux(&pl, eitAsm, stitch, carry+take, false);
+			if(used>=carry){
+				off = used-carry;
+				carry = 0;
+			}else{
+				// CHUNK が小さく stitch 内で処理しきれなかった
+				memmove(stitch, stitch+used, carry+take-used);
+				carry = carry+take-used;
+				off = chunk->len;
+			}
+		}
+		if(off<chunk->len){
+			off += pipeDemux(&pl, eitAsm, chunk->data+off, chunk->len-off, false);
+			memcpy(stitch, chunk->data+off, chunk->len-off);
+			carry = chunk->len-off;
+		}
+		ringPush(&pl.chunkFree, chunk, &pl.demux);
+	}
+	used = pipeDemux(&pl, eitAsm, stitch, carry, true);
+	// 末尾の188byte未満
+	pl.skipped += carry-used;
+	pl.demux.cpu = threadCpuTime();
+	pthread_join(reader, NULL);
+	pipeStopWorkers(&pl, workers);
+	pthread_join(writer, NULL);
+
+	if(pl.syncLoss>0){
+		fprintf(stderr, "sync loss %" PRIu64 " skipped %" PRIu64 " bytes\n", pl.syncLoss, pl.skipped);
+	}
+	if(param->verbose){
+		printPipeStage(&pl.reader, "bytes  ");
+		printPipeStage(&pl.demux, "packets");
+		for(uint32_t i=0; i<pl.jobs; i++){
+			printPipeStage(&pl.worker[i], "events ");
+		}
+		printPipeStage(&pl.writer, "bytes  ");
+	}
+
+END:
+	for(uint32_t i=0; i<numOfRings && pl.workIn!=NULL && pl.workOut!=NULL; i++){
+		ringFree(&pl.workIn[i]);
+		ringFree(&pl.workOut[i]);
+	}
+	ringFree(&pl.chunkFree);
+	ringFree(&pl.chunkFull);
+	ringFree(&pl.workFree);
+	free(pl.chunks);
+	free(pl.works);
+	free(pl.workIn);
+	free(pl.workOut);
+	free(pl.worker);
+	free(args);
+	free(workers);
+	free(eitAsm);
+	return(rtn);
+}
+
+int main(int argc, char *argv[])
+{
+
+	uint8_t payload[MAX_PAYLOAD];
+	size_t	payload_len;
+	FILE *fp;
+	bool find;
+	EIT eit;
+	EitDescriptor edesc;
+	ARG_PARAM param;
+	TIME_WINDOW window;
+	EVENT_STORE store;
+
+	memset(&param, '\0', sizeof(ARG_PARAM));
+	param.pid = 0xffff;
+	param.sid = 0xffff;
+	param.from = INT64_MIN;
+	param.to = INT64_MAX;
+	if(parseOption(argc, argv, &param)){
+		if(param.query!=NULL){
+			mjdTableInit();
+			return(queryIndex(param.index, param.query));
+		}
+		// --fields 指定時は標準出力をTAB区切りデータのみとする
+		FILE *info = (param.numOfFields>0 || param.indexOut!=NULL || param.report || param.batch) ? stderr : stdout;
+		fprintf(info,"parseOption() return true\n");
+		fprintf(info,"pid     = %d\n", param.pid);
+		fprintf(info,"sid     = %d\n", param.sid);
+		for(uint32_t i=0; i<param.numOfFiles; i++){
+			fprintf(info,"file    = %s\n", param.files[i]);
+		}
+
+		// 未指定時、デフォルト0x12とする
+		if(param.pid==0xffff){
+			param.pid = 0x12;
+		}
+	}else{
+		fprintf(stdout,"parseOption() return false\n");
+		return(-1);
+	}
+
+	mjdTableInit();
+	memset(&window, '\0', sizeof(TIME_WINDOW));
+	window.from = param.from;
+	window.to = param.to;
+	window.verbose = param.verbose;
+	memset(&store, '\0', sizeof(EVENT_STORE));
+
+	// 複数ファイルとインデックス作成はイベントを重複除去してから出力する
+	if(!param.report && (param.batch || param.indexOut!=NULL)){
+		bool allRead = false;
+		bool rtn = batchScan(&param, &store, &allRead);
+		if(rtn){
+			storeSort(&store);
+			if(param.indexOut!=NULL){
+				rtn = writeIndex(&store, param.indexOut);
+			}else{
+				if(param.numOfFields==0){
+					parseFields("sid,event_id,start,duration,title", &param);
+				}
+				printStore(&store, &param);
+			}
+		}
+		storeFree(&store);
+		return((rtn && allRead) ? 0 : -1);
+	}
+
+	// 受信完了状況はセクションヘッダのみで判断する
+	// 複数ファイルはファイル毎に報告する
+	if(param.report){
+		int rtn = 0;
+		for(uint32_t i=0; i<param.numOfFiles; i++){
+			if((fp=fopen(param.files[i],"r"))==NULL){
+				fprintf(stderr, "file open error : %s\n", param.files[i]);
+				rtn = -1;
+				continue;
+			}
+			if(param.numOfFiles>1){
+				fprintf(stdout, "file %s\n", param.files[i]);
+			}
+			if(reportScan(fp, &param)!=0){
+				rtn = -1;
+			}
+			fclose(fp);
+		}
+		return(rtn);
+	}
+
+	if((fp=fopen(param.file,"r"))==NULL){
+		fprintf(stderr, "file open error : %s\n", param.file);
+		return(-1);
+   	 }
+
+	// --fields は読込・分離・変換・出力を段階別のスレッドで行う
+	if(param.numOfFields>0){
+		int rtn = pipelineScan(fp, &param);
+		fclose(fp);
+		return(rtn);
+	}
+
+	while(!feof(fp)){
+		find = create_payload(param.pid, payload, &payload_len, &fp);
+		if(find){
+			memset(&eit, '\0', sizeof(EIT));
+			EIT_set(payload, &eit);
+
+			if(param.timeFilter){
+				if(eit.tableId<0x4e || eit.tableId>0x6f || eit.sectionLength<11+4){
+					continue;
+				}
+				// 時間範囲外のセクションはヘッダと先頭イベントだけで読み飛ばす
+				if(sectionOutOfWindow(&window, &eit)){
+					continue;
+				}
+			}
+
+			if(param.sid==0xffff || param.sid == eit.serviceId){
+				printEIT(&eit);
+			}
+
+			memset(&edesc, '\0', sizeof(EitDescriptor));
+			for(int eDescriptorLength=0; eDescriptorLength<eit.sectionLength-11-4; eDescriptorLength+=12+edesc.descriptorsLoopLength){
+																				// 11 : EIT serviceId から lastTableId までのbyte数
+																				// 4  : EIT CRC32 のbyte数
+																				// eit.sectionLength-11-4 : EIT sectionData のbyte数
+																				// 12 : eventId から descriptorsLoopLength までのbyte数
+																				// edesc.descriptorsLoopLength : descriptor のbyte数
+																				// 12+sdesc.descriptorsLoopLength : EIT Descriptor 1つのbyte数
+
+				memset(&edesc, '\0', sizeof(EitDescriptor));
+				EitDescriptor_set(eit.sectionData+eDescriptorLength, &edesc);
+				uint8_t descriptorTag;
+				if(param.timeFilter && !eventInWindow(&window, &edesc)){
+					continue;
+				}
 				if(param.sid==0xffff || param.sid == eit.serviceId){
 					printEitDescriptor(&edesc);
 				}
@@ -0,0 +1,503 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* 関数名：aribTOutf8                                                         */
+/* 機能  ：ARIB 8単位符号をUTF-8に直接変換する                                */
+/*           SJIS を経由せず nkf も使用しない 1パスの変換                     */
+/*           文字は mkaribtbl がビルド時に生成した aribtbl.h のテーブルを     */
+/*           直接参照する                                                     */
+/*                                                                            */
+/* size_t aribTOutf8(const uint8_t *input, size_t length,                     */
+/*                   uint8_t *out, size_t outSize)                            */
+/*            input  :ARIB文字列                                              */
+/*            length :ARIB文字列byte数                                        */
+/*            out    :出力バッファ (呼出し側で用意する)                       */
+/*            outSize:出力バッファbyte数                                      */
+/*                    ARIB_UTF8_BUFSIZE(length) あれば切り捨ては起きない      */
+/*            戻値   :出力したbyte数 終端文字 '\0' は含まない                 */
+/*                    バッファが足りない場合は文字単位で切り捨てる            */
+/*                                                                            */
+/* aribTOsjis との違い                                                        */
+/*   GL/GR は中間バッファ番号で保持するので呼出し後の再指示にも追従する       */
+/*   GR に2バイト符号集合を呼び出した場合も変換する                           */
+/*   1バイトDRCSと2バイト符号集合の終端符号を区別する                         */
+/*   SP(0x20) は空白、APR(0x0D) は改行として出力する                          */
+/*   追加記号は aribgaiji.map、DRCS は aribdrcs.map に記載した文字を出力する  */
+/*   パラメータ付き制御符号はパラメータも読み飛ばす                           */
+/******************************************************************************/
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "libnkf.h"
+#include "aribtbl.h"
+
+// 符号集合の分類 (aribTOsjis.c と同じ終端符号)
+#define GSET_KANJI					0x42 // 2バイト符号 漢字
+#define GSET_ASCII					0x4A // 1バイト符号 英数
+#define GSET_HIRAGANA				0x30 // 1バイト符号 平仮名
+#define GSET_KATAKANA 				0x31 // 1バイト符号 カタカナ
+#define GSET_P_ASCII				0x36 // 1バイト符号 プロポーショナル英数
+#define GSET_P_HIRAGANA				0x37 // 1バイト符号 プロポーショナル平仮名
+#define GSET_P_KATAKANA				0x38 // 1バイト符号 プロポーショナルカタカナ
+#define GSET_JIS_X0201_KATAKANA		0x49 // 1バイト符号 JIS X0201 片仮名
+#define GSET_JIS_COMPATIBLE_KANJI1	0x39 // 2バイト符号 JIS互換漢字1面
+#define GSET_JIS_COMPATIBLE_KANJI2	0x3A // 2バイト符号 JIS互換漢字2面
+#define GSET_ADD_CODE				0x3B // 2バイト符号 追加記号
+
+// 中間バッファに指示した符号集合 終端符号に種別を付けて区別する
+#define SET_1BYTE	0x000		// 1バイトGセット
+#define SET_2BYTE	0x100		// 2バイトGセット
+#define SET_DRCS1	0x200		// 1バイトDRCS
+#define SET_DRCS2	0x300		// 2バイトDRCS
+#define SET_BYTES(set)	(((set) & 0x100) ? 2 : 1)
+
+#define ESC		0x1B
+#define LS0		0x0F
+#define LS1		0x0E
+#define SS2		0x19
+#define SS3		0x1D
+#define CSI		0x9B
+
+/******************************************************************************/
+/* 制御符号の後続パラメータbyte数                                             */
+/* 0x20 が続く場合に1byte増える COL/CDC は個別に判定する                      */
+/******************************************************************************/
+static uint8_t controlParam(uint8_t c)
+{
+	switch(c){
+	case 0x16:	// PAPF
+	case 0x8B:	// SZX
+	case 0x91:	// FLC
+	case 0x93:	// POL
+	case 0x94:	// WMM
+	case 0x97:	// HLC
+	case 0x98:	// RPC
+		return(1);
+	case 0x1C:	// APS
+	case 0x9D:	// TIME
+		return(2);
+	default:
+		return(0);
+	}
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* 1文字分をテーブルから出力する 戻値:false バッファ不足                      */
+/******************************************************************************/
+static bool putEntry(uint32_t entry, uint8_t **out, uint8_t *end)
+{
+	size_t len = entry & 0x07;
+
+	if(len==0){
+		return(true);
+	}
+	if(*out+len > end){
+		return(false);
+	}
+	memcpy(*out, aribUtf8Pool+(entry>>3), len);
+	*out += len;
+	return(true);
+}
+
+static bool putBytes(const uint8_t *utf8, size_t len, uint8_t **out, uint8_t *end)
+{
+	if(*out+len > end){
+		return(false);
+	}
+	memcpy(*out, utf8, len);
+	*out += len;
+	return(true);
+}
+
+// 符号集合 set の文字 c1(,c2) を出力する c1/c2 は 0x21-0x7E
+static bool putChar(uint16_t set, uint8_t c1, uint8_t c2, uint8_t **out, uint8_t *end)
+{
+	uint32_t ku = (c1-0x21)*94 + (c2-0x21);
+
+	switch(set){
+	case SET_1BYTE|GSET_ASCII:
+	case SET_1BYTE|GSET_P_ASCII:
+		return(putBytes(&c1, 1, out, end));
+	case SET_1BYTE|GSET_HIRAGANA:
+	case SET_1BYTE|GSET_P_HIRAGANA:
+		return(putEntry(aribHiraganaUtf8[c1-0x20], out, end));
+	case SET_1BYTE|GSET_KATAKANA:
+	case SET_1BYTE|GSET_P_KATAKANA:
+		return(putEntry(aribKatakanaUtf8[c1-0x20], out, end));
+	case SET_1BYTE|GSET_JIS_X0201_KATAKANA:
+		return(putEntry(aribX0201Utf8[c1-0x20], out, end));
+	case SET_2BYTE|GSET_KANJI:
+		return(putEntry(aribKanjiUtf8[ku], out, end));
+	case SET_2BYTE|GSET_JIS_COMPATIBLE_KANJI1:
+		return(putEntry(aribCompat1Utf8[ku], out, end));
+	case SET_2BYTE|GSET_JIS_COMPATIBLE_KANJI2:
+		return(putEntry(aribCompat2Utf8[ku], out, end));
+	case SET_2BYTE|GSET_ADD_CODE:
+		return(putEntry(aribAddCodeUtf8[ku], out, end));
+	case SET_DRCS2|0x40:	// DRCS-0
+		return(putEntry(aribDrcs0Utf8[ku], out, end));
+	default:
+		// DRCS-1〜15 は aribdrcs.map に記載した文字だけ出力する
+		if((set & 0x300)==SET_DRCS1 && (set & 0xff)>=0x41 && (set & 0xff)<=0x4F){
+			return(putEntry(aribDrcsUtf8[((set & 0xff)-0x41)*96 + c1-0x20], out, end));
+		}
+		// モザイク等は出力しない
+		return(true);
+	}
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* 制御符号を含まない同じ側の文字 run byte を符号集合 set で変換する          */
+/* 戻値:処理したbyte数 2バイト符号集合で端数の1byteが残る場合はその手前まで   */
+/*      出力バッファ不足の場合は *full を true にしてその手前まで             */
+/******************************************************************************/
+static size_t decodeRun(uint16_t set, const uint8_t *p, size_t run, uint8_t **out, uint8_t *end, bool *full)
+{
+	size_t i = 0;
+
+	switch(set){
+	case SET_1BYTE|GSET_ASCII:
+	case SET_1BYTE|GSET_P_ASCII:
+		// 英数は表引きせずバッファに収まる分をまとめて書き込む
+		if(run > (size_t)(end-*out)){
+			run = end-*out;
+			*full = true;
+		}
+		for(; i<run; i++){
+			(*out)[i] = p[i] & 0x7F;
+		}
+		*out += run;
+		return(run);
+	case SET_2BYTE|GSET_KANJI:
+	case SET_2BYTE|GSET_JIS_COMPATIBLE_KANJI1:
+	case SET_2BYTE|GSET_JIS_COMPATIBLE_KANJI2:
+		// 漢字は符号集合の表を1回だけ選んで区点で直接引く
+		{
+			const uint32_t *tbl = (set==(SET_2BYTE|GSET_KANJI)) ? aribKanjiUtf8
+								: (set==(SET_2BYTE|GSET_JIS_COMPATIBLE_KANJI1)) ? aribCompat1Utf8 : aribCompat2Utf8;
+			for(; i+2<=run; i+=2){
+				if(!putEntry(tbl[((p[i] & 0x7F)-0x21)*94 + ((p[i+1] & 0x7F)-0x21)], out, end)){
+					*full = true;
+					break;
+				}
+			}
+		}
+		return(i);
+	default:
+		if(SET_BYTES(set)==2){
+			for(; i+2<=run; i+=2){
+				if(!putChar(set, p[i] & 0x7F, p[i+1] & 0x7F, out, end)){
+					*full = true;
+					break;
+				}
+			}
+		}else{
+			for(; i<run; i++){
+				if(!putChar(set, p[i] & 0x7F, 0x21, out, end)){
+					*full = true;
+					break;
+				}
+			}
+		}
+		return(i);
+	}
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* ESC で始まる指示・呼出し制御 戻値:使用したbyte数 0:後続不足                */
+/******************************************************************************/
+static size_t escape(ARIB_DECODER *dec, const uint8_t *p, size_t rest)
+{
+	uint16_t type = SET_1BYTE;
+	size_t n = 1;
+	int g = 0;
+
+	if(rest<2){
+		return(0);
+	}
+	switch(p[1]){
+	case 0x6E: dec->GL = 2; return(2);		// LS2
+	case 0x6F: dec->GL = 3; return(2);		// LS3
+	case 0x7E: dec->GR = 1; return(2);		// LS1R
+	case 0x7D: dec->GR = 2; return(2);		// LS2R
+	case 0x7C: dec->GR = 3; return(2);		// LS3R
+	case 0x24:								// 2バイト符号集合
+		type = SET_2BYTE;
+		n = 2;
+		if(rest<3){
+			return(0);
+		}
+		if(p[2]>=0x28 && p[2]<=0x2B){
+			g = p[2]-0x28;
+			n = 3;
+		}
+		break;
+	case 0x28: case 0x29: case 0x2A: case 0x2B:	// 1バイト符号集合
+		g = p[1]-0x28;
+		n = 2;
+		break;
+	default:
+		// 対応しない ESC は ESC のみ読み捨てる
+		return(1);
+	}
+	if(rest<n+1){
+		return(0);
+	}
+	// 0x20 が続く場合は DRCS
+	if(p[n]==0x20){
+		type = (type==SET_2BYTE) ? SET_DRCS2 : SET_DRCS1;
+		n++;
+		if(rest<n+1){
+			return(0);
+		}
+	}
+	dec->G[g] = type | p[n];
+	return(n+1);
+}
+
+/******************************************************************************/
+/* 復号器の初期化 デフォルト G0:漢字 G1:英数 G2:平仮名 G3:カタカナ            */
+/*                GL:G0 GR:G2                                                 */
+/******************************************************************************/
+void aribDecoderInit(ARIB_DECODER *dec)
+{
+	dec->G[0]			= SET_2BYTE|GSET_KANJI;
+	dec->G[1]			= SET_1BYTE|GSET_ASCII;
+	dec->G[2]			= SET_1BYTE|GSET_HIRAGANA;
+	dec->G[3]			= SET_1BYTE|GSET_KATAKANA;
+	dec->GL				= 0;
+	dec->GR				= 2;
+	dec->singleShift	= -1;
+	dec->csi			= 0;
+	dec->numOfPending	= 0;
+}
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* input を復号して out に書き込む                                            */
+/* 戻値 : 処理したinput byte数                                                */
+/*        文字・制御符号の途中で input が終わった場合はその手前まで           */
+/*        出力バッファ不足の場合は *full を true にしてその手前まで           */
+/******************************************************************************/
+static size_t decode(ARIB_DECODER *dec, const uint8_t *input, size_t length, uint8_t **out, uint8_t *end, bool *full)
+{
+	size_t offset = 0;
+
+	*full = false;
+	while(offset < length){
+		const uint8_t *p = input+offset;
+		size_t rest = length-offset;
+		uint8_t c = *p;
+		uint16_t set;
+
+		// 前回の入力が CSI の途中で終わっていれば終端まで読み飛ばす
+		if(dec->csi){
+			for(; offset<length && !(input[offset]>=0x40 && input[offset]<=0x6F); offset++){
+				;
+			}
+			if(offset<length){
+				offset++;
+				dec->csi = 0;
+			}
+			continue;
+		}
+
+		// 文字 GL / GR
+		if((c>=0x21 && c<=0x7E) || (c>=0xA1 && c<=0xFE)){
+			// シングルシフト中でなければ同じ側の文字の並びをまとめて変換する
+			if(dec->singleShift<0 && rest>=2){
+				size_t run = decodeRun(dec->G[(c & 0x80) ? dec->GR : dec->GL], p, aribRunLength(p, rest, c & 0x80), out, end, full);
+				if(*full){
+					return(offset+run);
+				}
+				if(run>0){
+					offset += run;
+					continue;
+				}
+			}
+
+			if(c & 0x80){
+				set = dec->G[dec->GR];
+			}else{
+				set = dec->G[(dec->singleShift>=0) ? dec->singleShift : dec->GL];
+			}
+			if(SET_BYTES(set)==2){
+				if(rest<2){
+					break;
+				}
+				// 2byte目が文字符号でない場合は1byte目だけ読み捨てる
+				if((p[1] & 0x7F)<0x21 || (p[1] & 0x7F)>0x7E){
+					offset += 1;
+					continue;
+				}
+				if(!putChar(set, c & 0x7F, p[1] & 0x7F, out, end)){
+					*full = true;
+					break;
+				}
+				offset += 2;
+			}else{
+				if(!putChar(set, c & 0x7F, 0x21, out, end)){
+					*full = true;
+					break;
+				}
+				offset += 1;
+			}
+			if(!(c & 0x80)){
+				dec->singleShift = -1;
+			}
+			continue;
+		}
+
+		// 制御符号
+		switch(c){
+		case 0x20:	// SP
+			if(!putBytes(&c, 1, out, end)){
+				*full = true;
+				return(offset);
+			}
+			offset += 1;
+			break;
+		case 0x0D:	// APR 改行
+			if(!putBytes((const uint8_t *)"\n", 1, out, end)){
+				*full = true;
+				return(offset);
+			}
+			offset += 1;
+			break;
+		case LS0:
+			dec->GL = 0;
+			offset += 1;
+			break;
+		case LS1:
+			dec->GL = 1;
+			offset += 1;
+			break;
+		case SS2:
+			dec->singleShift = 2;
+			offset += 1;
+			break;
+		case SS3:
+			dec->singleShift = 3;
+			offset += 1;
+			break;
+		case ESC:
+			{
+				size_t n = escape(dec, p, rest);
+				if(n==0){
+					return(offset);
+				}
+				offset += n;
+			}
+			break;
+		case 0x90:	// COL
+		case 0x92:	// CDC パラメータが 0x20 の場合は2byte
+			if(rest<2 || (p[1]==0x20 && rest<3)){
+				return(offset);
+			}
+			offset += (p[1]==0x20) ? 3 : 2;
+			break;
+		case CSI:	// 終端 0x40-0x6F まで読み飛ばす 長さに上限がないので途中状態は csi に持つ
+			dec->csi = 1;
+			offset += 1;
+			break;
+		default:
+			if(rest<1+(size_t)controlParam(c)){
+				return(offset);
+			}
+			offset += 1+controlParam(c);
+			break;
+		}
+	}
+	return(offset);
+}
+
+/******************************************************************************/
+/* 関数名：aribDecoderFeed                                                    */
+/* 機能  ：ARIB文字列を分割して順に復号する                                   */
+/*           G0-G3/GL/GR/シングルシフトの状態と入力末尾で途中になった         */
+/*           符号列 (最大 ARIB_PENDING_MAX byte) を dec に持ち越すので        */
+/*           記述子やセクションに分かれた文字列を入力全体を溜めずに復号できる */
+/*                                                                            */
+/* size_t aribDecoderFeed(ARIB_DECODER *dec, const uint8_t *input,            */
+/*                        size_t length, uint8_t *out, size_t outSize)        */
+/*            dec    :aribDecoderInit で初期化した復号器                      */
+/*            input  :ARIB文字列の続き                                        */
+/*            length :input のbyte数                                          */
+/*            out    :出力バッファ ARIB_UTF8_FEEDSIZE(length) あれば          */
+/*                    切り捨ては起きない 不足した場合はこの入力の残りを捨てる */
+/*            戻値   :出力したbyte数 終端文字 '\0' は含まない                 */
+/*                                                                            */
+/* void aribDecoderFinish(ARIB_DECODER *dec)                                  */
+/*            途中の符号列を捨てて初期状態に戻す                              */
+/*            復号器は出力を保留しないので finish で出力するものはない        */
+/******************************************************************************/
+size_t aribDecoderFeed(ARIB_DECODER *dec, const uint8_t *input, size_t length, uint8_t *out, size_t outSize)
+{
+	uint8_t *cur = out;
+	uint8_t *end;
+	size_t offset = 0;
+	bool full = false;
+
+	if(outSize==0){
+		return(0);
+	}
+	end = out+outSize-1;
+
+	// 前回の途中の符号列に入力を継ぎ足して先に処理する
+	if(dec->numOfPending>0){
+		uint8_t before = dec->numOfPending;
+		size_t add = ARIB_PENDING_MAX-before;
+		size_t n;
+
+		if(add>length){
+			add = length;
+		}
+		memcpy(dec->pending+before, input, add);
+		n = decode(dec, dec->pending, before+add, &cur, end, &full);
+		if(n>0){
+			// 途中の符号列は継ぎ足した入力で完結している
+			offset = (n>before) ? n-before : 0;
+			dec->numOfPending = 0;
+		}else if(before+add==ARIB_PENDING_MAX){
+			// 完結しない符号列は捨てる
+			dec->numOfPending = 0;
+		}else{
+			dec->numOfPending = before+add;
+			offset = length;
+		}
+	}
+
+	if(!full && offset<length){
+		offset += decode(dec, input+offset, length-offset, &cur, end, &full);
+		// 途中で終わった符号列は次の入力まで持ち越す
+		if(!full && length-offset<=ARIB_PENDING_MAX){
+			memcpy(dec->pending, input+offset, length-offset);
+			dec->numOfPending = length-offset;
+		}
+	}
+	*cur = '\0';
+
+	return(cur-out);
+}
+
+void aribDecoderFinish(ARIB_DECODER *dec)
+{
+	aribDecoderInit(dec);
+}
+
+size_t aribTOutf8(const uint8_t *input, size_t length, uint8_t *out, size_t outSize)
+{
+	ARIB_DECODER dec;
+	size_t n;
+
+	aribDecoderInit(&dec);
+	n = aribDecoderFeed(&dec, input, length, out, outSize);
+	aribDecoderFinish(&dec);
+
+	return(n);
+}
@@ -0,0 +1,119 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* 関数名：aribRunLength                                                      */
+/* 機能  ：ARIB文字列先頭から制御符号を含まない文字の並びの長さを求める       */
+/*           aribTOsjisBuf / aribTOutf8 がまとめて変換する範囲の判定に使う    */
+/*                                                                            */
+/* size_t aribRunLength(const uint8_t *p, size_t len, uint8_t side)           */
+/*            p     :ARIB文字列                                               */
+/*            len   :ARIB文字列byte数                                         */
+/*            side  :0x00 GL(0x21-0x7E) の並び  0x80 GR(0xA1-0xFE) の並び     */
+/*            戻値  :先頭から続く side 側の文字byte数                         */
+/*                                                                            */
+/* x86 では 16byte(SSE2)/32byte(AVX2) 単位の比較で判定する                    */
+/* AVX2 は初回呼出し時に CPU を調べて使えるときだけ使う                       */
+/* それ以外の CPU では1byteずつ判定する                                       */
+/******************************************************************************/
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "libnkf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ARIB_RUN_X86
+#endif
+
+// side 側の文字か 0x21-0x7E / 0xA1-0xFE
+#define RUN_CHAR(c, side)	((uint8_t)((c) - (0x21|(side))) < 0x5E)
+
+static size_t runScalar(const uint8_t *p, size_t len, uint8_t side)
+{
+	size_t i;
+
+	for(i=0; i<len && RUN_CHAR(p[i], side); i++){
+		;
+	}
+	return(i);
+}
+
+#ifdef ARIB_RUN_X86
+/******************************************************************************/
+/* 符号なしの範囲比較は SSE2/AVX2 にないので                                  */
+/* 先頭 0x21|side が -128 になるようずらして符号付き比較 (< -128+0x5E) にする */
+/******************************************************************************/
+__attribute__((target("sse2")))
+static size_t runSse2(const uint8_t *p, size_t len, uint8_t side)
+{
+	const __m128i bias	= _mm_set1_epi8((char)(0x80-(0x21|side)));
+	const __m128i limit	= _mm_set1_epi8((char)(-128+0x5E));
+	size_t i = 0;
+
+	for(; i+16<=len; i+=16){
+		__m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(p+i)), bias);
+		uint32_t m = _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+		if(m!=0xffff){
+			return(i+__builtin_ctz(~m));
+		}
+	}
+	return(i+runScalar(p+i, len-i, side));
+}
+
+__attribute__((target("avx2")))
+static size_t runAvx2(const uint8_t *p, size_t len, uint8_t side)
+{
+	const __m256i bias	= _mm256_set1_epi8((char)(0x80-(0x21|side)));
+	const __m256i limit	= _mm256_set1_epi8((char)(-128+0x5E));
+	size_t i = 0;
+
+	for(; i+32<=len; i+=32){
+		__m256i v = _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(p+i)), bias);
+		uint32_t m = _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, v));
+		if(m!=0xffffffff){
+			return(i+__builtin_ctz(~m));
+		}
+	}
+	return(i+runSse2(p+i, len-i, side));
+}
+#endif
+
+/******************************************************************************/
+/* 内部関数                                                                   */
+/* 初回呼出し時に使用する実装を決める                                         */
+/* 複数スレッドから同時に呼ばれても同じ値を書き込むだけなので問題ない         */
+/******************************************************************************/
+static size_t runResolve(const uint8_t *p, size_t len, uint8_t side);
+
+static size_t (*runImpl)(const uint8_t *, size_t, uint8_t) = runResolve;
+
+static size_t runResolve(const uint8_t *p, size_t len, uint8_t side)
+{
+	size_t (*impl)(const uint8_t *, size_t, uint8_t) = runScalar;
+
+#ifdef ARIB_RUN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		impl = runAvx2;
+	}else if(__builtin_cpu_supports("sse2")){
+		impl = runSse2;
+	}
+#endif
+	// 環境変数 ARIB_RUN_SCALAR があれば比較用に1byteずつの判定にする
+	if(getenv("ARIB_RUN_SCALAR")!=NULL){
+		impl = runScalar;
+	}
+	__atomic_store_n(&runImpl, impl, __ATOMIC_RELAXED);
+	return(impl(p, len, side));
+}
+
+size_t aribRunLength(const uint8_t *p, size_t len, uint8_t side)
+{
+	// 短い並びは呼び分けより1byteずつの方が速い
+	if(len<16){
+		return(runScalar(p, len, side));
+	}
+	return(__atomic_load_n(&runImpl, __ATOMIC_RELAXED)(p, len, side));
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,8 +16,71 @@ nkf_convert(unsigned char* str, int strlen, char* opts, int optslen);
 extern const char*
 nkf_guess(unsigned char* str, int strlen);
 
+/* 変換コンテキスト スレッド毎に作成すれば並行して変換できる */
+typedef struct nkf_ctx NKF_CTX;
+
+extern NKF_CTX*
+nkf_ctx_new(void);
+
+extern unsigned char*
+nkf_ctx_convert(NKF_CTX* ctx, unsigned char* str, int strlen, char* opts, int optslen);
+
+extern void
+nkf_ctx_free(NKF_CTX* ctx);
+
+/* 変換ハンドル オプション解析済みで出力バッファを使い回す */
+typedef struct nkf_handle NKF_HANDLE;
+
+extern NKF_HANDLE*
+nkf_open(char* opts, int optslen);
+
+extern unsigned char*
+nkf_handle_convert(NKF_HANDLE* h, unsigned char* str, int strlen, int* outlen);
+
+extern void
+nkf_close(NKF_HANDLE* h);
+
 extern unsigned char *aribTOsjis(unsigned char *input, size_t length);
 
+/* 出力バッファに必要なbyte数 (1入力byteあたり最大2byte + 終端) */
+#define ARIB_SJIS_BUFSIZE(len)	((len)*2+1)
+
+extern size_t aribTOsjisBuf(const uint8_t *input, size_t length, uint8_t *sjis, size_t sjisSize);
+
+/* ARIB 8単位符号 → UTF-8 直接変換 (aribTOutf8.c) */
+#define ARIB_PENDING_MAX	8	/* 入力の区切りで途中になった符号列の最大byte数 */
+
+typedef struct {
+	uint16_t	G[4];			/* G0-G3 に指示した符号集合 種別<<8|終端符号 */
+	uint8_t		GL;				/* GL に呼び出した G0-G3 */
+	uint8_t		GR;				/* GR に呼び出した G0-G3 */
+	int8_t		singleShift;	/* SS2/SS3 の G2/G3 -1:なし */
+	uint8_t		csi;			/* CSI の終端待ち */
+	uint8_t		numOfPending;	/* 前回の入力末尾で途中だった符号列 */
+	uint8_t		pending[ARIB_PENDING_MAX];
+} ARIB_DECODER;
+
+/* 出力バッファに必要なbyte数 (1入力byteあたり最大4byte + 終端) */
+#define ARIB_UTF8_BUFSIZE(len)	((len)*4+1)
+/* aribDecoderFeed の出力バッファに必要なbyte数 (前回の途中の符号列を含む) */
+#define ARIB_UTF8_FEEDSIZE(len)	ARIB_UTF8_BUFSIZE((len)+ARIB_PENDING_MAX)
+
+extern void aribDecoderInit(ARIB_DECODER *dec);
+extern size_t aribDecoderFeed(ARIB_DECODER *dec, const uint8_t *input, size_t length, uint8_t *out, size_t outSize);
+extern void aribDecoderFinish(ARIB_DECODER *dec);
+extern size_t aribTOutf8(const uint8_t *input, size_t length, uint8_t *out, size_t outSize);
+
+/* 制御符号を含まない GL(side=0x00)/GR(side=0x80) 文字の並びの長さ (aribrun.c) */
+extern size_t aribRunLength(const uint8_t *p, size_t len, uint8_t side);
+
+/* ARIB文字列 → UTF-8 変換結果のインターンキャッシュ (aribcache.c) */
+typedef struct aribCache ARIB_CACHE;
+
+extern ARIB_CACHE *aribCacheNew(void);
+extern const uint8_t *aribCacheUtf8(ARIB_CACHE *cache, const uint8_t *arib, size_t len, size_t *utf8Len);
+extern void aribCacheLimit(ARIB_CACHE *cache, size_t maxBytes);
+extern void aribCacheFree(ARIB_CACHE *cache);
+
 #ifdef __cplusplus
 }   /* extern "C" */
 #endif
@@ -0,0 +1,1388 @@
+//345678901234567890123456789012345678901234567890123456789012345678901234567890
+/******************************************************************************/
+/* ts_scan                                                                    */
+/* TSファイルを1回だけ読み、登録した複数の解析(コンシューマー)に              */
+/* パケット・セクションを配る                                                 */
+/*                                                                            */
+/* 使用方法： ./ts_scan [-c pid,check,sdt,eit] [-o dir] [-r] TSfile ...       */
+/*   -c  実行する解析 カンマ区切り (省略時は全て)                             */
+/*         pid   PID毎のパケット数・スクランブル数 (ts_dump 相当の統計)       */
+/*         check 同期外れ・TEI・連続性指標・セクションCRCの異常数             */
+/*         sdt   SDT のサービスとCVI (cvi_scan -x 形式)                       */
+/*         eit   EIT のイベント一覧 (TAB区切り)                               */
+/*   -o  解析毎の結果を dir/TSファイル名.解析名 に出力する                    */
+/*       省略時は標準出力にファイル・解析毎に続けて出力する                   */
+/*   -r  io_uring を使わず read() で読む                                      */
+/*       通常ファイルは io_uring で複数バッファを先読みし、読込と解析を重ねる */
+/*                                                                            */
+/* セクションの組み立てとCRC計算は PID 毎に1回だけ行い、                      */
+/* そのPIDを登録した全ての解析に同じセクションを渡す                          */
+/******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// io_uring のヘッダが無い環境では read() のみ
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "libnkf.h"
+
+#define TS_PACKETSIZE	188
+#define TS_NUM_PID		0x2000
+#define MAX_CONSUMERS	8
+
+/****************************************************************/
+/* 読込全体の統計 各解析の終了処理に渡す                        */
+/****************************************************************/
+typedef struct {
+	uint64_t	packets;				// 読んだパケット数
+	uint64_t	syncLoss;				// 同期外れ回数
+	uint64_t	skipped;				// 同期外れで読み飛ばしたbyte数
+} READ_STATS;
+
+/****************************************************************/
+/* 解析(コンシューマー)                                         */
+/* packet  : 全パケットを受け取る NULL:不要                     */
+/* pids    : section で受け取るPID 0xffff終端 NULL:不要         */
+/* section : 組み立てたセクション crcOk:false はCRC不一致       */
+/****************************************************************/
+typedef struct {
+	const char		*name;
+	void			*(*init)(void);
+	void			(*packet)(void *ctx, const uint8_t *packet, uint16_t pid);
+	const uint16_t	*pids;
+	void			(*section)(void *ctx, uint16_t pid, const uint8_t *section, size_t len, bool crcOk);
+	void			(*finish)(void *ctx, const READ_STATS *stats, FILE *out);
+	void			(*free)(void *ctx);
+} CONSUMER;
+
+/****************************************************************/
+/* CRC32 (MPEG-2)                                               */
+/****************************************************************/
+static uint32_t crcTable[256];
+
+static void crcTableInit(void)
+{
+	for(uint32_t i=0; i<256; i++){
+		uint32_t c = i<<24;
+		for(int j=0; j<8; j++){
+			c = (c & 0x80000000) ? (c<<1)^0x04c11db7 : c<<1;
+		}
+		crcTable[i] = c;
+	}
+}
+
+// CRC32 を含めたセクション全体で計算すると 0 になる
+static uint32_t crc32Mpeg(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+
+	for(size_t i=0; i<len; i++){
+		crc = crc<<8 ^ crcTable[(crc>>24 ^ p[i]) & 0xff];
+	}
+	return(crc);
+}
+
+/****************************************************************/
+/* uint64_t キー → 値 のハッシュ表 (オープンアドレス法)         */
+/* value==NULL:空き                                             */
+/****************************************************************/
+typedef struct {
+	uint64_t	*key;
+	void		**value;
+	size_t		numOfSlots;
+	size_t		numOfEntries;
+} U64_MAP;
+
+static uint64_t mapHash(uint64_t x)
+{
+	x ^= x>>33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x>>33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x>>33;
+	return(x);
+}
+
+static void *mapGet(U64_MAP *map, uint64_t key)
+{
+	if(map->numOfSlots==0){
+		return(NULL);
+	}
+	for(size_t k=mapHash(key) & (map->numOfSlots-1); map->value[k]!=NULL; k=(k+1) & (map->numOfSlots-1)){
+		if(map->key[k]==key){
+			return(map->value[k]);
+		}
+	}
+	return(NULL);
+}
+
+// 登録済みなら値を置き換える
+static bool mapPut(U64_MAP *map, uint64_t key, void *value)
+{
+	size_t k;
+
+	if((map->numOfEntries+1)*4 > map->numOfSlots*3){
+		size_t numOfSlots = (map->numOfSlots==0) ? 256 : map->numOfSlots*2;
+		uint64_t *newKey = calloc(numOfSlots, sizeof(uint64_t));
+		void **newValue = calloc(numOfSlots, sizeof(void *));
+		if(newKey==NULL || newValue==NULL){
+			free(newKey);
+			free(newValue);
+			return(false);
+		}
+		for(size_t i=0; i<map->numOfSlots; i++){
+			if(map->value[i]==NULL){
+				continue;
+			}
+			for(k=mapHash(map->key[i]) & (numOfSlots-1); newValue[k]!=NULL; k=(k+1) & (numOfSlots-1)){
+				;
+			}
+			newKey[k]	= map->key[i];
+			newValue[k]	= map->value[i];
+		}
+		free(map->key);
+		free(map->value);
+		map->key		= newKey;
+		map->value		= newValue;
+		map->numOfSlots	= numOfSlots;
+	}
+	for(k=mapHash(key) & (map->numOfSlots-1); map->value[k]!=NULL; k=(k+1) & (map->numOfSlots-1)){
+		if(map->key[k]==key){
+			map->value[k] = value;
+			return(true);
+		}
+	}
+	map->key[k]		= key;
+	map->value[k]	= value;
+	map->numOfEntries++;
+	return(true);
+}
+
+static void mapFree(U64_MAP *map)
+{
+	free(map->key);
+	free(map->value);
+	memset(map, '\0', sizeof(U64_MAP));
+}
+
+// 同じ (table_id, 拡張識別, onid, tsid, section_number) の同じバージョンは1回だけ解析する
+// 戻値:true 未解析のセクション
+static bool sectionIsNew(U64_MAP *seen, const uint8_t *section, uint16_t onid, uint16_t tsid)
+{
+	uint64_t key = (uint64_t)section[0]<<56 | (uint64_t)(section[3]<<8 | section[4])<<40
+				 | (uint64_t)onid<<24 | (uint64_t)tsid<<8 | section[6];
+	uintptr_t version = (section[5]>>1 & 0x1f) + 1;
+
+	if((uintptr_t)mapGet(seen, key)==version){
+		return(false);
+	}
+	mapPut(seen, key, (void *)version);
+	return(true);
+}
+
+/****************************************************************/
+/* pid : PID毎の統計                                            */
+/****************************************************************/
+typedef struct {
+	uint64_t	packets[TS_NUM_PID];
+	uint64_t	scrambled[TS_NUM_PID];	// transport_scrambling_control!=0
+	uint64_t	unitStart[TS_NUM_PID];	// payload_unit_start_indicator=1
+} PID_STATS;
+
+static void *pidInit(void)
+{
+	return(calloc(1, sizeof(PID_STATS)));
+}
+
+static void pidPacket(void *ctx, const uint8_t *packet, uint16_t pid)
+{
+	PID_STATS *st = ctx;
+
+	st->packets[pid]++;
+	if(packet[3]>>6 & 0x03){
+		st->scrambled[pid]++;
+	}
+	if(packet[1] & 0x40){
+		st->unitStart[pid]++;
+	}
+}
+
+static void pidFinish(void *ctx, const READ_STATS *stats, FILE *out)
+{
+	PID_STATS *st = ctx;
+
+	fprintf(out, "PID   packets        ratio    scrambled      unit_start\n");
+	for(uint16_t pid=0; pid<TS_NUM_PID; pid++){
+		if(st->packets[pid]==0){
+			continue;
+		}
+		fprintf(out, "%04" PRIx16"  %-13" PRIu64"  %6.2f%%  %-13" PRIu64"  %" PRIu64"\n",
+				pid, st->packets[pid], stats->packets ? 100.0*st->packets[pid]/stats->packets : 0.0,
+				st->scrambled[pid], st->unitStart[pid]);
+	}
+	fprintf(out, "total %" PRIu64"\n", stats->packets);
+}
+
+/****************************************************************/
+/* check : TSの異常検出                                         */
+/* 連続性指標はペイロードのあるパケットで前回+1 (重送1回は可)   */
+/* ヌルパケットと discontinuity_indicator 付きは数えない        */
+/****************************************************************/
+typedef struct {
+	int8_t		lastCounter[TS_NUM_PID];	// -1:未受信
+	bool		duplicated[TS_NUM_PID];		// 直前が重送
+	uint64_t	ccErrors[TS_NUM_PID];
+	uint64_t	teiErrors[TS_NUM_PID];		// transport_error_indicator=1
+	uint64_t	crcErrors[TS_NUM_PID];
+	uint64_t	sections[TS_NUM_PID];
+} CHECK_STATS;
+
+static const uint16_t checkPids[] = {0x0000, 0x0001, 0x0010, 0x0011, 0x0012, 0x0014, 0x0026, 0x0027, 0x0029, 0xffff};
+
+static void *checkInit(void)
+{
+	CHECK_STATS *st = calloc(1, sizeof(CHECK_STATS));
+
+	if(st!=NULL){
+		memset(st->lastCounter, 0xff, sizeof(st->lastCounter));
+	}
+	return(st);
+}
+
+static void checkPacket(void *ctx, const uint8_t *packet, uint16_t pid)
+{
+	CHECK_STATS *st = ctx;
+	uint8_t afc = packet[3]>>4 & 0x03;
+	int8_t cc = packet[3] & 0x0f;
+
+	if(packet[1] & 0x80){
+		st->teiErrors[pid]++;
+	}
+	if(pid==0x1fff || !(afc & 0b01)){
+		return;
+	}
+	// discontinuity_indicator
+	if((afc & 0b10) && packet[4]>0 && (packet[5] & 0x80)){
+		st->lastCounter[pid] = cc;
+		st->duplicated[pid] = false;
+		return;
+	}
+	if(st->lastCounter[pid]>=0){
+		if(cc==st->lastCounter[pid] && !st->duplicated[pid]){
+			st->duplicated[pid] = true;
+			return;
+		}
+		if(cc!=((st->lastCounter[pid]+1) & 0x0f)){
+			st->ccErrors[pid]++;
+		}
+	}
+	st->lastCounter[pid] = cc;
+	st->duplicated[pid] = false;
+}
+
+static void checkSection(void *ctx, uint16_t pid, const uint8_t *section, size_t len, bool crcOk)
+{
+	CHECK_STATS *st = ctx;
+
+	st->sections[pid]++;
+	if(!crcOk){
+		st->crcErrors[pid]++;
+	}
+}
+
+static void checkFinish(void *ctx, const READ_STATS *stats, FILE *out)
+{
+	CHECK_STATS *st = ctx;
+	uint64_t cc = 0, tei = 0, crc = 0;
+
+	fprintf(out, "sync_loss %" PRIu64" (skipped %" PRIu64" byte)\n", stats->syncLoss, stats->skipped);
+	fprintf(out, "PID   cc_error       tei_error      sections       crc_error\n");
+	for(uint16_t pid=0; pid<TS_NUM_PID; pid++){
+		if(st->ccErrors[pid]==0 && st->teiErrors[pid]==0 && st->crcErrors[pid]==0 && st->sections[pid]==0){
+			continue;
+		}
+		fprintf(out, "%04" PRIx16"  %-13" PRIu64"  %-13" PRIu64"  %-13" PRIu64"  %" PRIu64"\n",
+				pid, st->ccErrors[pid], st->teiErrors[pid], st->sections[pid], st->crcErrors[pid]);
+		cc += st->ccErrors[pid];
+		tei += st->teiErrors[pid];
+		crc += st->crcErrors[pid];
+	}
+	fprintf(out, "total cc_error %" PRIu64" tei_error %" PRIu64" crc_error %" PRIu64"\n", cc, tei, crc);
+}
+
+/****************************************************************/
+/* sdt : SDT(0x42/0x46) のサービスとCA契約情報                  */
+/****************************************************************/
+typedef struct {
+	uint8_t			*cvi;
+	uint8_t			cviLength;
+} SDT_CVI;
+
+typedef struct {
+	uint16_t		originalNetworkId;
+	uint16_t		transportStreamId;
+	uint16_t		serviceId;
+	bool			freeCaMode;
+	const uint8_t	*serviceName;			// NULL:サービス記述子未受信
+	SDT_CVI			*cvi;
+	size_t			numOfCvi;
+} SDT_SERVICE;
+
+typedef struct {
+	U64_MAP			seen;					// 解析済みセクション
+	U64_MAP			index;					// (onid, tsid, sid) → SDT_SERVICE
+	SDT_SERVICE		**service;				// 登録順
+	size_t			numOfServices;
+	size_t			maxServices;
+	ARIB_CACHE		*text;
+} SDT_STATS;
+
+static const uint16_t sdtPids[] = {0x0011, 0xffff};
+
+static void *sdtInit(void)
+{
+	SDT_STATS *st = calloc(1, sizeof(SDT_STATS));
+
+	if(st!=NULL && (st->text = aribCacheNew())==NULL){
+		free(st);
+		return(NULL);
+	}
+	return(st);
+}
+
+static SDT_SERVICE *sdtService(SDT_STATS *st, uint16_t onid, uint16_t tsid, uint16_t sid)
+{
+	uint64_t key = (uint64_t)onid<<32 | (uint64_t)tsid<<16 | sid;
+	SDT_SERVICE *s;
+
+	if((s = mapGet(&st->index, key))!=NULL){
+		return(s);
+	}
+	if(st->numOfServices==st->maxServices){
+		size_t max = (st->maxServices==0) ? 64 : st->maxServices*2;
+		SDT_SERVICE **p = realloc(st->service, sizeof(SDT_SERVICE *)*max);
+		if(p==NULL){
+			return(NULL);
+		}
+		st->service = p;
+		st->maxServices = max;
+	}
+	if((s = calloc(1, sizeof(SDT_SERVICE)))==NULL){
+		return(NULL);
+	}
+	s->originalNetworkId	= onid;
+	s->transportStreamId	= tsid;
+	s->serviceId			= sid;
+	if(!mapPut(&st->index, key, s)){
+		free(s);
+		return(NULL);
+	}
+	st->service[st->numOfServices++] = s;
+	return(s);
+}
+
+static void sdtCvi(SDT_SERVICE *s, const uint8_t *cvi, uint8_t cviLength)
+{
+	for(size_t i=0; i<s->numOfCvi; i++){
+		if(s->cvi[i].cviLength==cviLength && !memcmp(s->cvi[i].cvi, cvi, cviLength)){
+			return;
+		}
+	}
+	SDT_CVI *p = realloc(s->cvi, sizeof(SDT_CVI)*(s->numOfCvi+1));
+	if(p==NULL){
+		return;
+	}
+	s->cvi = p;
+	if((p[s->numOfCvi].cvi = malloc(cviLength+1))==NULL){
+		return;
+	}
+	memcpy(p[s->numOfCvi].cvi, cvi, cviLength);
+	p[s->numOfCvi].cviLength = cviLength;
+	s->numOfCvi++;
+}
+
+static void sdtSection(void *ctx, uint16_t pid, const uint8_t *section, size_t len, bool crcOk)
+{
+	SDT_STATS *st = ctx;
+
+	if(!crcOk || (section[0]!=0x42 && section[0]!=0x46) || len<11+4 || !(section[5] & 0x01)){
+		return;
+	}
+	uint16_t tsid = section[3]<<8 | section[4];
+	uint16_t onid = section[8]<<8 | section[9];
+	if(!sectionIsNew(&st->seen, section, onid, tsid)){
+		return;
+	}
+
+	const uint8_t *end = section+len-4;
+	for(const uint8_t *p=section+11; p+5<=end; ){
+		uint16_t sid = p[0]<<8 | p[1];
+		bool freeCaMode = p[3]>>4 & 0x01;
+		size_t loopLength = (p[3] & 0x0f)<<8 | p[4];
+		const uint8_t *d = p+5;
+		p += 5+loopLength;
+		if(p>end){
+			break;
+		}
+		SDT_SERVICE *s = sdtService(st, onid, tsid, sid);
+		if(s==NULL){
+			continue;
+		}
+		s->freeCaMode = freeCaMode;
+		for(; d+2<=p && d+2+d[1]<=p; d+=2+d[1]){
+			const uint8_t *body = d+2;
+			uint8_t dlen = d[1];
+			if(d[0]==0x48 && s->serviceName==NULL && dlen>=2){		// サービス記述子
+				uint8_t providerLength = body[1];
+				if(2+providerLength+1<=dlen && 2+providerLength+1+body[2+providerLength]<=dlen){
+					s->serviceName = aribCacheUtf8(st->text, body+3+providerLength, body[2+providerLength], NULL);
+				}
+			}else if(d[0]==0xcb && dlen>=4){						// CA 契約情報記述子
+				size_t numOfComponent = body[2] & 0x0f;
+				if(3+numOfComponent+1<=dlen && 3+numOfComponent+1+body[3+numOfComponent]<=dlen){
+					sdtCvi(s, body+4+numOfComponent, body[3+numOfComponent]);
+				}
+			}
+		}
+	}
+}
+
+static int compare_service(const void *a, const void *b)
+{
+	const SDT_SERVICE *x = *(SDT_SERVICE **)a;
+	const SDT_SERVICE *y = *(SDT_SERVICE **)b;
+
+	if(x->originalNetworkId!=y->originalNetworkId){
+		return(x->originalNetworkId - y->originalNetworkId);
+	}
+	if(x->serviceId!=y->serviceId){
+		return(x->serviceId - y->serviceId);
+	}
+	return(x->transportStreamId - y->transportStreamId);
+}
+
+static void sdtFinish(void *ctx, const READ_STATS *stats, FILE *out)
+{
+	SDT_STATS *st = ctx;
+
+	if(st->numOfServices>0){
+		qsort(st->service, st->numOfServices, sizeof(SDT_SERVICE *), compare_service);
+	}
+	fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n");
+	fprintf(out, "<CVI_INFOMATION>\n\n");
+	for(size_t i=0; i<st->numOfServices; i++){
+		SDT_SERVICE *s = st->service[i];
+		if(!s->freeCaMode){
+			continue;
+		}
+		fprintf(out, "\t<ServiceID sid=\"%d\" tsid=\"%d\" nid=\"%d\" name=\"%s\" >\n",
+				s->serviceId, s->transportStreamId, s->originalNetworkId,
+				s->serviceName ? (const char *)s->serviceName : "");
+		fprintf(out, "\t\t<cvi>\n\t\t\t");
+		if(s->numOfCvi>0){
+			for(size_t k=0; k<s->cvi[0].cviLength; k++){
+				fprintf(out, "%02" PRIX8"", s->cvi[0].cvi[k]);
+			}
+			fprintf(out, "\n\t\t</cvi>\n");
+		}
+		fprintf(out, "\t</ServiceID>\n");
+	}
+	fprintf(out, "</CVI_INFOMATION>\n\n");
+}
+
+static void sdtFree(void *ctx)
+{
+	SDT_STATS *st = ctx;
+
+	for(size_t i=0; i<st->numOfServices; i++){
+		for(size_t k=0; k<st->service[i]->numOfCvi; k++){
+			free(st->service[i]->cvi[k].cvi);
+		}
+		free(st->service[i]->cvi);
+		free(st->service[i]);
+	}
+	free(st->service);
+	mapFree(&st->seen);
+	mapFree(&st->index);
+	aribCacheFree(st->text);
+	free(st);
+}
+
+/****************************************************************/
+/* eit : EIT(0x4E-0x6F) のイベント一覧                          */
+/* 同じイベントはバージョンの異なるセクションを後から受信した   */
+/* 場合にその内容で置き換える                                   */
+/****************************************************************/
+typedef struct {
+	uint16_t		originalNetworkId;
+	uint16_t		transportStreamId;
+	uint16_t		serviceId;
+	uint16_t		eventId;
+	uint64_t		startTime;				// MJD 16bit + BCD 24bit
+	uint32_t		duration;				// BCD 24bit
+	uint8_t			version;
+	const uint8_t	*title;					// NULL:短形式イベント記述子無し
+} EIT_EVENT;
+
+typedef struct {
+	U64_MAP			seen;					// 解析済みセクション
+	U64_MAP			index;					// (onid, tsid, sid, event_id) → EIT_EVENT
+	EIT_EVENT		**event;				// 登録順
+	size_t			numOfEvents;
+	size_t			maxEvents;
+	ARIB_CACHE		*text;
+} EIT_STATS;
+
+static const uint16_t eitPids[] = {0x0012, 0x0026, 0x0027, 0xffff};
+
+static void *eitInit(void)
+{
+	EIT_STATS *st = calloc(1, sizeof(EIT_STATS));
+
+	if(st!=NULL && (st->text = aribCacheNew())==NULL){
+		free(st);
+		return(NULL);
+	}
+	return(st);
+}
+
+static EIT_EVENT *eitEvent(EIT_STATS *st, uint16_t onid, uint16_t tsid, uint16_t sid, uint16_t eid)
+{
+	uint64_t key = (uint64_t)onid<<48 | (uint64_t)tsid<<32 | (uint64_t)sid<<16 | eid;
+	EIT_EVENT *e;
+
+	if((e = mapGet(&st->index, key))!=NULL){
+		return(e);
+	}
+	if(st->numOfEvents==st->maxEvents){
+		size_t max = (st->maxEvents==0) ? 1024 : st->maxEvents*2;
+		EIT_EVENT **p = realloc(st->event, sizeof(EIT_EVENT *)*max);
+		if(p==NULL){
+			return(NULL);
+		}
+		st->event = p;
+		st->maxEvents = max;
+	}
+	if((e = calloc(1, sizeof(EIT_EVENT)))==NULL){
+		return(NULL);
+	}
+	e->originalNetworkId	= onid;
+	e->transportStreamId	= tsid;
+	e->serviceId			= sid;
+	e->eventId				= eid;
+	e->version				= 0xff;
+	if(!mapPut(&st->index, key, e)){
+		free(e);
+		return(NULL);
+	}
+	st->event[st->numOfEvents++] = e;
+	return(e);
+}
+
+static void eitSection(void *ctx, uint16_t pid, const uint8_t *section, size_t len, bool crcOk)
+{
+	EIT_STATS *st = ctx;
+
+	if(!crcOk || section[0]<0x4e || section[0]>0x6f || len<14+4 || !(section[5] & 0x01)){
+		return;
+	}
+	uint16_t sid  = section[3]<<8 | section[4];
+	uint16_t tsid = section[8]<<8 | section[9];
+	uint16_t onid = section[10]<<8 | section[11];
+	uint8_t version = section[5]>>1 & 0x1f;
+	if(!sectionIsNew(&st->seen, section, onid, tsid)){
+		return;
+	}
+
+	const uint8_t *end = section+len-4;
+	for(const uint8_t *p=section+14; p+12<=end; ){
+		uint16_t eid = p[0]<<8 | p[1];
+		uint64_t startTime = (uint64_t)p[2]<<32 | (uint64_t)p[3]<<24 | p[4]<<16 | p[5]<<8 | p[6];
+		uint32_t duration = p[7]<<16 | p[8]<<8 | p[9];
+		size_t loopLength = (p[10] & 0x0f)<<8 | p[11];
+		const uint8_t *d = p+12;
+		p += 12+loopLength;
+		if(p>end){
+			break;
+		}
+		EIT_EVENT *e = eitEvent(st, onid, tsid, sid, eid);
+		if(e==NULL || e->version==version){
+			continue;
+		}
+		e->version		= version;
+		e->startTime	= startTime;
+		e->duration		= duration;
+		e->title		= NULL;
+		for(; d+2<=p && d+2+d[1]<=p; d+=2+d[1]){
+			// 短形式イベント記述子 ISO_639_language_code(3) event_name_length event_name ...
+			if(d[0]==0x4d && d[1]>=4 && 4+d[5]<=d[1]){
+				e->title = aribCacheUtf8(st->text, d+6, d[5], NULL);
+				break;
+			}
+		}
+	}
+}
+
+static int compare_event(const void *a, const void *b)
+{
+	const EIT_EVENT *x = *(EIT_EVENT **)a;
+	const EIT_EVENT *y = *(EIT_EVENT **)b;
+
+	if(x->originalNetworkId!=y->originalNetworkId){
+		return(x->originalNetworkId - y->originalNetworkId);
+	}
+	if(x->serviceId!=y->serviceId){
+		return(x->serviceId - y->serviceId);
+	}
+	if(x->startTime!=y->startTime){
+		return((x->startTime<y->startTime) ? -1 : 1);
+	}
+	return(x->eventId - y->eventId);
+}
+
+#define BCD(b)	((int)(((b)>>4 & 0x0f)*10 + ((b) & 0x0f)))
+
+// start_time を YYYY/MM/DD hh:mm:ss にする (ARIB STD-B10 付録の MJD 変換)
+static void printStart(FILE *out, uint64_t startTime)
+{
+	if(startTime==0xffffffffffULL){
+		fprintf(out, "-");
+		return;
+	}
+	int mjd = startTime>>24 & 0xffff;
+	int y = (int)((mjd-15078.2)/365.25);
+	int m = (int)((mjd-14956.1-(int)(y*365.25))/30.6001);
+	int d = mjd-14956-(int)(y*365.25)-(int)(m*30.6001);
+	int k = (m==14 || m==15) ? 1 : 0;
+	fprintf(out, "%04d/%02d/%02d %02d:%02d:%02d", y+k+1900, m-1-k*12, d,
+			BCD(startTime>>16 & 0xff), BCD(startTime>>8 & 0xff), BCD(startTime & 0xff));
+}
+
+static void eitFinish(void *ctx, const READ_STATS *stats, FILE *out)
+{
+	EIT_STATS *st = ctx;
+
+	if(st->numOfEvents>0){
+		qsort(st->event, st->numOfEvents, sizeof(EIT_EVENT *), compare_event);
+	}
+	fprintf(out, "onid\ttsid\tsid\tevent_id\tstart\tduration\ttitle\n");
+	for(size_t i=0; i<st->numOfEvents; i++){
+		EIT_EVENT *e = st->event[i];
+		fprintf(out, "%d\t%d\t%d\t%d\t", e->originalNetworkId, e->transportStreamId, e->serviceId, e->eventId);
+		printStart(out, e->startTime);
+		if(e->duration==0xffffff){
+			fprintf(out, "\t-\t");
+		}else{
+			fprintf(out, "\t%02d:%02d:%02d\t", BCD(e->duration>>16 & 0xff), BCD(e->duration>>8 & 0xff), BCD(e->duration & 0xff));
+		}
+		// TAB区切りを崩さないよう制御文字は空白にする
+		for(const uint8_t *t=e->title; t!=NULL && *t!='\0'; t++){
+			fputc((*t<0x20) ? ' ' : *t, out);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void eitFree(void *ctx)
+{
+	EIT_STATS *st = ctx;
+
+	for(size_t i=0; i<st->numOfEvents; i++){
+		free(st->event[i]);
+	}
+	free(st->event);
+	mapFree(&st->seen);
+	mapFree(&st->index);
+	aribCacheFree(st->text);
+	free(st);
+}
+
+static void statsFree(void *ctx)
+{
+	free(ctx);
+}
+
+static const CONSUMER consumers[] = {
+	{"pid",		pidInit,	pidPacket,		NULL,		NULL,			pidFinish,		statsFree},
+	{"check",	checkInit,	checkPacket,	checkPids,	checkSection,	checkFinish,	statsFree},
+	{"sdt",		sdtInit,	NULL,			sdtPids,	sdtSection,		sdtFinish,		sdtFree},
+	{"eit",		eitInit,	NULL,			eitPids,	eitSection,		eitFinish,		eitFree},
+};
+#define NUM_CONSUMERS	(sizeof(consumers)/sizeof(CONSUMER))
+
+/****************************************************************/
+/* PID単位のセクション組み立て                                  */
+/* 1パケットに複数セクションがある場合やアダプテーション        */
+/* フィールド付きも扱う (eit_scan --report と同じ処理)          */
+/****************************************************************/
+typedef struct {
+	bool		sync;							// セクション先頭から受信中
+	int8_t		continuityCounter;
+	size_t		len;
+	uint8_t		buf[4096+TS_PACKETSIZE];
+} SECTION_ASSEMBLER;
+
+typedef struct {
+	const CONSUMER	*consumer[MAX_CONSUMERS];	// 実行する解析
+	void			*ctx[MAX_CONSUMERS];
+	size_t			numOfConsumers;
+	const CONSUMER	*packetConsumer[MAX_CONSUMERS];	// packet を受け取る解析
+	void			*packetCtx[MAX_CONSUMERS];
+	size_t			numOfPacketConsumers;
+	uint8_t			route[TS_NUM_PID];			// セクションを受け取る解析のビットマスク
+	SECTION_ASSEMBLER	*assembler[TS_NUM_PID];	// route!=0 のPIDのみ
+	bool			lost;						// 同期外れ中
+	READ_STATS		stats;
+} PIPELINE;
+
+// 完成したセクションを route に登録された解析に配る
+static void sectionDispatch(PIPELINE *pl, uint16_t pid, const uint8_t *sec, size_t secLen)
+{
+	// section_syntax_indicator=1 のセクションは CRC32 を含めて計算すると 0
+	bool crcOk = !(sec[1] & 0x80) || crc32Mpeg(sec, secLen)==0;
+
+	for(size_t i=0; i<pl->numOfConsumers; i++){
+		if(pl->route[pid] & 1<<i){
+			pl->consumer[i]->section(pl->ctx[i], pid, sec, secLen, crcOk);
+		}
+	}
+}
+
+static void sectionEmit(PIPELINE *pl, uint16_t pid, SECTION_ASSEMBLER *sa)
+{
+	size_t done = 0;
+
+	while(sa->len-done>=3){
+		uint8_t *sec = sa->buf+done;
+		size_t secLen = 3 + ((sec[1]&0x0f)<<8 | sec[2]);
+		// 0xFF はスタッフィング 以降このパケットにセクションは無い
+		if(sec[0]==0xff){
+			done = sa->len;
+			sa->sync = false;
+			break;
+		}
+		if(sa->len-done<secLen){
+			break;
+		}
+		sectionDispatch(pl, pid, sec, secLen);
+		done += secLen;
+	}
+	if(done>0){
+		memmove(sa->buf, sa->buf+done, sa->len-done);
+		sa->len -= done;
+	}
+}
+
+static void sectionFeed(PIPELINE *pl, uint16_t pid, SECTION_ASSEMBLER *sa, const uint8_t *packet)
+{
+	uint8_t afc = packet[3]>>4 & 0x03;
+	int8_t cc = packet[3] & 0x0f;
+	size_t offset = 4;
+
+	if(!(afc & 0b01)){
+		return;
+	}
+	if(afc & 0b10){
+		offset += 1+packet[4];
+	}
+	if(offset>=TS_PACKETSIZE){
+		sa->sync = false;
+		sa->len = 0;
+		return;
+	}
+	// 連続性指標が飛んだら組み立て中のセクションは破棄する
+	if(sa->continuityCounter>=0 && cc==sa->continuityCounter){
+		return;
+	}
+	if(sa->continuityCounter>=0 && cc!=((sa->continuityCounter+1) & 0x0f)){
+		sa->sync = false;
+		sa->len = 0;
+	}
+	sa->continuityCounter = cc;
+
+	if(packet[1] & 0x40){
+		size_t pointer = packet[offset++];
+		if(offset+pointer>TS_PACKETSIZE){
+			sa->sync = false;
+			sa->len = 0;
+			return;
+		}
+		// ポインタフィールドまでは前のセクションの続き
+		if(sa->sync && pointer>0){
+			memcpy(sa->buf+sa->len, packet+offset, pointer);
+			sa->len += pointer;
+			sectionEmit(pl, pid, sa);
+		}
+		sa->sync = true;
+		sa->len = 0;
+		offset += pointer;
+	}else if(!sa->sync){
+		return;
+	}
+	if(sa->len+TS_PACKETSIZE-offset > sizeof(sa->buf)){
+		sa->sync = false;
+		sa->len = 0;
+		return;
+	}
+	memcpy(sa->buf+sa->len, packet+offset, TS_PACKETSIZE-offset);
+	sa->len += TS_PACKETSIZE-offset;
+	sectionEmit(pl, pid, sa);
+}
+
+/****************************************************************/
+/* 解析の登録                                                   */
+/****************************************************************/
+static bool pipelineInit(PIPELINE *pl, const bool *enabled)
+{
+	memset(pl, '\0', sizeof(PIPELINE));
+	for(size_t c=0; c<NUM_CONSUMERS; c++){
+		const CONSUMER *cs = &consumers[c];
+		size_t i = pl->numOfConsumers;
+		if(!enabled[c]){
+			continue;
+		}
+		if((pl->ctx[i] = cs->init())==NULL){
+			return(false);
+		}
+		pl->consumer[i] = cs;
+		pl->numOfConsumers++;
+		if(cs->packet!=NULL){
+			pl->packetConsumer[pl->numOfPacketConsumers] = cs;
+			pl->packetCtx[pl->numOfPacketConsumers++] = pl->ctx[i];
+		}
+		for(const uint16_t *pid=cs->pids; pid!=NULL && *pid!=0xffff; pid++){
+			pl->route[*pid] |= 1<<i;
+			if(pl->assembler[*pid]==NULL){
+				if((pl->assembler[*pid] = calloc(1, sizeof(SECTION_ASSEMBLER)))==NULL){
+					return(false);
+				}
+				pl->assembler[*pid]->continuityCounter = -1;
+			}
+		}
+	}
+	return(true);
+}
+
+static void pipelineFree(PIPELINE *pl)
+{
+	for(size_t i=0; i<pl->numOfConsumers; i++){
+		pl->consumer[i]->free(pl->ctx[i]);
+	}
+	for(size_t pid=0; pid<TS_NUM_PID; pid++){
+		free(pl->assembler[pid]);
+	}
+}
+
+// 1パケットを全ての解析に配る
+static void pipelinePacket(PIPELINE *pl, const uint8_t *packet)
+{
+	uint16_t pid = (packet[1] & 0x1f)<<8 | packet[2];
+
+	pl->stats.packets++;
+	for(size_t i=0; i<pl->numOfPacketConsumers; i++){
+		pl->packetConsumer[i]->packet(pl->packetCtx[i], packet, pid);
+	}
+	if(pl->route[pid]!=0 && !(packet[1] & 0x80)){
+		sectionFeed(pl, pid, pl->assembler[pid], packet);
+	}
+}
+
+/****************************************************************/
+/* パケットの読込元                                             */
+/* io_uring : READ_DEPTH 個のバッファの読込を先に発行しておき、 */
+/*            解析中のバッファ以外は読込を続けさせる            */
+/*            読み終えたバッファは次の位置の読込に再利用する    */
+/* read     : io_uring が使えない場合・パイプ等通常ファイル以外 */
+/****************************************************************/
+#define READ_BUFSIZE	(TS_PACKETSIZE*4096)	// 1回の読込 770,048byte
+#define READ_DEPTH		4						// io_uring で同時に発行する読込数
+
+typedef enum {
+	SOURCE_IDLE,								// 未発行 (EOF以降)
+	SOURCE_READING,								// 読込中
+	SOURCE_DONE,								// 読込完了
+	SOURCE_ERROR,
+} SOURCE_STATE;
+
+typedef struct {
+	int				fd;
+	bool			uring;						// false:read()
+	uint8_t			*buf[READ_DEPTH];
+	size_t			filled[READ_DEPTH];			// 読込済みbyte数
+	off_t			offset[READ_DEPTH];			// バッファ先頭のファイル位置
+	SOURCE_STATE	state[READ_DEPTH];
+	size_t			head;						// 次に解析に渡すバッファ
+	bool			handed;						// head のバッファを解析に渡し済み
+	off_t			nextOffset;					// 次に発行する読込位置
+	bool			eof;
+	bool			closing;					// 読み直しをしない
+#ifdef USE_IO_URING
+	int				ringFd;
+	uint8_t			*sqMap, *cqMap;
+	size_t			sqMapSize, cqMapSize;
+	struct io_uring_sqe	*sqes;
+	size_t			sqesSize;
+	unsigned		*sqTail, *sqMask, *sqArray;
+	unsigned		*cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe	*cqes;
+	unsigned		toSubmit;
+	struct iovec	iov[READ_DEPTH];
+#endif
+} TS_SOURCE;
+
+#ifdef USE_IO_URING
+static bool uringInit(TS_SOURCE *src)
+{
+	struct io_uring_params p;
+
+	memset(&p, '\0', sizeof(p));
+	if((src->ringFd = syscall(__NR_io_uring_setup, READ_DEPTH, &p))<0){
+		return(false);
+	}
+	src->sqMapSize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	src->cqMapSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(src->cqMapSize > src->sqMapSize){
+			src->sqMapSize = src->cqMapSize;
+		}
+		src->cqMapSize = 0;
+	}
+	src->sqMap = mmap(NULL, src->sqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, src->ringFd, IORING_OFF_SQ_RING);
+	if(src->sqMap==MAP_FAILED){
+		close(src->ringFd);
+		return(false);
+	}
+	src->cqMap = src->sqMap;
+	if(src->cqMapSize>0){
+		src->cqMap = mmap(NULL, src->cqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, src->ringFd, IORING_OFF_CQ_RING);
+		if(src->cqMap==MAP_FAILED){
+			munmap(src->sqMap, src->sqMapSize);
+			close(src->ringFd);
+			return(false);
+		}
+	}
+	src->sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+	src->sqes = mmap(NULL, src->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, src->ringFd, IORING_OFF_SQES);
+	if(src->sqes==MAP_FAILED){
+		if(src->cqMapSize>0){
+			munmap(src->cqMap, src->cqMapSize);
+		}
+		munmap(src->sqMap, src->sqMapSize);
+		close(src->ringFd);
+		return(false);
+	}
+	src->sqTail		= (unsigned *)(src->sqMap + p.sq_off.tail);
+	src->sqMask		= (unsigned *)(src->sqMap + p.sq_off.ring_mask);
+	src->sqArray	= (unsigned *)(src->sqMap + p.sq_off.array);
+	src->cqHead		= (unsigned *)(src->cqMap + p.cq_off.head);
+	src->cqTail		= (unsigned *)(src->cqMap + p.cq_off.tail);
+	src->cqMask		= (unsigned *)(src->cqMap + p.cq_off.ring_mask);
+	src->cqes		= (struct io_uring_cqe *)(src->cqMap + p.cq_off.cqes);
+	src->toSubmit	= 0;
+	return(true);
+}
+
+static void uringFree(TS_SOURCE *src)
+{
+	munmap(src->sqes, src->sqesSize);
+	if(src->cqMapSize>0){
+		munmap(src->cqMap, src->cqMapSize);
+	}
+	munmap(src->sqMap, src->sqMapSize);
+	close(src->ringFd);
+}
+
+// バッファ i の残りを読む要求を積む (発行は uringEnter)
+static void uringQueue(TS_SOURCE *src, size_t i)
+{
+	unsigned tail = *src->sqTail;
+	unsigned index = tail & *src->sqMask;
+	struct io_uring_sqe *sqe = &src->sqes[index];
+
+	src->iov[i].iov_base	= src->buf[i] + src->filled[i];
+	src->iov[i].iov_len		= READ_BUFSIZE - src->filled[i];
+	memset(sqe, '\0', sizeof(struct io_uring_sqe));
+	sqe->opcode		= IORING_OP_READV;
+	sqe->fd			= src->fd;
+	sqe->addr		= (uintptr_t)&src->iov[i];
+	sqe->len		= 1;
+	sqe->off		= src->offset[i] + src->filled[i];
+	sqe->user_data	= i;
+	src->sqArray[index] = index;
+	__atomic_store_n(src->sqTail, tail+1, __ATOMIC_RELEASE);
+	src->state[i] = SOURCE_READING;
+	src->toSubmit++;
+}
+
+// 積んだ要求を発行し、wait:true なら1つ以上の完了を待つ
+static bool uringEnter(TS_SOURCE *src, bool wait)
+{
+	while(src->toSubmit>0 || wait){
+		int n = syscall(__NR_io_uring_enter, src->ringFd, src->toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(n<0){
+			if(errno==EINTR){
+				continue;
+			}
+			return(false);
+		}
+		src->toSubmit -= n;
+		if(src->toSubmit==0){
+			break;
+		}
+	}
+	return(true);
+}
+
+// 完了した読込を反映する 途中までしか読めなかった場合は残りを読み直す
+static void uringReap(TS_SOURCE *src)
+{
+	unsigned head = *src->cqHead;
+	unsigned tail = __atomic_load_n(src->cqTail, __ATOMIC_ACQUIRE);
+
+	for(; head!=tail; head++){
+		struct io_uring_cqe *cqe = &src->cqes[head & *src->cqMask];
+		size_t i = cqe->user_data;
+		if(cqe->res<0){
+			if((cqe->res==-EINTR || cqe->res==-EAGAIN) && !src->closing){
+				uringQueue(src, i);
+			}else{
+				errno = -cqe->res;
+				src->state[i] = SOURCE_ERROR;
+			}
+		}else if(cqe->res==0){
+			src->eof = true;
+			src->state[i] = SOURCE_DONE;
+		}else{
+			src->filled[i] += cqe->res;
+			if(src->filled[i]<READ_BUFSIZE && !src->closing){
+				uringQueue(src, i);
+			}else{
+				src->state[i] = SOURCE_DONE;
+			}
+		}
+	}
+	__atomic_store_n(src->cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+static bool sourceOpen(TS_SOURCE *src, const char *path, bool useUring)
+{
+	struct stat st;
+
+	memset(src, '\0', sizeof(TS_SOURCE));
+	if((src->fd = open(path, O_RDONLY))<0){
+		return(false);
+	}
+	src->buf[0] = malloc(READ_BUFSIZE);
+	if(src->buf[0]==NULL){
+		close(src->fd);
+		return(false);
+	}
+#ifdef USE_IO_URING
+	// 位置を指定して先読みするので通常ファイルのみ
+	if(useUring && fstat(src->fd, &st)==0 && S_ISREG(st.st_mode) && uringInit(src)){
+		size_t i;
+		for(i=1; i<READ_DEPTH && (src->buf[i] = malloc(READ_BUFSIZE))!=NULL; i++){
+			;
+		}
+		if(i<READ_DEPTH){
+			for(; i>1; i--){
+				free(src->buf[i-1]);
+			}
+			uringFree(src);
+			return(true);
+		}
+		src->uring = true;
+		for(i=0; i<READ_DEPTH; i++){
+			src->offset[i] = src->nextOffset;
+			src->nextOffset += READ_BUFSIZE;
+			uringQueue(src, i);
+		}
+		if(!uringEnter(src, false)){
+			// io_uring_enter が使えない 発行前なので read() に切り替える
+			for(i=1; i<READ_DEPTH; i++){
+				free(src->buf[i]);
+				src->buf[i] = NULL;
+			}
+			uringFree(src);
+			src->uring = false;
+		}
+	}
+#else
+	(void)st;
+	(void)useUring;
+#endif
+	return(true);
+}
+
+// 次のバッファを返す 前回返したバッファはこの呼び出しで再利用する
+// 戻値:読んだbyte数 0:EOF -1:読込エラー
+static ssize_t sourceNext(TS_SOURCE *src, const uint8_t **data)
+{
+	if(!src->uring){
+		size_t len = 0;
+		while(len<READ_BUFSIZE){
+			ssize_t n = read(src->fd, src->buf[0]+len, READ_BUFSIZE-len);
+			if(n<0){
+				if(errno==EINTR){
+					continue;
+				}
+				return(-1);
+			}
+			if(n==0){
+				break;
+			}
+			len += n;
+		}
+		*data = src->buf[0];
+		return(len);
+	}
+#ifdef USE_IO_URING
+	size_t i = src->head;
+	if(src->handed){
+		// 解析を終えたバッファで先の位置を読む
+		src->filled[i] = 0;
+		src->state[i] = SOURCE_IDLE;
+		if(!src->eof){
+			src->offset[i] = src->nextOffset;
+			src->nextOffset += READ_BUFSIZE;
+			uringQueue(src, i);
+			if(!uringEnter(src, false)){
+				return(-1);
+			}
+		}
+		src->head = i = (i+1) % READ_DEPTH;
+		src->handed = false;
+	}
+	while(src->state[i]==SOURCE_READING){
+		if(!uringEnter(src, true)){
+			return(-1);
+		}
+		uringReap(src);
+		if(!uringEnter(src, false)){
+			return(-1);
+		}
+	}
+	if(src->state[i]==SOURCE_ERROR){
+		return(-1);
+	}
+	src->handed = true;
+	*data = src->buf[i];
+	return(src->filled[i]);
+#else
+	return(-1);
+#endif
+}
+
+static void sourceClose(TS_SOURCE *src)
+{
+#ifdef USE_IO_URING
+	if(src->uring){
+		// 発行済みの読込が終わるまでバッファは解放できない
+		src->closing = true;
+		for(size_t i=0; i<READ_DEPTH; i++){
+			while(src->state[i]==SOURCE_READING && uringEnter(src, true)){
+				uringReap(src);
+			}
+		}
+		uringFree(src);
+	}
+#endif
+	for(size_t i=0; i<READ_DEPTH; i++){
+		free(src->buf[i]);
+	}
+	close(src->fd);
+}
+
+/****************************************************************/
+/* パケットの同期を確認して配る                                 */
+/* 0x47 が 188byte 間隔で並ばない場合は同期を取り直す           */
+/* 次のパケット先頭を確認できない末尾は残して処理したbyte数を   */
+/* 返す last:true はファイル末尾で次のパケットを確認しない      */
+/****************************************************************/
+static size_t pipelineScan(PIPELINE *pl, const uint8_t *buf, size_t len, bool last)
+{
+	size_t pos = 0;
+
+	while(len-pos>=TS_PACKETSIZE){
+		if(len-pos==TS_PACKETSIZE && !last){
+			break;
+		}
+		if(buf[pos]==0x47 && (len-pos==TS_PACKETSIZE || buf[pos+TS_PACKETSIZE]==0x47)){
+			pl->lost = false;
+			pipelinePacket(pl, buf+pos);
+			pos += TS_PACKETSIZE;
+			continue;
+		}
+		// 同期外れ 次の 0x47 + 188byte 先も 0x47 の位置まで読み飛ばす
+		if(!pl->lost){
+			pl->lost = true;
+			pl->stats.syncLoss++;
+		}
+		pl->stats.skipped++;
+		pos++;
+	}
+	return(pos);
+}
+
+/****************************************************************/
+/* ファイルを READ_BUFSIZE 単位で読み、パケットを配る           */
+/* バッファ境界を跨ぐパケットは stitch に繋いでから処理する     */
+/****************************************************************/
+static bool pipelineRun(PIPELINE *pl, const char *path, bool useUring)
+{
+	uint8_t stitch[TS_PACKETSIZE*3];
+	size_t carry = 0, off, used;
+	const uint8_t *data;
+	TS_SOURCE src;
+	ssize_t n;
+
+	if(!sourceOpen(&src, path, useUring)){
+		fprintf(stderr, "file open error : %s\n", path);
+		return(false);
+	}
+	pl->lost = false;
+	while((n = sourceNext(&src, &data))>0){
+		off = 0;
+		if(carry>0){
+			size_t take = ((size_t)n < sizeof(stitch)-carry) ? (size_t)n : sizeof(stitch)-carry;
+			memcpy(stitch+carry, data, take);
+			used = pipelineScan(pl, stitch, carry+take, false);
+			if(used>=carry){
+				off = used-carry;
+				carry = 0;
+			}else{
+				// バッファが小さく stitch 内で処理しきれなかった
+				memmove(stitch, stitch+used, carry+take-used);
+				carry = carry+take-used;
+				off = n;
+			}
+		}
+		if(off<(size_t)n){
+			off += pipelineScan(pl, data+off, n-off, false);
+			memcpy(stitch, data+off, n-off);
+			carry = n-off;
+		}
+	}
+	if(n<0){
+		fprintf(stderr, "file read error : %s : %s\n", path, strerror(errno));
+		sourceClose(&src);
+		return(false);
+	}
+	used = pipelineScan(pl, stitch, carry, true);
+	// 末尾の188byte未満
+	pl->stats.skipped += carry-used;
+	sourceClose(&src);
+	return(true);
+}
+
+// -o 指定時の出力ファイル dir/TSファイル名.解析名
+static FILE *outputOpen(const char *dir, const char *path, const char *name)
+{
+	const char *base = strrchr(path, '/');
+	char *file;
+	FILE *fp;
+
+	base = (base==NULL) ? path : base+1;
+	if((file = malloc(strlen(dir)+strlen(base)+strlen(name)+3))==NULL){
+		return(NULL);
+	}
+	sprintf(file, "%s/%s.%s", dir, base, name);
+	fp = fopen(file, "w");
+	if(fp==NULL){
+		fprintf(stderr, "file open error : %s\n", file);
+	}
+	free(file);
+	return(fp);
+}
+
+int main(int argc, char *argv[])
+{
+	bool enabled[NUM_CONSUMERS];
+	char *outDir = NULL;
+	bool useUring = true;
+	int opt;
+	int rtn = 0;
+
+	for(size_t c=0; c<NUM_CONSUMERS; c++){
+		enabled[c] = true;
+	}
+	while((opt = getopt(argc, argv, "c:o:r")) != -1){
+		switch(opt){
+			case 'c':
+				memset(enabled, '\0', sizeof(enabled));
+				for(char *name=strtok(optarg, ","); name!=NULL; name=strtok(NULL, ",")){
+					size_t c;
+					for(c=0; c<NUM_CONSUMERS && strcmp(consumers[c].name, name); c++){
+						;
+					}
+					if(c==NUM_CONSUMERS){
+						fprintf(stderr, "-c arg error %s\n", name);
+						return(-1);
+					}
+					enabled[c] = true;
+				}
+			break;
+			case 'o':
+				outDir = optarg;
+			break;
+			case 'r':
+				useUring = false;
+			break;
+			default:
+				fprintf(stderr, "Usage: %s [-c pid,check,sdt,eit] [-o dir] [-r] TSfile ...\n", argv[0]);
+				return(-1);
+		}
+	}
+	if(optind>=argc){
+		fprintf(stderr, "Usage: %s [-c pid,check,sdt,eit] [-o dir] [-r] TSfile ...\n", argv[0]);
+		return(-1);
+	}
+
+	crcTableInit();
+	for(int f=optind; f<argc; f++){
+		PIPELINE *pl = malloc(sizeof(PIPELINE));
+		if(pl==NULL || !pipelineInit(pl, enabled)){
+			fprintf(stderr, "memory allocate error\n");
+			return(-1);
+		}
+		if(!pipelineRun(pl, argv[f], useUring)){
+			rtn = -1;
+		}else{
+			for(size_t i=0; i<pl->numOfConsumers; i++){
+				FILE *out = stdout;
+				if(outDir!=NULL){
+					if((out = outputOpen(outDir, argv[f], pl->consumer[i]->name))==NULL){
+						rtn = -1;
+						continue;
+					}
+				}else{
+					fprintf(stdout, "======================== %s : %s ========================\n", argv[f], pl->consumer[i]->name);
+				}
+				pl->consumer[i]->finish(pl->ctx[i], &pl->stats, out);
+				if(out!=stdout){
+					fclose(out);
+				}
+			}
+		}
+		pipelineFree(pl);
+		free(pl);
+	}
+
+	return(rtn);
+}